@@ -81,6 +81,8 @@ usage()
 	printf("  test_http	test option that pretends that http fails\n");
 	printf("  test_update	software update to the unstable test version\n");
 	printf("  results	continuous feed of probe results\n");
+	printf("  timings	timeline of the last probe round\n");
+	printf("  stats [reset]	statistics, and set them to zero\n");
 	printf("  cmdtray	command channel for gui panel\n");
 	printf("  stoppanels	connected panels quit (for installers)\n");
 	printf("  stop		stop the daemon\n");
@@ -44,6 +44,13 @@
 #include "net_help.h"
 #include <ctype.h>
 
+/** directory with the unbound control keys, with trailing slash */
+#ifdef UB_ON_WINDOWS
+#define UNBOUND_KEYDIR "C:\\Program Files\\Unbound\\"
+#else
+#define UNBOUND_KEYDIR "/etc/unbound/"
+#endif
+
 /** append to strlist */
 void
 strlist_append(struct strlist** first, struct strlist** last, char* str)
@@ -149,6 +156,15 @@ ssllist_delete(struct ssllist* e)
 	while(p) {
 		np = p->next;
 		hashlist_delete(p->hashes);
+		if(p->sslctx) {
+			/* connections that are still open keep the context */
+			SSL_CTX_set_app_data(p->sslctx, NULL);
+			SSL_CTX_free(p->sslctx);
+		}
+		if(p->session)
+			SSL_SESSION_free(p->session);
+		if(p->cert)
+			X509_free(p->cert);
 		free(p->str);
 		free(p);
 		p = np;
@@ -228,6 +244,16 @@ static void tcp_arg(struct strlist** first4, struct strlist** last4, int* num4,
 	}
 }
 
+/** append the domain name argument on the line */
+static void name_arg(struct strlist** first, struct strlist** last, int* num,
+	char* line)
+{
+	line = get_arg(line);
+	if(line[0] == 0) return; /* ignore empty ones */
+	strlist_append(first, last, line);
+	(*num) ++;
+}
+
 static int read_hash(char* arg, struct ssllist* e)
 {
 	int i;
@@ -327,6 +353,8 @@ keyword(struct cfg* cfg, char* p)
 		cfg->verbosity = atoi(get_arg(p+10));
 	} else if(strncmp(p, "pidfile:", 8) == 0) {
 		str_arg(&cfg->pidfile, p+8);
+	} else if(strncmp(p, "state-file:", 11) == 0) {
+		str_arg(&cfg->state_file, p+11);
 	} else if(strncmp(p, "logfile:", 8) == 0) {
 		str_arg(&cfg->logfile, p+8);
 		cfg->use_syslog = 0;
@@ -336,6 +364,18 @@ keyword(struct cfg* cfg, char* p)
 		str_arg(&cfg->chroot, p+7);
 	} else if(strncmp(p, "unbound-control:", 16) == 0) {
 		str_arg(&cfg->unbound_control, p+16);
+	} else if(strncmp(p, "unbound-control-native:", 23) == 0) {
+		bool_arg(&cfg->unbound_control_native, p+23);
+	} else if(strncmp(p, "unbound-control-interface:", 26) == 0) {
+		str_arg(&cfg->unbound_control_interface, p+26);
+	} else if(strncmp(p, "unbound-control-port:", 21) == 0) {
+		cfg->unbound_control_port = atoi(get_arg(p+21));
+	} else if(strncmp(p, "unbound-server-cert-file:", 25) == 0) {
+		str_arg(&cfg->unbound_server_cert_file, p+25);
+	} else if(strncmp(p, "unbound-control-key-file:", 25) == 0) {
+		str_arg(&cfg->unbound_control_key_file, p+25);
+	} else if(strncmp(p, "unbound-control-cert-file:", 26) == 0) {
+		str_arg(&cfg->unbound_control_cert_file, p+26);
 	} else if(strncmp(p, "resolvconf:", 11) == 0) {
 		str_arg(&cfg->resolvconf, p+11);
 	} else if(strncmp(p, "domain:", 7) == 0) {
@@ -362,6 +402,10 @@ keyword(struct cfg* cfg, char* p)
 		tcp_arg(&cfg->tcp80_ip4, &cfg->tcp80_ip4_last,
 			&cfg->num_tcp80_ip4, &cfg->tcp80_ip6,
 			&cfg->tcp80_ip6_last, &cfg->num_tcp80_ip6, p+6);
+	} else if(strncmp(p, "root:", 5) == 0) {
+		tcp_arg(&cfg->root_ip4, &cfg->root_ip4_last,
+			&cfg->num_root_ip4, &cfg->root_ip6,
+			&cfg->root_ip6_last, &cfg->num_root_ip6, p+5);
 	} else if(strncmp(p, "tcp443:", 7) == 0) {
 		tcp_arg(&cfg->tcp443_ip4, &cfg->tcp443_ip4_last,
 			&cfg->num_tcp443_ip4, &cfg->tcp443_ip6,
@@ -375,6 +419,30 @@ keyword(struct cfg* cfg, char* p)
 			&cfg->num_http_urls, get_arg(p+4));
 	} else if(strncmp(p, "check-updates:", 14) == 0) {
 		bool_arg(&cfg->check_updates, p+14);
+	} else if(strncmp(p, "probe-stage-delay:", 18) == 0) {
+		cfg->probe_stage_delay = atoi(get_arg(p+18));
+	} else if(strncmp(p, "submit-delay:", 13) == 0) {
+		cfg->submit_delay = atoi(get_arg(p+13));
+	} else if(strncmp(p, "tcp-race:", 9) == 0) {
+		cfg->tcp_race = atoi(get_arg(p+9));
+	} else if(strncmp(p, "health-interval:", 16) == 0) {
+		cfg->health_interval = atoi(get_arg(p+16));
+	} else if(strncmp(p, "timer-slack:", 12) == 0) {
+		cfg->timer_slack = atoi(get_arg(p+12));
+	} else if(strncmp(p, "stats-file:", 11) == 0) {
+		str_arg(&cfg->stats_file, p+11);
+	} else if(strncmp(p, "edns-buffer-size:", 17) == 0) {
+		cfg->edns_buffer_size = atoi(get_arg(p+17));
+	} else if(strncmp(p, "prewarm:", 8) == 0) {
+		bool_arg(&cfg->prewarm, p+8);
+	} else if(strncmp(p, "prewarm-concurrency:", 20) == 0) {
+		cfg->prewarm_concurrency = atoi(get_arg(p+20));
+	} else if(strncmp(p, "prewarm-tld:", 12) == 0) {
+		name_arg(&cfg->prewarm_tld, &cfg->prewarm_tld_last,
+			&cfg->num_prewarm_tld, p+12);
+	} else if(strncmp(p, "prewarm-name:", 13) == 0) {
+		name_arg(&cfg->prewarm_name, &cfg->prewarm_name_last,
+			&cfg->num_prewarm_name, p+13);
 	} else {
 		return 0;
 	}
@@ -412,6 +480,93 @@ attempt_readfile(struct cfg* cfg, const char* file)
 	fclose(in);
 }
 
+/** the default state file, in the directory of the default pidfile */
+static char*
+default_state_file(void)
+{
+	const char* pid = PIDFILE;
+	const char* sl = strrchr(pid, '/');
+	size_t dirlen;
+	char* f;
+#ifdef UB_ON_WINDOWS
+	if(strrchr(pid, '\\') > sl)
+		sl = strrchr(pid, '\\');
+#endif
+	dirlen = sl?(size_t)(sl-pid)+1:0;
+	f = (char*)malloc(dirlen + strlen("dnssec-trigger.state") + 1);
+	if(!f) return NULL;
+	memmove(f, pid, dirlen);
+	memmove(f+dirlen, "dnssec-trigger.state",
+		strlen("dnssec-trigger.state")+1);
+	return f;
+}
+
+/** use the root servers if none are configured */
+static void
+default_roots(struct cfg* cfg)
+{
+	const char* ip4[] = {
+		"198.41.0.4", /* a */
+		"170.247.170.2", /* b */
+		"192.33.4.12", /* c */
+		"199.7.91.13", /* d */
+		"192.203.230.10", /* e */
+		"192.5.5.241", /* f */
+		"192.112.36.4", /* g */
+		"198.97.190.53", /* h */
+		"192.36.148.17", /* i */
+		"192.58.128.30", /* j */
+		"193.0.14.129", /* k */
+		"199.7.83.42", /* l */
+		"202.12.27.33" /* m */
+	};
+	const char* ip6[] = {
+		"2001:503:ba3e::2:30", /* a */
+		"2801:1b8:10::b", /* b */
+		"2001:500:2::c", /* c */
+		"2001:500:2d::d", /* d */
+		"2001:500:a8::e", /* e */
+		"2001:500:2f::f", /* f */
+		"2001:500:12::d0d", /* g */
+		"2001:500:1::53", /* h */
+		"2001:7fe::53", /* i */
+		"2001:503:c27::2:30", /* j */
+		"2001:7fd::1", /* k */
+		"2001:500:3::42", /* l */
+		"2001:dc3::35" /* m */
+	};
+	size_t i;
+	if(cfg->num_root_ip4 || cfg->num_root_ip6)
+		return;
+	for(i=0; i<sizeof(ip4)/sizeof(ip4[0]); i++) {
+		strlist_append(&cfg->root_ip4, &cfg->root_ip4_last,
+			(char*)ip4[i]);
+		cfg->num_root_ip4++;
+	}
+	for(i=0; i<sizeof(ip6)/sizeof(ip6[0]); i++) {
+		strlist_append(&cfg->root_ip6, &cfg->root_ip6_last,
+			(char*)ip6[i]);
+		cfg->num_root_ip6++;
+	}
+}
+
+/** the TLDs that are pre-warmed if none are configured, the larger
+ * signed ones */
+static void
+default_prewarm_tlds(struct cfg* cfg)
+{
+	const char* tld[] = { "com", "net", "org", "de", "uk", "nl", "eu",
+		"info", "io", "jp" };
+	size_t i;
+	if(cfg->num_prewarm_tld)
+		return;
+	for(i=0; i<sizeof(tld)/sizeof(tld[0]); i++) {
+		strlist_append(&cfg->prewarm_tld, &cfg->prewarm_tld_last,
+			(char*)tld[i]);
+		cfg->num_prewarm_tld++;
+	}
+}
+
 struct cfg* cfg_create(const char* cfgfile)
 {
 	struct cfg* cfg = (struct cfg*)calloc(1, sizeof(*cfg));
@@ -423,21 +578,45 @@ struct cfg* cfg_create(const char* cfgfile)
 	cfg->control_key_file=strdup(KEYDIR"/dnssec_trigger_control.key");
 	cfg->control_cert_file=strdup(KEYDIR"/dnssec_trigger_control.pem");
 	cfg->unbound_control = strdup(UNBOUND_CONTROL);
+	cfg->unbound_control_native = 1;
+	cfg->unbound_control_interface = strdup("127.0.0.1");
+	cfg->unbound_control_port = 8953;
+	cfg->unbound_server_cert_file = strdup(
+		UNBOUND_KEYDIR"unbound_server.pem");
+	cfg->unbound_control_key_file = strdup(
+		UNBOUND_KEYDIR"unbound_control.key");
+	cfg->unbound_control_cert_file = strdup(
+		UNBOUND_KEYDIR"unbound_control.pem");
 	cfg->login_command = strdup(LOGIN_COMMAND);
 	cfg->login_location = strdup(LOGIN_LOCATION);
 	cfg->pidfile = strdup(PIDFILE);
+	cfg->state_file = default_state_file();
 	cfg->resolvconf = strdup("/etc/resolv.conf");
 	cfg->check_updates = (strcmp(CHECK_UPDATES, "yes")==0);
-
-	if(!cfg->unbound_control || !cfg->pidfile || !cfg->server_key_file ||
+	cfg->probe_stage_delay = 1000;
+	cfg->submit_delay = 250;
+	cfg->tcp_race = 3;
+	cfg->health_interval = 60;
+	cfg->timer_slack = 1000;
+	cfg->prewarm_concurrency = 4;
+	cfg->edns_buffer_size = 1232;
+
+	if(!cfg->unbound_control || !cfg->pidfile || !cfg->state_file ||
+		!cfg->server_key_file ||
 		!cfg->server_cert_file || !cfg->control_key_file ||
 		!cfg->control_cert_file || !cfg->resolvconf ||
-		!cfg->login_command || !cfg->login_location) {
+		!cfg->login_command || !cfg->login_location ||
+		!cfg->unbound_control_interface ||
+		!cfg->unbound_server_cert_file ||
+		!cfg->unbound_control_key_file ||
+		!cfg->unbound_control_cert_file) {
 		cfg_delete(cfg);
 		return NULL;
 	}
 
 	attempt_readfile(cfg, cfgfile);
+	default_roots(cfg);
+	default_prewarm_tlds(cfg);
 
 	/* apply */
 	verbosity = cfg->verbosity;
@@ -451,15 +630,25 @@ void cfg_delete(struct cfg* cfg)
 	strlist_delete(cfg->tcp80_ip6);
 	strlist_delete(cfg->tcp443_ip4);
 	strlist_delete(cfg->tcp443_ip6);
+	strlist_delete(cfg->root_ip4);
+	strlist_delete(cfg->root_ip6);
+	strlist_delete(cfg->prewarm_tld);
+	strlist_delete(cfg->prewarm_name);
 	ssllist_delete(cfg->ssl443_ip4);
 	ssllist_delete(cfg->ssl443_ip6);
 	strlist2_delete(cfg->http_urls);
 	free(cfg->login_command);
 	free(cfg->login_location);
 	free(cfg->pidfile);
+	free(cfg->state_file);
+	free(cfg->stats_file);
 	free(cfg->logfile);
 	free(cfg->chroot);
 	free(cfg->unbound_control);
+	free(cfg->unbound_control_interface);
+	free(cfg->unbound_server_cert_file);
+	free(cfg->unbound_control_key_file);
+	free(cfg->unbound_control_cert_file);
 	free(cfg->resolvconf);
 	free(cfg->rescf_domain);
 	free(cfg->rescf_search);
@@ -526,6 +715,50 @@ ssl_err_ret(SSL* ssl, char* err, size_t errlen, const char* msg)
 	return NULL;
 }
 
+/** store the new session of an ssl443 server, to resume it later */
+static int
+ssllist_new_session(SSL* ssl, SSL_SESSION* sess)
+{
+	struct ssllist* e = (struct ssllist*)SSL_CTX_get_app_data(
+		SSL_get_SSL_CTX(ssl));
+	if(!e)
+		return 0;
+	if(e->session)
+		SSL_SESSION_free(e->session);
+	e->session = sess;
+	return 1; /* we keep the reference */
+}
+
+/** setup client SSL contexts for one list of ssl443 servers */
+static int
+ssllist_setup_ctx(struct ssllist* list)
+{
+	struct ssllist* e;
+	for(e=list; e; e=e->next) {
+		if(e->sslctx)
+			continue;
+		e->sslctx = (SSL_CTX*)connect_sslctx_create(NULL, NULL, NULL);
+		if(!e->sslctx) {
+			log_err("could not create sslctx for %s", e->str);
+			return 0;
+		}
+		SSL_CTX_set_app_data(e->sslctx, e);
+		/* the client keeps the session (or ticket) of the server,
+		 * so that probes and retries do an abbreviated handshake */
+		SSL_CTX_set_session_cache_mode(e->sslctx,
+			SSL_SESS_CACHE_CLIENT|SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		SSL_CTX_sess_set_new_cb(e->sslctx, &ssllist_new_session);
+	}
+	return 1;
+}
+
+int
+cfg_setup_ssl443(struct cfg* cfg)
+{
+	return ssllist_setup_ctx(cfg->ssl443_ip4) &&
+		ssllist_setup_ctx(cfg->ssl443_ip6);
+}
+
 /** setup SSL context */
 SSL_CTX*
 cfg_setup_ctx_client(struct cfg* cfg, char* err, size_t errlen)
@@ -55,6 +55,8 @@ struct cfg {
 	int verbosity;
 	/** pid file */
 	char* pidfile;
+	/** file with the probe results per network, "" for none */
+	char* state_file;
 	/** log file (or NULL) */
 	char* logfile;
 	/** use syslog (bool) */
@@ -64,6 +66,18 @@ struct cfg {
 
 	/** path to unbound-control, can have space and commandline options */
 	char* unbound_control;
+	/** contact unbound remote control from the daemon itself (bool) */
+	int unbound_control_native;
+	/** unbound control interface, ip address or pathname of local socket */
+	char* unbound_control_interface;
+	/** unbound control port number */
+	int unbound_control_port;
+	/** unbound server certificate file, to verify unbound */
+	char* unbound_server_cert_file;
+	/** unbound control private key file */
+	char* unbound_control_key_file;
+	/** unbound control certificate file */
+	char* unbound_control_cert_file;
 	/** path to resolv.conf */
 	char* resolvconf;
 	/** resolv.conf domain line (or NULL) */
@@ -93,6 +107,17 @@ struct cfg {
 	int num_ssl443_ip4;
 	struct ssllist* ssl443_ip6, *ssl443_ip6_last;
 	int num_ssl443_ip6;
+	/** list of root servers on ip4 and ip6, for the authority probes */
+	struct strlist* root_ip4, *root_ip4_last;
+	int num_root_ip4;
+	struct strlist* root_ip6, *root_ip6_last;
+	int num_root_ip6;
+	/** list of TLDs whose DNSKEY and DS are pre-warmed */
+	struct strlist* prewarm_tld, *prewarm_tld_last;
+	int num_prewarm_tld;
+	/** list of names whose address is pre-warmed */
+	struct strlist* prewarm_name, *prewarm_name_last;
+	int num_prewarm_name;
 
 	/** list of http probe urls */
 	struct strlist2* http_urls, *http_urls_last;
@@ -102,6 +127,31 @@ struct cfg {
 	 * enabled on windows and osx. */
 	int check_updates;
 
+	/** msec after which the next probe stage is started, before the
+	 * current stage is done, 0 to wait for the stage to finish */
+	int probe_stage_delay;
+	/** msec that submit and reprobe commands wait, the commands in
+	 * that time are merged into one probe, 0 to probe at once */
+	int submit_delay;
+	/** number of tcp80, tcp443 and ssl443 resolvers that are probed
+	 * at the same time per port and address family, 0 for all */
+	int tcp_race;
+	/** seconds between the health checks of the upstream that is in
+	 * use, 0 for no checks */
+	int health_interval;
+	/** msec the background timers, retry, health check and update, may
+	 * be late, so that they run in the same wakeup, 0 for none */
+	int timer_slack;
+	/** file with statistics in prometheus format, or NULL */
+	char* stats_file;
+	/** pre-warm the unbound cache after it is set up for an upstream */
+	int prewarm;
+	/** number of pre-warm queries that are sent at the same time */
+	int prewarm_concurrency;
+	/** EDNS buffer size that is checked on the path and set in
+	 * unbound, 0 to leave it alone */
+	int edns_buffer_size;
+
 	/** port number for the control port */
 	int control_port;
 	/** private key file for server */
@@ -139,6 +189,10 @@ struct ssllist {
 	struct ssllist* next; /* must be first for compatibility with strlist */
 	char* str; /* ip address */
 	struct hashlist* hashes; /* zero or more hashes to check */
+	SSL_CTX* sslctx; /* client context for probes, or NULL */
+	SSL_SESSION* session; /* session to resume, or NULL */
+	X509* cert; /* last certificate checked against the hashes */
+	const char* cert_reason; /* result of that check, NULL if OK */
 };
 
 /** create config and read in */
@@ -165,6 +219,9 @@ void ssllist_append(struct ssllist** first, struct ssllist** last,
 void ssllist_delete(struct ssllist* first);
 /** get nth element of ssllist */
 struct ssllist* ssllist_get_num(struct ssllist* list, unsigned n);
+/** create the SSL contexts with session cache for the ssl443 servers,
+ * false on failure */
+int cfg_setup_ssl443(struct cfg* cfg);
 
 /** free hashlist */
 void hashlist_delete(struct hashlist* first);
@@ -0,0 +1,396 @@
+/*
+ * cmdq.c - dnssec-trigger queue of commands run in the background
+ *
+ * Copyright (c) 2011, NLnet Labs. All rights reserved.
+ *
+ * This software is open source.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the NLNET LABS nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file
+ *
+ * This file contains the queue of commands that adjust unbound and the
+ * system resolver.  Every item runs in a forked child process, that writes
+ * the exit status on a pipe when it is done.  The pipe is watched by the
+ * event loop, so probes and panels are serviced while the command runs.
+ * The next item is started when the previous one is done, so the order of
+ * changes to unbound and resolv.conf is kept.  Items with a start function
+ * are performed in the daemon, they report with cmdq_async_done, and only
+ * fork when they cannot do the work themselves.
+ */
+#include "config.h"
+#include "cmdq.h"
+#include "log.h"
+#include "netevent.h"
+#ifdef USE_WINSOCK
+#include "winrc/win_svc.h"
+#endif
+#ifdef HAVE_SYS_WAIT_H
+#include <sys/wait.h>
+#endif
+#include <fcntl.h>
+
+struct cmdq* cmdq_create(struct comm_base* base)
+{
+	struct cmdq* q = (struct cmdq*)calloc(1, sizeof(*q));
+	if(!q) return NULL;
+	q->base = base;
+	q->pid = -1;
+	q->fd = -1;
+	return q;
+}
+
+/** free an item */
+static void
+item_free(struct cmdq_item* item)
+{
+	if(!item) return;
+	free(item->cmd);
+	free(item->data);
+	free(item);
+}
+
+/** perform the work of the item, blocking, returns the exit status */
+static int
+item_perform(struct cmdq_item* item)
+{
+	int r;
+	if(!item->cmd && !item->run)
+		return 0; /* mark */
+	if(item->run)
+		return (*item->run)(item->arg, item->data);
+	verbose(VERB_ALGO, "system %s", item->cmd);
+#ifdef USE_WINSOCK
+	r = win_run_cmd(item->cmd);
+#else
+	r = system(item->cmd);
+	if(r == -1)
+		log_err("system(%s) failed: %s", item->cmd, strerror(errno));
+#endif
+	return r;
+}
+
+/** the time now, from the event base */
+static void
+cmdq_time(struct cmdq* q, struct timeval* t)
+{
+	uint32_t* secs;
+	struct timeval* now;
+	comm_base_timept(q->base, &secs, &now);
+	*t = *now;
+}
+
+/** the first item in the queue is done, call callback and remove it */
+static void
+item_done(struct cmdq* q, int status)
+{
+	struct cmdq_item* item = q->first;
+	log_assert(item);
+	if(q->report && (item->cmd || item->run))
+		(*q->report)(q->report_arg, item->cmd?item->cmd:item->data,
+			&item->queued, &item->start, status);
+	if(item->cb) {
+		/* items added by the callback go right after this item */
+		q->insert = item;
+		(*item->cb)(status, item->arg, item->data);
+		q->insert = NULL;
+	}
+	q->first = item->next;
+	if(q->last == item)
+		q->last = NULL;
+	item_free(item);
+	q->num_done++;
+}
+
+/** wait for the child process to finish, returns its status */
+static int
+cmdq_child_wait(struct cmdq* q)
+{
+	int status = -1;
+#if defined(HAVE_FORK) && !defined(USE_WINSOCK)
+	ssize_t r;
+	while((r=read(q->fd, &status, sizeof(status))) == -1 &&
+		errno == EINTR)
+		;
+	if(r != (ssize_t)sizeof(status)) {
+		if(r == -1)
+			log_err("read from command child: %s", strerror(errno));
+		status = -1;
+	}
+	comm_point_delete(q->c);
+	q->c = NULL;
+	close(q->fd);
+	q->fd = -1;
+	/* the child exits right after it wrote the status */
+	while(waitpid(q->pid, NULL, 0) == -1) {
+		if(errno == EINTR)
+			continue;
+		if(errno != ECHILD)
+			log_err("waitpid: %s", strerror(errno));
+		break;
+	}
+#endif
+	q->pid = -1;
+	return status;
+}
+
+/** start the item in a child process, returns false if not possible */
+static int
+cmdq_fork(struct cmdq* q, struct cmdq_item* item)
+{
+#if defined(HAVE_FORK) && !defined(USE_WINSOCK)
+	int fd[2], status;
+	pid_t pid;
+	if(pipe(fd) == -1) {
+		log_err("pipe: %s", strerror(errno));
+		return 0;
+	}
+	pid = fork();
+	switch(pid) {
+	default: 	/* main */
+		break;
+	case -1:
+		/* error */
+		log_err("cannot fork: %s", strerror(errno));
+		close(fd[0]);
+		close(fd[1]);
+		return 0;
+	case 0:
+		/* child, commands that it starts do not get the pipe, so
+		 * the daemon does not wait for their background processes */
+		close(fd[0]);
+		if(fcntl(fd[1], F_SETFD, FD_CLOEXEC) == -1)
+			log_err("fcntl FD_CLOEXEC: %s", strerror(errno));
+		status = item_perform(item);
+		if(write(fd[1], &status, sizeof(status)) == -1)
+			log_err("write to daemon: %s", strerror(errno));
+		_exit(0);
+	}
+	close(fd[1]);
+	q->pid = pid;
+	q->fd = fd[0];
+	q->c = comm_point_create_raw(q->base, q->fd, 0, &cmdq_handle_done, q);
+	if(!q->c)
+		log_err("out of memory, waiting for command child");
+	return 1;
+#else
+	(void)q; (void)item;
+	return 0;
+#endif
+}
+
+/** start the item in the daemon, returns false if not possible */
+static int
+cmdq_start_async(struct cmdq* q, struct cmdq_item* item)
+{
+	if(!item->async)
+		return 0;
+	q->busy = 1;
+	if(!(*item->async)(q, item->arg, item->data)) {
+		q->busy = 0;
+		return 0;
+	}
+	return 1;
+}
+
+/** start the next items in the queue */
+static void
+cmdq_start_next(struct cmdq* q)
+{
+	while(q->first && q->pid == -1 && !q->busy && !q->insert) {
+		cmdq_time(q, &q->first->start);
+		if(!q->first->cmd && !q->first->run) {
+			/* a mark does not need a child process */
+			item_done(q, 0);
+		} else if(cmdq_start_async(q, q->first)) {
+			/* busy in the daemon, until cmdq_async_done */
+		} else if(!cmdq_fork(q, q->first)) {
+			/* run it here, blocking */
+			item_done(q, item_perform(q->first));
+		} else if(!q->c) {
+			item_done(q, cmdq_child_wait(q));
+		}
+	}
+}
+
+/** add item to the queue, or perform it if there is no queue */
+static void
+cmdq_add_item(struct cmdq* q, struct cmdq_item* item)
+{
+	if(!q) {
+		int status = item_perform(item);
+		if(item->cb)
+			(*item->cb)(status, item->arg, item->data);
+		item_free(item);
+		return;
+	}
+	cmdq_time(q, &item->queued);
+	if(q->insert) {
+		item->next = q->insert->next;
+		q->insert->next = item;
+		if(q->last == q->insert)
+			q->last = item;
+		q->insert = item;
+		return; /* started when the callback is done */
+	}
+	if(q->last)
+		q->last->next = item;
+	else	q->first = item;
+	q->last = item;
+	cmdq_start_next(q);
+}
+
+void cmdq_add_cmd(struct cmdq* q, const char* cmd, cmdq_cb_type* cb,
+	void* arg)
+{
+	struct cmdq_item* item = (struct cmdq_item*)calloc(1, sizeof(*item));
+	if(!item) {
+		log_err("out of memory");
+		return;
+	}
+	item->cmd = strdup(cmd);
+	if(!item->cmd) {
+		log_err("out of memory");
+		free(item);
+		return;
+	}
+	item->cb = cb;
+	item->arg = arg;
+	cmdq_add_item(q, item);
+}
+
+void cmdq_add_run(struct cmdq* q, cmdq_run_type* run, cmdq_cb_type* cb,
+	void* arg, const char* data)
+{
+	struct cmdq_item* item = (struct cmdq_item*)calloc(1, sizeof(*item));
+	if(!item) {
+		log_err("out of memory");
+		return;
+	}
+	if(data) {
+		item->data = strdup(data);
+		if(!item->data) {
+			log_err("out of memory");
+			free(item);
+			return;
+		}
+	}
+	item->run = run;
+	item->cb = cb;
+	item->arg = arg;
+	cmdq_add_item(q, item);
+}
+
+void cmdq_add_async(struct cmdq* q, cmdq_start_type* start,
+	cmdq_stop_type* stop, cmdq_run_type* run, cmdq_cb_type* cb,
+	void* arg, const char* data)
+{
+	struct cmdq_item* item = (struct cmdq_item*)calloc(1, sizeof(*item));
+	if(!item) {
+		log_err("out of memory");
+		return;
+	}
+	if(data) {
+		item->data = strdup(data);
+		if(!item->data) {
+			log_err("out of memory");
+			free(item);
+			return;
+		}
+	}
+	item->async = start;
+	item->stop = stop;
+	item->run = run;
+	item->cb = cb;
+	item->arg = arg;
+	cmdq_add_item(q, item);
+}
+
+void cmdq_async_done(struct cmdq* q, int status)
+{
+	log_assert(q->busy && q->first);
+	q->busy = 0;
+	if(status == CMDQ_RUN_INSTEAD) {
+		/* the daemon could not do it, use the run function */
+		if(!cmdq_fork(q, q->first))
+			item_done(q, item_perform(q->first));
+		else if(!q->c)
+			item_done(q, cmdq_child_wait(q));
+	} else {
+		item_done(q, status);
+	}
+	cmdq_start_next(q);
+}
+
+void cmdq_add_mark(struct cmdq* q, cmdq_cb_type* cb, void* arg)
+{
+	struct cmdq_item* item = (struct cmdq_item*)calloc(1, sizeof(*item));
+	if(!item) {
+		log_err("out of memory");
+		return;
+	}
+	item->cb = cb;
+	item->arg = arg;
+	cmdq_add_item(q, item);
+}
+
+void cmdq_flush(struct cmdq* q)
+{
+	if(!q) return;
+	while(q->first) {
+		if(q->pid != -1) {
+			item_done(q, cmdq_child_wait(q));
+			continue;
+		}
+		if(q->busy) {
+			/* abort it, and do it again, blocking */
+			(*q->first->stop)(q->first->arg);
+			q->busy = 0;
+		}
+		cmdq_time(q, &q->first->start);
+		item_done(q, item_perform(q->first));
+	}
+}
+
+void cmdq_delete(struct cmdq* q)
+{
+	if(!q) return;
+	cmdq_flush(q);
+	free(q);
+}
+
+int cmdq_handle_done(struct comm_point* ATTR_UNUSED(c), void* arg,
+	int ATTR_UNUSED(err), struct comm_reply* ATTR_UNUSED(reply_info))
+{
+	struct cmdq* q = (struct cmdq*)arg;
+	item_done(q, cmdq_child_wait(q));
+	cmdq_start_next(q);
+	return 0;
+}
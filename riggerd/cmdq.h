@@ -0,0 +1,240 @@
+/*
+ * cmdq.h - dnssec-trigger queue of commands run in the background
+ *
+ * Copyright (c) 2011, NLnet Labs. All rights reserved.
+ *
+ * This software is open source.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the NLNET LABS nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file
+ *
+ * This file contains the queue of commands that adjust unbound and the
+ * system resolver.  The commands run one after another, in the order in
+ * which they are added, in a child process, so that the daemon can keep
+ * handling probes and panels while they run.  An item can also start in
+ * the daemon itself, driven by the event loop, and run in a child process
+ * only if that is not possible.
+ */
+
+#ifndef CMDQ_H
+#define CMDQ_H
+struct comm_base;
+struct comm_point;
+struct comm_reply;
+struct cmdq;
+
+/** status for cmdq_async_done, the item runs in a child process instead */
+#define CMDQ_RUN_INSTEAD -2
+
+/**
+ * Function that performs the work of an item, it runs in the child process.
+ * @param arg: user argument.
+ * @param data: user data string (or NULL).
+ * @return exit status, 0 is success.
+ */
+typedef int cmdq_run_type(void* arg, char* data);
+
+/**
+ * Function that starts the work of an item in the daemon, without blocking.
+ * When the work is done, it calls cmdq_async_done.  It must not call that
+ * from inside this function.
+ * @param q: the queue.
+ * @param arg: user argument.
+ * @param data: user data string (or NULL).
+ * @return false if it cannot start, the run function is used instead.
+ */
+typedef int cmdq_start_type(struct cmdq* q, void* arg, char* data);
+
+/**
+ * Function that aborts the work that the start function started, without
+ * a call to cmdq_async_done.
+ * @param arg: user argument.
+ */
+typedef void cmdq_stop_type(void* arg);
+
+/**
+ * Callback when an item is done, it runs in the daemon.
+ * @param status: exit status of the item, -1 if it could not be run.
+ * @param arg: user argument.
+ * @param data: user data string (or NULL).
+ */
+typedef void cmdq_cb_type(int status, void* arg, char* data);
+
+/**
+ * Report of the times of an item that is done, it runs in the daemon.
+ * @param arg: user argument of the queue.
+ * @param desc: the shell command, or the data of the function, or NULL.
+ * @param queued: time the item was added.
+ * @param start: time the item was started.
+ * @param status: exit status of the item.
+ */
+typedef void cmdq_report_type(void* arg, const char* desc,
+	struct timeval* queued, struct timeval* start, int status);
+
+/**
+ * An item in the command queue.
+ */
+struct cmdq_item {
+	/** next in the queue */
+	struct cmdq_item* next;
+	/** shell command to run, or NULL if run function is used */
+	char* cmd;
+	/** function to run (if no cmd), if both are NULL it is a mark */
+	cmdq_run_type* run;
+	/** function that starts the item in the daemon, or NULL, if it
+	 * cannot, the run function is used */
+	cmdq_start_type* async;
+	/** function that aborts the started item (if async is used) */
+	cmdq_stop_type* stop;
+	/** callback when done (or NULL) */
+	cmdq_cb_type* cb;
+	/** argument for run and callback, must remain valid until done */
+	void* arg;
+	/** data for run and callback, malloced, freed after callback */
+	char* data;
+	/** time the item was added */
+	struct timeval queued;
+	/** time the item was started */
+	struct timeval start;
+};
+
+/**
+ * The command queue.
+ */
+struct cmdq {
+	/** the event base */
+	struct comm_base* base;
+	/** first item, the one that is running, or NULL if empty */
+	struct cmdq_item* first;
+	/** last item in the queue */
+	struct cmdq_item* last;
+	/** if not NULL, the callback of this item is busy, items that are
+	 * added go after it, so that followup work keeps its order */
+	struct cmdq_item* insert;
+	/** pid of the running child process, or -1 if none */
+	pid_t pid;
+	/** if the first item was started in the daemon and is busy */
+	int busy;
+	/** read end of the pipe from the child, or -1 */
+	int fd;
+	/** commpoint that listens on the pipe from the child, or NULL */
+	struct comm_point* c;
+	/** number of items that have been done */
+	unsigned num_done;
+	/** called with the times of the items that are done, or NULL */
+	cmdq_report_type* report;
+	/** argument for the report */
+	void* report_arg;
+};
+
+/**
+ * Create command queue.
+ * @param base: the event base.
+ * @return new queue or NULL on malloc failure.
+ */
+struct cmdq* cmdq_create(struct comm_base* base);
+
+/**
+ * Delete command queue.  Items that are still in the queue are run first,
+ * blocking, so that the system is left in the state that was asked for.
+ * @param q: queue to delete.
+ */
+void cmdq_delete(struct cmdq* q);
+
+/**
+ * Add a shell command to the queue.
+ * @param q: the queue, if NULL the command is run immediately, blocking.
+ * @param cmd: the command line for the shell.
+ * @param cb: callback when done, or NULL.
+ * @param arg: argument for the callback.
+ */
+void cmdq_add_cmd(struct cmdq* q, const char* cmd, cmdq_cb_type* cb,
+	void* arg);
+
+/**
+ * Add a function to run in the child process to the queue.
+ * @param q: the queue, if NULL the function is run immediately, blocking.
+ * @param run: function to run.
+ * @param cb: callback when done, or NULL.
+ * @param arg: argument for run and callback.
+ * @param data: string that is copied, passed to run and callback, or NULL.
+ */
+void cmdq_add_run(struct cmdq* q, cmdq_run_type* run, cmdq_cb_type* cb,
+	void* arg, const char* data);
+
+/**
+ * Add an item to the queue that is performed in the daemon itself, with
+ * the event loop.  If it cannot start, or it asks for it when done, the
+ * run function runs in a child process instead.
+ * @param q: the queue, if NULL the run function is run immediately,
+ * 	blocking.
+ * @param start: function that starts the item.
+ * @param stop: function that aborts the started item.
+ * @param run: function to run in the child process instead.
+ * @param cb: callback when done, or NULL.
+ * @param arg: argument for start, stop, run and callback.
+ * @param data: string that is copied, passed to the functions, or NULL.
+ */
+void cmdq_add_async(struct cmdq* q, cmdq_start_type* start,
+	cmdq_stop_type* stop, cmdq_run_type* run, cmdq_cb_type* cb,
+	void* arg, const char* data);
+
+/**
+ * The item that was started in the daemon is done.  The next item is
+ * started.
+ * @param q: the queue.
+ * @param status: exit status of the item, 0 is success.  Or
+ * 	CMDQ_RUN_INSTEAD to run the run function in a child process.
+ */
+void cmdq_async_done(struct cmdq* q, int status);
+
+/**
+ * Add a mark to the queue, nothing is run for it, the callback is called
+ * in the daemon when the items before it are done.
+ * @param q: the queue, if NULL the callback is called immediately.
+ * @param cb: callback when the items before it are done, status is 0.
+ * @param arg: argument for the callback.
+ */
+void cmdq_add_mark(struct cmdq* q, cmdq_cb_type* cb, void* arg);
+
+/**
+ * Wait until the queue is empty, blocking.  Runs the items in the queue.
+ * An item that is busy in the daemon is stopped and run blocking.
+ * Used before the config is reloaded, the items reference it.
+ * @param q: the queue, or NULL.
+ */
+void cmdq_flush(struct cmdq* q);
+
+/** handle the pipe from the child becoming readable, the child is done */
+int cmdq_handle_done(struct comm_point* c, void* arg, int err,
+	struct comm_reply* reply_info);
+
+#endif /* CMDQ_H */
@@ -0,0 +1,146 @@
+/*
+ * ednsize.c - dnssec-trigger EDNS buffer size discovery
+ *
+ * Copyright (c) 2011, NLnet Labs. All rights reserved.
+ *
+ * This software is open source.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the NLNET LABS nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file
+ *
+ * This file contains the check of the EDNS buffer size.  A complete
+ * reply that is longer than 512 octets shows that a reply of that length
+ * is not lost on the path.  A truncated or short reply proves nothing;
+ * that and a timeout leave unbound alone.
+ */
+#include "config.h"
+#include "ednsize.h"
+#include "probe.h"
+#include "svr.h"
+#include "cfg.h"
+#include "log.h"
+#include "health.h"
+#include "ubhook.h"
+#include <ldns/ldns.h>
+
+struct ednsize* ednsize_create(void)
+{
+	struct ednsize* e = (struct ednsize*)calloc(1, sizeof(*e));
+	if(!e) {
+		log_err("out of memory");
+		return NULL;
+	}
+	return e;
+}
+
+void ednsize_delete(struct ednsize* e)
+{
+	if(!e)
+		return;
+	probe_delete(e->check);
+	free(e);
+}
+
+void ednsize_stop(struct ednsize* e)
+{
+	probe_delete(e->check);
+	e->check = NULL;
+}
+
+/** send the query with the size */
+static void
+ednsize_send(struct ednsize* e, struct svr* svr, int size)
+{
+	struct probe_ip* t, *p;
+	if(!(t = health_target(svr)) || t->dnstcp) {
+		verbose(VERB_ALGO, "edns size: no server to check");
+		return;
+	}
+	p = (struct probe_ip*)calloc(1, sizeof(*p));
+	if(!p) {
+		log_err("out of memory");
+		return;
+	}
+	p->name = strdup(t->name);
+	if(!p->name) {
+		log_err("out of memory");
+		free(p);
+		return;
+	}
+	p->to_auth = t->to_auth;
+	p->port = t->port;
+	p->udp_size = size;
+	e->check = p;
+	verbose(VERB_ALGO, "edns size %d to %s", p->udp_size, p->name);
+	p->dnskey_c = outq_create(p->name, LDNS_RR_TYPE_DNSKEY, ".",
+		!p->to_auth, p, 0, 0, p->port, 1, 1);
+	if(!p->dnskey_c) {
+		e->check = NULL;
+		probe_delete(p);
+	}
+}
+
+void ednsize_start(struct ednsize* e, struct svr* svr)
+{
+	int size = svr->cfg->edns_buffer_size;
+	ednsize_stop(e);
+	if(size <= 0 || svr->forced_insecure || svr->http_insecure ||
+		(svr->res_state != res_cache && svr->res_state != res_auth))
+		return;
+	ednsize_send(e, svr, size);
+}
+
+const char* ednsize_check_reply(struct ednsize* e, uint8_t* wire,
+	size_t len)
+{
+	if(LDNS_TC_WIRE(wire))
+		return "truncated reply";
+	if(len <= EDNSIZE_MIN)
+		return "reply is too short to show it";
+	return NULL;
+}
+
+void ednsize_outq_done(struct ednsize* e, const char* reason)
+{
+	struct svr* svr = global_svr;
+	int size = e->check->udp_size;
+	/* this deletes the query too */
+	probe_delete(e->check);
+	e->check = NULL;
+	if(!reason) {
+		verbose(VERB_OPS, "edns buffer size %d works", size);
+		e->size = size;
+		hook_unbound_edns_size(svr->cfg, size);
+		return;
+	}
+	verbose(VERB_OPS, "edns buffer size %d not confirmed: %s, "
+		"unbound is not changed", size, reason);
+}
@@ -0,0 +1,110 @@
+/*
+ * ednsize.h - dnssec-trigger EDNS buffer size discovery
+ *
+ * Copyright (c) 2011, NLnet Labs. All rights reserved.
+ *
+ * This software is open source.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the NLNET LABS nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file
+ *
+ * This file contains the check of the EDNS buffer size on the path to the
+ * upstream that is in use.  The DNSKEY answer of the root, about 1100
+ * octets, is asked for with the configured size, and if it arrives
+ * complete unbound is set to that size.  Only that one size is checked,
+ * and the answer is not larger than 1232, so a larger size is not really
+ * tested.  On a path that drops fragments, unbound then does not wait for
+ * timeouts before it falls back.
+ */
+
+#ifndef EDNSIZE_H
+#define EDNSIZE_H
+struct svr;
+struct probe_ip;
+
+/** a reply that is not longer than this fits in any EDNS buffer */
+#define EDNSIZE_MIN 512
+
+/**
+ * EDNS buffer size check.
+ */
+struct ednsize {
+	/** the query in progress, or NULL.  It is not in the probe list */
+	struct probe_ip* check;
+	/** the size that works on the path, 0 if not known */
+	int size;
+};
+
+/**
+ * Create the EDNS size check.
+ * @return new structure or NULL on alloc failure.
+ */
+struct ednsize* ednsize_create(void);
+
+/**
+ * Delete the EDNS size check.
+ * @param e: the structure to delete.
+ */
+void ednsize_delete(struct ednsize* e);
+
+/**
+ * The probe has selected an upstream, check the configured size for it.
+ * Nothing is done if it is not reached over UDP.
+ * @param e: the EDNS size check.
+ * @param svr: the server with the probe results.
+ */
+void ednsize_start(struct ednsize* e, struct svr* svr);
+
+/**
+ * Stop the check, a new probe starts.
+ * @param e: the EDNS size check.
+ */
+void ednsize_stop(struct ednsize* e);
+
+/**
+ * Check the reply to the query of the check.  Only a reply without the
+ * TC flag that is longer than EDNSIZE_MIN confirms the size.
+ * @param e: the EDNS size check.
+ * @param wire: the reply.
+ * @param len: length of the reply.
+ * @return NULL if the size works, or why the reply does not confirm it.
+ */
+const char* ednsize_check_reply(struct ednsize* e, uint8_t* wire,
+	size_t len);
+
+/**
+ * The query of the check is done.
+ * @param e: the EDNS size check, the query is deleted.
+ * @param reason: NULL if the size is confirmed, or the failure.
+ */
+void ednsize_outq_done(struct ednsize* e, const char* reason);
+
+#endif /* EDNSIZE_H */
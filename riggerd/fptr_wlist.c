@@ -50,6 +50,11 @@
 #include "mini_event.h"
 #include "http.h"
 #include "update.h"
+#include "cmdq.h"
+#include "rtt.h"
+#include "health.h"
+#include "resume.h"
+#include "ubctrl.h"
 #ifdef USE_WINSOCK
 #include "winrc/netlist.h"
 #include "winrc/win_svc.h"
@@ -69,6 +74,9 @@ fptr_whitelist_comm_point_raw(comm_point_callback_t *fptr)
 	if(fptr == &handle_ssl_accept) return 1;
 	else if(fptr == &http_get_callback) return 1;
 	else if(fptr == &control_callback) return 1;
+	else if(fptr == &cmdq_handle_done) return 1;
+	else if(fptr == &resume_handle) return 1;
+	else if(fptr == &ubctrl_handle) return 1;
 	return 0;
 }
 
@@ -76,10 +84,16 @@ int
 fptr_whitelist_comm_timer(void (*fptr)(void*))
 {
 	if(fptr == &outq_timeout) return 1;
+	else if(fptr == &probe_conn_pending) return 1;
 	else if(fptr == &svr_retry_callback) return 1;
 	else if(fptr == &http_get_timeout_handler) return 1;
 	else if(fptr == &selfupdate_timeout) return 1;
 	else if(fptr == &svr_tcp_callback) return 1;
+	else if(fptr == &probe_stage_timeout) return 1;
+	else if(fptr == &probe_race_timeout) return 1;
+	else if(fptr == &health_timeout) return 1;
+	else if(fptr == &svr_submit_callback) return 1;
+	else if(fptr == &ubctrl_timeout) return 1;
 #ifdef USE_WINSOCK
 	else if(fptr == &wsvc_cron_cb) return 1;
 #endif
@@ -115,6 +129,8 @@ int
 fptr_whitelist_rbtree_cmp(int (*fptr) (const void *, const void *))
 {
 	if(fptr == &mini_ev_cmp) return 1;
+	else if(fptr == &outq_cmp) return 1;
+	else if(fptr == &rtt_cmp) return 1;
 	return 0;
 }
 
@@ -0,0 +1,317 @@
+/*
+ * health.c - dnssec-trigger health checks of the selected upstream
+ *
+ * Copyright (c) 2011, NLnet Labs. All rights reserved.
+ *
+ * This software is open source.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the NLNET LABS nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file
+ *
+ * This file contains the health checks of the upstream that the probe
+ * selected.  The check is a DNSKEY query for the root, with DO flag, to
+ * the fastest server that worked in the probe, over the same transport.
+ * The reply must have the RRSIGs, as in the probe.  A single lost packet
+ * is retransmitted by the query itself, and a reprobe needs
+ * HEALTH_FAIL_MAX failures in the window, so that a short loss does
+ * not change the state.
+ */
+#include "config.h"
+#include "health.h"
+#include "probe.h"
+#include "svr.h"
+#include "cfg.h"
+#include "log.h"
+#include "netevent.h"
+#include "stats.h"
+#include <ldns/ldns.h>
+
+/** seconds to the next check after a check failed, so that a failed
+ * upstream is found sooner */
+#define HEALTH_RECHECK 10
+
+struct health* health_create(struct svr* svr)
+{
+	struct health* h = (struct health*)calloc(1, sizeof(*h));
+	if(!h) {
+		log_err("out of memory");
+		return NULL;
+	}
+	h->timer = comm_timer_create(svr->base, &health_timeout, svr);
+	if(!h->timer) {
+		log_err("out of memory");
+		free(h);
+		return NULL;
+	}
+	return h;
+}
+
+void health_delete(struct health* h)
+{
+	if(!h)
+		return;
+	probe_delete(h->check);
+	comm_timer_delete(h->timer);
+	free(h);
+}
+
+/** see if the state is one that is checked */
+static int
+health_secure(struct svr* svr)
+{
+	if(svr->forced_insecure || svr->http_insecure)
+		return 0;
+	return svr->res_state == res_cache || svr->res_state == res_auth ||
+		svr->res_state == res_tcp || svr->res_state == res_ssl;
+}
+
+/** see if a probe is in progress */
+static int
+health_probe_busy(struct svr* svr)
+{
+	struct probe_ip* p;
+	for(p = svr->probes; p; p = p->next) {
+		if(!p->finished)
+			return 1;
+	}
+	return 0;
+}
+
+struct probe_ip*
+health_target(struct svr* svr)
+{
+	struct probe_ip* p, *best = NULL;
+	for(p = svr->probes; p; p = p->next) {
+		if(!p->works || p->to_http)
+			continue;
+		switch(svr->res_state) {
+		case res_cache:
+			if(!probe_is_cache(p)) continue;
+			break;
+		case res_auth:
+			if(!p->to_auth || p->dnstcp) continue;
+			break;
+		case res_tcp:
+			if(!p->dnstcp || p->ssldns) continue;
+			break;
+		case res_ssl:
+			if(!p->ssldns) continue;
+			break;
+		default:
+			return NULL;
+		}
+		if(!best || p->msec < best->msec)
+			best = p;
+	}
+	return best;
+}
+
+/** find the ssl443 server of the current config, the probe result may
+ * be from before a reload.  NULL if it is no longer configured */
+static struct ssllist*
+health_ssllist(struct cfg* cfg, const char* name)
+{
+	struct ssllist* e;
+	for(e = cfg->ssl443_ip4; e; e = e->next)
+		if(strcmp(e->str, name) == 0)
+			return e;
+	for(e = cfg->ssl443_ip6; e; e = e->next)
+		if(strcmp(e->str, name) == 0)
+			return e;
+	return NULL;
+}
+
+/** set the timer for the next check, if checks are done */
+static void
+health_next(struct health* h, struct svr* svr)
+{
+	struct timeval tv;
+	int secs = svr->cfg->health_interval;
+	if(secs <= 0 || !health_secure(svr))
+		return;
+	/* the last check failed, see soon if it was a one-off */
+	if(h->num > 0 && !h->ok[(h->pos+HEALTH_WINDOW-1)%HEALTH_WINDOW] &&
+		secs > HEALTH_RECHECK)
+		secs = HEALTH_RECHECK;
+	tv.tv_sec = secs;
+	tv.tv_usec = 0;
+	comm_timer_set(h->timer, &tv);
+}
+
+/** number of failed checks in the window */
+static int
+health_fails(struct health* h)
+{
+	int i, n = 0;
+	for(i = 0; i < h->num; i++) {
+		if(!h->ok[i])
+			n++;
+	}
+	return n;
+}
+
+/** note the result of a check, and reprobe if too many failed */
+static void
+health_result(struct health* h, struct svr* svr, int ok, int msec,
+	const char* reason)
+{
+	int fails;
+	h->ok[h->pos] = ok;
+	h->msec[h->pos] = msec;
+	h->pos = (h->pos+1)%HEALTH_WINDOW;
+	if(h->num < HEALTH_WINDOW)
+		h->num++;
+	fails = health_fails(h);
+	if(ok)
+		verbose(VERB_ALGO, "health check OK in %d msec, %d%% in "
+			"window, average %d msec", msec, health_rate(h),
+			health_latency(h));
+	else	verbose(VERB_ALGO, "health check failed: %s, %d of %d "
+			"in window failed", reason, fails, h->num);
+	stats_write(svr);
+	if(!ok && fails >= HEALTH_FAIL_MAX) {
+		verbose(VERB_OPS, "health check: %d of the last %d checks "
+			"failed, reprobe", fails, h->num);
+		h->num_reprobe++;
+		health_stop(h);
+		svr_submit_queue(svr, NULL);
+		return;
+	}
+	health_next(h, svr);
+}
+
+void health_start(struct health* h, struct svr* svr)
+{
+	health_stop(h);
+	h->num = 0;
+	h->pos = 0;
+	health_next(h, svr);
+}
+
+void health_stop(struct health* h)
+{
+	comm_timer_disable(h->timer);
+	probe_delete(h->check);
+	h->check = NULL;
+}
+
+void health_timeout(void* arg)
+{
+	struct svr* svr = (struct svr*)arg;
+	struct health* h = svr->health;
+	struct probe_ip* t, *p;
+	uint32_t* secs;
+	struct timeval* now;
+	comm_timer_disable(h->timer);
+	if(h->check || !health_secure(svr))
+		return;
+	if(svr->submit_waiting || health_probe_busy(svr)) {
+		/* the probe checks it, try again later */
+		health_next(h, svr);
+		return;
+	}
+	if(!(t = health_target(svr))) {
+		verbose(VERB_ALGO, "health check: no server to check");
+		return;
+	}
+	p = (struct probe_ip*)calloc(1, sizeof(*p));
+	if(!p) {
+		log_err("out of memory");
+		health_next(h, svr);
+		return;
+	}
+	p->name = strdup(t->name);
+	if(!p->name) {
+		log_err("out of memory");
+		free(p);
+		health_next(h, svr);
+		return;
+	}
+	p->to_auth = t->to_auth;
+	p->dnstcp = t->dnstcp;
+	if(t->ssldns) {
+		p->ssldns = health_ssllist(svr->cfg, t->name);
+		if(!p->ssldns || !p->ssldns->sslctx) {
+			verbose(VERB_ALGO, "health check: %s is not in the "
+				"config", t->name);
+			probe_delete(p);
+			return;
+		}
+		p->sslctx = p->ssldns->sslctx;
+	}
+	p->port = t->port;
+	comm_base_timept(svr->base, &secs, &now);
+	h->start = *now;
+	h->check = p;
+	verbose(VERB_ALGO, "health check %s %s", p->name,
+		p->ssldns?"ssl":(p->dnstcp?"tcp":"udp"));
+	p->dnskey_c = outq_create(p->name, LDNS_RR_TYPE_DNSKEY, ".",
+		!p->to_auth, p, p->dnstcp, p->ssldns!=0, p->port, 1, 1);
+	if(!p->dnskey_c) {
+		h->check = NULL;
+		probe_delete(p);
+		health_result(h, svr, 0, 0, "could not send query");
+	}
+}
+
+void health_outq_done(struct health* h, const char* reason)
+{
+	struct svr* svr = global_svr;
+	uint32_t* secs;
+	struct timeval* now;
+	int msec;
+	comm_base_timept(svr->base, &secs, &now);
+	msec = (int)(now->tv_sec - h->start.tv_sec)*1000 +
+		(int)(now->tv_usec - h->start.tv_usec)/1000;
+	/* this deletes the query too */
+	probe_delete(h->check);
+	h->check = NULL;
+	health_result(h, svr, reason == NULL, msec, reason);
+}
+
+int health_rate(struct health* h)
+{
+	if(h->num == 0)
+		return 100;
+	return (h->num - health_fails(h))*100/h->num;
+}
+
+int health_latency(struct health* h)
+{
+	int i, n = 0, sum = 0;
+	for(i = 0; i < h->num; i++) {
+		if(h->ok[i]) {
+			sum += h->msec[i];
+			n++;
+		}
+	}
+	return n?sum/n:0;
+}
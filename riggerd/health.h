@@ -0,0 +1,136 @@
+/*
+ * health.h - dnssec-trigger health checks of the selected upstream
+ *
+ * Copyright (c) 2011, NLnet Labs. All rights reserved.
+ *
+ * This software is open source.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the NLNET LABS nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file
+ *
+ * This file contains the health checks of the upstream that the probe
+ * selected.  Now and then a DNSKEY query is sent over the path that is
+ * in use, and the results are kept in a sliding window.  Too many
+ * failures in the window cause a reprobe.
+ */
+
+#ifndef HEALTH_H
+#define HEALTH_H
+struct svr;
+struct probe_ip;
+struct comm_timer;
+
+/** number of checks in the sliding window */
+#define HEALTH_WINDOW 8
+/** number of failed checks in the window that cause a reprobe */
+#define HEALTH_FAIL_MAX 3
+
+/**
+ * Health checks of the selected upstream.
+ */
+struct health {
+	/** timer for the next check */
+	struct comm_timer* timer;
+	/** the check in progress, or NULL.  It is not in the probe list */
+	struct probe_ip* check;
+	/** when the check in progress was sent */
+	struct timeval start;
+	/** the window of results, 1 for success, 0 for failure */
+	int ok[HEALTH_WINDOW];
+	/** the msec the checks took */
+	int msec[HEALTH_WINDOW];
+	/** number of results in the window */
+	int num;
+	/** position in the window for the next result */
+	int pos;
+	/** number of reprobes caused by failed checks */
+	unsigned num_reprobe;
+};
+
+/**
+ * Create the health checks.
+ * @param svr: the server, the checks use its event base.
+ * @return new structure or NULL on alloc failure.
+ */
+struct health* health_create(struct svr* svr);
+
+/**
+ * Delete the health checks.
+ * @param h: the structure to delete.
+ */
+void health_delete(struct health* h);
+
+/**
+ * The probe has selected an upstream, start to check it.  The window is
+ * emptied, and nothing is checked if the state is not secure.
+ * @param h: the health checks.
+ * @param svr: the server with the probe results.
+ */
+void health_start(struct health* h, struct svr* svr);
+
+/**
+ * Stop the checks, a new probe starts.
+ * @param h: the health checks.
+ */
+void health_stop(struct health* h);
+
+/** timeout handler that starts a check, arg is svr */
+void health_timeout(void* arg);
+
+/**
+ * The query of the check is done.
+ * @param h: the health checks, the query of the check is deleted.
+ * @param reason: NULL on success, or the failure.
+ */
+void health_outq_done(struct health* h, const char* reason);
+
+/**
+ * Find the probe that worked for the state that is in use, the fastest one.
+ * @param svr: the server with the probe results.
+ * @return the probe or NULL if there is none, or the state is insecure.
+ */
+struct probe_ip* health_target(struct svr* svr);
+
+/**
+ * Get the success rate over the window.
+ * @param h: the health checks.
+ * @return percentage of the checks that worked, 100 if there are none.
+ */
+int health_rate(struct health* h);
+
+/**
+ * Get the latency over the window.
+ * @param h: the health checks.
+ * @return average msec of the checks that worked, or 0 if none.
+ */
+int health_latency(struct health* h);
+
+#endif /* HEALTH_H */
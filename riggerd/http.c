@@ -686,13 +686,16 @@ void http_general_done(const char* reason)
 	if(svr->num_probes_done < svr->num_probes) {
 		/* if we are probing the cache, and now http works,
 		 * and some cache was already seen to work.
-		 * (and we are not probing TCP, SSL, Authority),
+		 * (the later probe stages are stopped then),
 		 * (and we are not in forced_insecure mode).
 		 * Then we can already use the working cache server now. */
-		if(!reason && !svr->probe_dnstcp && !svr->probe_direct &&
-			svr->saw_first_working && !svr->forced_insecure) {
+		if(!reason && svr->saw_first_working &&
+			!svr->forced_insecure) {
 			probe_setup_cache(svr, NULL);
 		}
+		/* the next probe stage waited for http to work */
+		if(!reason && svr->stage_wait_http)
+			probe_stage_timeout(svr);
 		return; /* wait for other probes at the cache stage */
 	}
 	probe_cache_done();
@@ -37,7 +37,7 @@
 /**
  * \file
  * fake libevent implementation. Less broad in functionality, and only
- * supports select(2).
+ * supports epoll(7) and select(2).  The back end is chosen by configure.
  */
 
 #include "config.h"
@@ -72,13 +72,103 @@ int mini_ev_cmp(const void* a, const void* b)
 	return 0;
 }
 
-/** set time */
+/** put the event at the position in the heap */
+static void
+heap_place(struct event_base* base, struct event* ev, int i)
+{
+	base->times[i] = ev;
+	ev->heap_idx = i+1;
+}
+
+/** move the event at the position up, to its place in the heap */
+static void
+heap_up(struct event_base* base, int i)
+{
+	struct event* ev = base->times[i];
+	while(i > 0) {
+		int parent = (i-1)/HEAP_ARITY;
+		if(mini_ev_cmp(base->times[parent], ev) <= 0)
+			break;
+		heap_place(base, base->times[parent], i);
+		i = parent;
+	}
+	heap_place(base, ev, i);
+}
+
+/** move the event at the position down, to its place in the heap */
+static void
+heap_down(struct event_base* base, int i)
+{
+	struct event* ev = base->times[i];
+	for(;;) {
+		int c, first = i*HEAP_ARITY+1, least = -1;
+		for(c = first; c < first+HEAP_ARITY && c < base->num_times;
+			c++) {
+			if(least == -1 || mini_ev_cmp(base->times[c],
+				base->times[least]) < 0)
+				least = c;
+		}
+		if(least == -1 || mini_ev_cmp(ev, base->times[least]) <= 0)
+			break;
+		heap_place(base, base->times[least], i);
+		i = least;
+	}
+	heap_place(base, ev, i);
+}
+
+/** insert the event in the timeout heap, false on alloc failure */
+static int
+heap_insert(struct event_base* base, struct event* ev)
+{
+	if(base->num_times == base->cap_times) {
+		int cap = base->cap_times?base->cap_times*2:64;
+		struct event** t = (struct event**)realloc(base->times,
+			(size_t)cap*sizeof(struct event*));
+		if(!t)
+			return 0;
+		base->times = t;
+		base->cap_times = cap;
+	}
+	heap_place(base, ev, base->num_times++);
+	heap_up(base, base->num_times-1);
+	return 1;
+}
+
+/** remove the event from the timeout heap, if it is in it */
+static void
+heap_remove(struct event_base* base, struct event* ev)
+{
+	int i = ev->heap_idx-1;
+	struct event* last;
+	if(i < 0 || i >= base->num_times || base->times[i] != ev)
+		return;
+	ev->heap_idx = 0;
+	last = base->times[--base->num_times];
+	if(last == ev)
+		return;
+	/* the last one fills the hole, it can go either way */
+	heap_place(base, last, i);
+	heap_down(base, i);
+	heap_up(base, last->heap_idx-1);
+}
+
+/** set time, from the monotonic clock if there is one, so that the
+ * timeouts do not move when the clock is set */
 static int
 settime(struct event_base* base)
 {
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+	if(clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+		return -1;
+	}
+	base->time_tv->tv_sec = ts.tv_sec;
+	base->time_tv->tv_usec = ts.tv_nsec/1000;
+#else
 	if(gettimeofday(base->time_tv, NULL) < 0) {
 		return -1;
 	}
+#endif
 #ifndef S_SPLINT_S
 	*base->time_secs = (uint32_t)base->time_tv->tv_sec;
 #endif
@@ -93,19 +183,17 @@ void *event_init(uint32_t* time_secs, struct timeval* time_tv)
 	if(!base)
 		return NULL;
 	memset(base, 0, sizeof(*base));
+#ifdef USE_EPOLL
+	base->epfd = -1;
+#endif
 	base->time_secs = time_secs;
 	base->time_tv = time_tv;
 	if(settime(base) < 0) {
 		event_base_free(base);
 		return NULL;
 	}
-	base->times = rbtree_create(mini_ev_cmp);
-	if(!base->times) {
-		event_base_free(base);
-		return NULL;
-	}
 	base->capfd = MAX_FDS;
-#ifdef FD_SETSIZE
+#if defined(FD_SETSIZE) && !defined(USE_EPOLL)
 	if((int)FD_SETSIZE < base->capfd)
 		base->capfd = (int)FD_SETSIZE;
 #endif
@@ -115,12 +203,26 @@ void *event_init(uint32_t* time_secs, struct timeval* time_tv)
 		event_base_free(base);
 		return NULL;
 	}
+#ifdef USE_EPOLL
+	base->fd_round = (unsigned*)calloc((size_t)base->capfd,
+		sizeof(unsigned));
+	if(!base->fd_round) {
+		event_base_free(base);
+		return NULL;
+	}
+	base->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(base->epfd == -1) {
+		log_err("epoll_create1: %s", strerror(errno));
+		event_base_free(base);
+		return NULL;
+	}
+#endif
 	base->signals = (struct event**)calloc(MAX_SIG, sizeof(struct event*));
 	if(!base->signals) {
 		event_base_free(base);
 		return NULL;
 	}
-#ifndef S_SPLINT_S
+#if !defined(S_SPLINT_S) && !defined(USE_EPOLL)
 	FD_ZERO(&base->reads);
 	FD_ZERO(&base->writes);
 #endif
@@ -133,10 +235,14 @@ const char *event_get_version(void)
 	return "mini-event-"PACKAGE_VERSION;
 }
 
-/** get polling method, select */
+/** get polling method, epoll or select */
 const char *event_get_method(void)
 {
+#ifdef USE_EPOLL
+	return "epoll";
+#else
 	return "select";
+#endif
 }
 
 /** call timeouts handlers, and return how long to wait for next one or -1 */
@@ -148,8 +254,8 @@ static void handle_timeouts(struct event_base* base, struct timeval* now,
 	wait->tv_sec = (time_t)-1;
 #endif
 
-	while((rbnode_t*)(p = (struct event*)rbtree_first(base->times))
-		!=RBTREE_NULL) {
+	while(base->num_times > 0) {
+		p = base->times[0];
 #ifndef S_SPLINT_S
 		if(p->ev_timeout.tv_sec > now->tv_sec ||
 			(p->ev_timeout.tv_sec==now->tv_sec && 
@@ -168,13 +274,61 @@ static void handle_timeouts(struct event_base* base, struct timeval* now,
 		}
 #endif
 		/* event times out, remove it */
-		(void)rbtree_delete(base->times, p);
+		heap_remove(base, p);
 		p->ev_events &= ~EV_TIMEOUT;
 		fptr_ok(fptr_whitelist_event(p->ev_callback));
 		(*p->ev_callback)(p->ev_fd, EV_TIMEOUT, p->ev_arg);
 	}
 }
 
+#ifdef USE_EPOLL
+/** call epoll and callbacks for the fds that are ready */
+static int handle_select(struct event_base* base, struct timeval* wait)
+{
+	int ret, i, msec = -1;
+	struct event* ev;
+
+#ifndef S_SPLINT_S
+	/* round up, so that the timeout has passed when it returns */
+	if(wait->tv_sec != (time_t)-1)
+		msec = (int)wait->tv_sec*1000 + (int)(wait->tv_usec+999)/1000;
+#endif
+	base->round++;
+	if((ret = epoll_wait(base->epfd, base->evs, MAX_EPOLL_EVENTS,
+		msec)) == -1) {
+		ret = errno;
+		if(settime(base) < 0)
+			return -1;
+		errno = ret;
+		if(ret == EAGAIN || ret == EINTR)
+			return 0;
+		return -1;
+	}
+	if(settime(base) < 0)
+		return -1;
+
+	for(i=0; i<ret; i++) {
+		int fd = base->evs[i].data.fd;
+		uint32_t e = base->evs[i].events;
+		short bits = 0;
+		/* the handlers can delete and add events, look it up */
+		if(fd < 0 || fd >= base->capfd || !(ev = base->fds[fd]) ||
+			base->fd_round[fd] == base->round)
+			continue;
+		/* like select, errors and hangup make it readable, writable */
+		if((e&(EPOLLIN|EPOLLERR|EPOLLHUP)))
+			bits |= EV_READ;
+		if((e&(EPOLLOUT|EPOLLERR|EPOLLHUP)))
+			bits |= EV_WRITE;
+		bits &= ev->ev_events;
+		if(bits) {
+			fptr_ok(fptr_whitelist_event(ev->ev_callback));
+			(*ev->ev_callback)(ev->ev_fd, bits, ev->ev_arg);
+		}
+	}
+	return 0;
+}
+#else /* USE_EPOLL */
 /** call select and callbacks for that */
 static int handle_select(struct event_base* base, struct timeval* wait)
 {
@@ -226,8 +380,9 @@ static int handle_select(struct event_base* base, struct timeval* wait)
 	}
 	return 0;
 }
+#endif /* USE_EPOLL */
 
-/** run select in a loop */
+/** run epoll or select in a loop */
 int event_base_dispatch(struct event_base* base)
 {
 	struct timeval wait;
@@ -239,12 +394,13 @@ int event_base_dispatch(struct event_base* base)
 		handle_timeouts(base, base->time_tv, &wait);
 		if(base->need_to_exit)
 			break;
-		/* do select */
+		/* do epoll or select */
 		if(handle_select(base, &wait) < 0) {
 			if(base->need_to_exit)
 				break;
 			return -1;
 		}
+		base->num_wakeups++;
 	}
 	base->need_to_exit = 0;
 	return 0;
@@ -269,6 +425,11 @@ void event_base_free(struct event_base* base)
 		free(base->fds);
 	if(base->signals)
 		free(base->signals);
+#ifdef USE_EPOLL
+	free(base->fd_round);
+	if(base->epfd != -1)
+		close(base->epfd);
+#endif
 	free(base);
 }
 
@@ -276,7 +437,6 @@ void event_base_free(struct event_base* base)
 void event_set(struct event* ev, int fd, short bits, 
 	void (*cb)(int, short, void *), void* arg)
 {
-	ev->node.key = ev;
 	ev->ev_fd = fd;
 	ev->ev_events = bits;
 	ev->ev_callback = cb;
@@ -293,14 +453,77 @@ int event_base_set(struct event_base* base, struct event* ev)
 	return 0;
 }
 
+#ifdef USE_EPOLL
+/** grow the fd arrays so the fd fits in them, false on alloc failure */
+static int
+grow_fds(struct event_base* base, int fd)
+{
+	int cap = base->capfd;
+	struct event** fds;
+	unsigned* rounds;
+	while(cap <= fd)
+		cap *= 2;
+	fds = (struct event**)realloc(base->fds, (size_t)cap*
+		sizeof(struct event*));
+	if(!fds)
+		return 0;
+	base->fds = fds;
+	rounds = (unsigned*)realloc(base->fd_round, (size_t)cap*
+		sizeof(unsigned));
+	if(!rounds)
+		return 0;
+	base->fd_round = rounds;
+	memset(&fds[base->capfd], 0, (size_t)(cap-base->capfd)*
+		sizeof(struct event*));
+	memset(&rounds[base->capfd], 0, (size_t)(cap-base->capfd)*
+		sizeof(unsigned));
+	base->capfd = cap;
+	return 1;
+}
+
+/** register the fd of the event with epoll */
+static int
+epoll_add(struct event* ev)
+{
+	struct epoll_event e;
+	memset(&e, 0, sizeof(e));
+	if(ev->ev_events&EV_READ)
+		e.events |= EPOLLIN;
+	if(ev->ev_events&EV_WRITE)
+		e.events |= EPOLLOUT;
+	e.data.fd = ev->ev_fd;
+	if(epoll_ctl(ev->ev_base->epfd, EPOLL_CTL_ADD, ev->ev_fd, &e) == -1) {
+		/* the fd is registered still, for an event that was not
+		 * deleted */
+		if(errno != EEXIST || epoll_ctl(ev->ev_base->epfd,
+			EPOLL_CTL_MOD, ev->ev_fd, &e) == -1) {
+			log_err("epoll_ctl: %s", strerror(errno));
+			return -1;
+		}
+	}
+	ev->ev_base->fd_round[ev->ev_fd] = ev->ev_base->round;
+	return 0;
+}
+#endif /* USE_EPOLL */
+
 /* add event to make it active, you may not change it with event_set anymore */
 int event_add(struct event* ev, struct timeval* tv)
 {
 	if(ev->added)
 		event_del(ev);
+#ifdef USE_EPOLL
+	if(ev->ev_fd != -1 && ev->ev_fd >= ev->ev_base->capfd &&
+		!grow_fds(ev->ev_base, ev->ev_fd))
+		return -1;
+#endif
 	if(ev->ev_fd != -1 && ev->ev_fd >= ev->ev_base->capfd)
 		return -1;
 	if( (ev->ev_events&(EV_READ|EV_WRITE)) && ev->ev_fd != -1) {
+#ifdef USE_EPOLL
+		if(epoll_add(ev) == -1)
+			return -1;
+		ev->ev_base->fds[ev->ev_fd] = ev;
+#else
 		ev->ev_base->fds[ev->ev_fd] = ev;
 		if(ev->ev_events&EV_READ) {
 			FD_SET(FD_SET_T ev->ev_fd, &ev->ev_base->reads);
@@ -310,6 +533,7 @@ int event_add(struct event* ev, struct timeval* tv)
 		}
 		FD_SET(FD_SET_T ev->ev_fd, &ev->ev_base->content);
 		FD_CLR(FD_SET_T ev->ev_fd, &ev->ev_base->ready);
+#endif /* USE_EPOLL */
 		if(ev->ev_fd > ev->ev_base->maxfd)
 			ev->ev_base->maxfd = ev->ev_fd;
 	}
@@ -323,7 +547,8 @@ int event_add(struct event* ev, struct timeval* tv)
 			ev->ev_timeout.tv_sec++;
 		}
 #endif
-		(void)rbtree_insert(ev->ev_base->times, &ev->node);
+		if(!heap_insert(ev->ev_base, ev))
+			return -1;
 	}
 	ev->added = 1;
 	return 0;
@@ -335,13 +560,19 @@ int event_del(struct event* ev)
 	if(ev->ev_fd != -1 && ev->ev_fd >= ev->ev_base->capfd)
 		return -1;
 	if((ev->ev_events&EV_TIMEOUT))
-		(void)rbtree_delete(ev->ev_base->times, &ev->node);
+		heap_remove(ev->ev_base, ev);
 	if((ev->ev_events&(EV_READ|EV_WRITE)) && ev->ev_fd != -1) {
 		ev->ev_base->fds[ev->ev_fd] = NULL;
+#ifdef USE_EPOLL
+		/* fails if the fd is closed already, that removed it */
+		(void)epoll_ctl(ev->ev_base->epfd, EPOLL_CTL_DEL, ev->ev_fd,
+			NULL);
+#else
 		FD_CLR(FD_SET_T ev->ev_fd, &ev->ev_base->reads);
 		FD_CLR(FD_SET_T ev->ev_fd, &ev->ev_base->writes);
 		FD_CLR(FD_SET_T ev->ev_fd, &ev->ev_base->ready);
 		FD_CLR(FD_SET_T ev->ev_fd, &ev->ev_base->content);
+#endif /* USE_EPOLL */
 	}
 	ev->added = 0;
 	return 0;
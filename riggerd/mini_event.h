@@ -36,15 +36,18 @@
 /**
  * \file
  * This file implements part of the event(3) libevent api.
- * The back end is only select. Max number of fds is limited.
+ * The back end is epoll where configure finds it, and otherwise select.
+ * With select the max number of fds is limited.
  * Max number of signals is limited, one handler per signal only.
  * And one handler per fd.
  *
- * Although limited to select() and a max (1024) open fds, it
- * is efficient:
+ * With select, limited to a max (1024) open fds, it is efficient:
  * o dispatch call caches fd_sets to use. 
  * o handler calling takes time ~ to the number of fds.
- * o timeouts are stored in a redblack tree, sorted, so take log(n).
+ * With epoll the fds are registered with the kernel when they are added,
+ * and handler calling takes time ~ to the number of ready fds.
+ * o timeouts are stored in a 4-ary min-heap in an array, add and delete
+ *   take log(n), and the next timeout is the first element.
  * Timeouts are only accurate to the second (no subsecond accuracy).
  * To avoid cpu hogging, fractional timeouts are rounded up to a whole second.
  */
@@ -69,25 +72,47 @@
 /** event must persist */
 #define EV_PERSIST	0x10
 
-/* needs our redblack tree */
-#include "rbtree.h"
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
 
-/** max number of file descriptors to support */
+/** max number of file descriptors to support, with epoll the start size
+ * of the fd array, that grows when needed */
 #define MAX_FDS 1024
+/** max number of ready fds that one epoll call returns */
+#define MAX_EPOLL_EVENTS 64
 /** max number of signals to support */
 #define MAX_SIG 32
+/** number of children of a node in the timeout heap */
+#define HEAP_ARITY 4
 
 /** event base */
 struct event_base
 {
-	/** sorted by timeout (absolute), ptr */
-	rbtree_t* times;
+	/** heap of the events with a timeout (absolute), the first one is
+	 * the next to time out */
+	struct event** times;
+	/** number of events in the heap */
+	int num_times;
+	/** capacity - size of the times array */
+	int cap_times;
 	/** array of 0 - maxfd of ptr to event for it */
 	struct event** fds;
 	/** max fd in use */
 	int maxfd;
 	/** capacity - size of the fds array */
 	int capfd;
+#ifdef USE_EPOLL
+	/** the epoll fd, or -1 */
+	int epfd;
+	/** the ready fds that epoll returned */
+	struct epoll_event evs[MAX_EPOLL_EVENTS];
+	/** number of the epoll call, counts the loops */
+	unsigned round;
+	/** array of 0 - capfd of the round in which the fd was added, the
+	 * fds that are added by handlers are not called in that round */
+	unsigned* fd_round;
+#else
 	/* fdset for read write, for fds ready, and added */
 	fd_set 
 		/** fds for reading */
@@ -98,10 +123,13 @@ struct event_base
 		ready, 
 		/** ready plus newly added events. */
 		content;
+#endif /* USE_EPOLL */
 	/** array of 0 - maxsig of ptr to event for it */
 	struct event** signals;
 	/** if we need to exit */
 	int need_to_exit;
+	/** number of times the loop woke up from waiting */
+	unsigned long long num_wakeups;
 	/** where to store time in seconds */
 	uint32_t* time_secs;
 	/** where to store time in microseconds */
@@ -112,8 +140,8 @@ struct event_base
  * Event structure. Has some of the event elements.
  */
 struct event {
-	/** node in timeout rbtree */
-	rbnode_t node;
+	/** position in the timeout heap plus one, 0 if not in the heap */
+	int heap_idx;
 	/** is event already added */
 	int added;
 
@@ -137,9 +165,9 @@ struct event {
 void *event_init(uint32_t* time_secs, struct timeval* time_tv);
 /** get version */
 const char *event_get_version(void);
-/** get polling method, select */
+/** get polling method, epoll or select */
 const char *event_get_method(void);
-/** run select in a loop */
+/** run epoll or select in a loop */
 int event_base_dispatch(struct event_base *);
 /** exit that loop */
 int event_base_loopexit(struct event_base *, struct timeval *);
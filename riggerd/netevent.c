@@ -74,6 +74,16 @@
 /** The TCP reading or writing query timeout in seconds */
 #define TCP_QUERY_TIMEOUT 120 
 
+/** number of size classes of the buffer pool */
+#define COMM_POOL_CLASSES 3
+/** max number of free buffers kept in the pool per size class */
+#define COMM_POOL_KEEP 8
+/** size of the buffers in the pool per size class, a TCP comm point
+ * starts with the smallest and changes to a larger one when a length
+ * prefix asks for it */
+static const size_t comm_pool_size[COMM_POOL_CLASSES] = { 512, 4096,
+	65553 };
+
 #ifndef NONBLOCKING_IS_BROKEN
 /** number of UDP reads to perform per read indication from select */
 #define NUM_UDP_PER_SELECT 100
@@ -115,6 +125,10 @@ struct internal_base {
 	uint32_t secs;
 	/** timeval with current time */
 	struct timeval now;
+	/** free buffers in the pool, per size class */
+	ldns_buffer* pool[COMM_POOL_CLASSES][COMM_POOL_KEEP];
+	/** number of free buffers in the pool, per size class */
+	int pool_num[COMM_POOL_CLASSES];
 };
 
 /**
@@ -127,6 +141,8 @@ struct internal_timer {
 	struct event ev;
 	/** is timer enabled */
 	uint8_t enabled;
+	/** msec the timer may be late, to run it with other timers */
+	int slack;
 };
 
 /**
@@ -223,8 +239,12 @@ comm_base_create(int sigs)
 void 
 comm_base_delete(struct comm_base* b)
 {
+	int i;
 	if(!b)
 		return;
+	for(i = 0; i < COMM_POOL_CLASSES; i++)
+		while(b->eb->pool_num[i] > 0)
+			ldns_buffer_free(b->eb->pool[i][--b->eb->pool_num[i]]);
 #ifdef USE_MINI_EVENT
 	event_base_free(b->eb->base);
 #elif defined(HAVE_EVENT_BASE_FREE) && defined(HAVE_EVENT_BASE_ONCE)
@@ -245,6 +265,17 @@ comm_base_timept(struct comm_base* b, uint32_t** tt, struct timeval** tv)
 	*tv = &b->eb->now;
 }
 
+unsigned long long 
+comm_base_wakeups(struct comm_base* b)
+{
+#ifdef USE_MINI_EVENT
+	return b->eb->base->num_wakeups;
+#else
+	(void)b;
+	return 0;
+#endif
+}
+
 void 
 comm_base_dispatch(struct comm_base* b)
 {
@@ -824,6 +855,14 @@ tcp_callback_reader(struct comm_point* c)
 	}
 }
 
+/** note the time of an event on the comm point, the first time only */
+static void
+comm_point_stamp(struct comm_point* c, struct timeval* t)
+{
+	if(t->tv_sec == 0 && t->tv_usec == 0)
+		*t = c->ev->base->eb->now;
+}
+
 /** continue ssl handshake */
 static int
 ssl_handshake(struct comm_point* c)
@@ -876,6 +915,7 @@ ssl_handshake(struct comm_point* c)
 	/* this is where peer verification could take place */
 	log_addr(VERB_ALGO, "SSL DNS connection", &c->repinfo.addr,
 		c->repinfo.addrlen);
+	comm_point_stamp(c, &c->ssl_shake_time);
 
 	/* setup listen rw correctly */
 	if(c->tcp_is_reading) {
@@ -926,8 +966,8 @@ ssl_handle_read(struct comm_point* c)
 		c->tcp_byte_count += r;
 		if(c->tcp_byte_count != sizeof(uint16_t))
 			return 1;
-		if(ldns_buffer_read_u16_at(c->buffer, 0) >
-			ldns_buffer_capacity(c->buffer)) {
+		if(!comm_point_buffer_reserve(c,
+			ldns_buffer_read_u16_at(c->buffer, 0))) {
 			verbose(VERB_QUERY, "ssl: dropped larger than buffer");
 			return 0;
 		}
@@ -1109,8 +1149,8 @@ comm_point_tcp_handle_read(int fd, struct comm_point* c, int short_ok)
 		c->tcp_byte_count += r;
 		if(c->tcp_byte_count != sizeof(uint16_t))
 			return 1;
-		if(ldns_buffer_read_u16_at(c->buffer, 0) >
-			ldns_buffer_capacity(c->buffer)) {
+		if(!comm_point_buffer_reserve(c,
+			ldns_buffer_read_u16_at(c->buffer, 0))) {
 			verbose(VERB_QUERY, "tcp: dropped larger than buffer");
 			return 0;
 		}
@@ -1211,6 +1251,11 @@ comm_point_tcp_handle_write(int fd, struct comm_point* c)
 				c->repinfo.addrlen);
 			return 0;
 		}
+		comm_point_stamp(c, &c->tcp_connect_time);
+	}
+	if(c->tcp_write_prefixed && c->tcp_byte_count < sizeof(uint16_t)) {
+		/* the length prefixes are in the buffer already */
+		c->tcp_byte_count = sizeof(uint16_t);
 	}
 	if(c->ssl)
 		return ssl_handle_it(c);
@@ -1401,6 +1446,7 @@ comm_point_create_udp(struct comm_base *base, int fd, ldns_buffer* buffer,
 	c->do_not_close = 0;
 	c->tcp_do_toggle_rw = 0;
 	c->tcp_check_nb_connect = 0;
+	c->tcp_write_prefixed = 0;
 	c->inuse = 0;
 	c->callback = callback;
 	c->cb_arg = callback_arg;
@@ -1452,6 +1498,7 @@ comm_point_create_udp_ancil(struct comm_base *base, int fd,
 	c->inuse = 0;
 	c->tcp_do_toggle_rw = 0;
 	c->tcp_check_nb_connect = 0;
+	c->tcp_write_prefixed = 0;
 	c->callback = callback;
 	c->cb_arg = callback_arg;
 	evbits = EV_READ | EV_PERSIST;
@@ -1470,6 +1517,65 @@ comm_point_create_udp_ancil(struct comm_base *base, int fd,
 	return c;
 }
 
+/** get a buffer of at least size from the pool, or a new one */
+static ldns_buffer*
+comm_pool_get(struct comm_base* b, size_t size)
+{
+	ldns_buffer* buf;
+	int i;
+	for(i = 0; i < COMM_POOL_CLASSES; i++) {
+		if(size <= comm_pool_size[i])
+			break;
+	}
+	if(i == COMM_POOL_CLASSES)
+		return ldns_buffer_new(size); /* too large for the pool */
+	if(b->eb->pool_num[i] > 0) {
+		buf = b->eb->pool[i][--b->eb->pool_num[i]];
+		ldns_buffer_clear(buf);
+		return buf;
+	}
+	return ldns_buffer_new(comm_pool_size[i]);
+}
+
+/** put the buffer back in the pool, it is freed if it is not of a size
+ * class or the pool has enough of them */
+static void
+comm_pool_put(struct comm_base* b, ldns_buffer* buf)
+{
+	int i;
+	if(!buf)
+		return;
+	for(i = 0; i < COMM_POOL_CLASSES; i++) {
+		if(ldns_buffer_capacity(buf) == comm_pool_size[i] &&
+			b->eb->pool_num[i] < COMM_POOL_KEEP) {
+			b->eb->pool[i][b->eb->pool_num[i]++] = buf;
+			return;
+		}
+	}
+	ldns_buffer_free(buf);
+}
+
+int
+comm_point_buffer_reserve(struct comm_point* c, size_t size)
+{
+	ldns_buffer* buf;
+	if(size <= ldns_buffer_capacity(c->buffer))
+		return 1;
+	if(size > c->buffer_max)
+		return 0;
+	if(!(buf = comm_pool_get(c->ev->base, size))) {
+		log_err("out of memory");
+		return 0;
+	}
+	memmove(ldns_buffer_begin(buf), ldns_buffer_begin(c->buffer),
+		ldns_buffer_limit(c->buffer));
+	ldns_buffer_set_limit(buf, ldns_buffer_limit(c->buffer));
+	ldns_buffer_set_position(buf, ldns_buffer_position(c->buffer));
+	comm_pool_put(c->ev->base, c->buffer);
+	c->buffer = buf;
+	return 1;
+}
+
 static struct comm_point* 
 comm_point_create_tcp_handler(struct comm_base *base, 
 	struct comm_point* parent, size_t bufsize,
@@ -1488,7 +1594,8 @@ comm_point_create_tcp_handler(struct comm_base *base,
 	}
 	c->ev->base = base;
 	c->fd = -1;
-	c->buffer = ldns_buffer_new(bufsize);
+	c->buffer = comm_pool_get(base, comm_pool_size[0]);
+	c->buffer_max = bufsize;
 	if(!c->buffer) {
 		free(c->ev);
 		free(c);
@@ -1512,6 +1619,7 @@ comm_point_create_tcp_handler(struct comm_base *base,
 	c->do_not_close = 0;
 	c->tcp_do_toggle_rw = 1;
 	c->tcp_check_nb_connect = 0;
+	c->tcp_write_prefixed = 0;
 	c->repinfo.c = c;
 	c->callback = callback;
 	c->cb_arg = callback_arg;
@@ -1570,6 +1678,7 @@ comm_point_create_tcp(struct comm_base *base, int fd, int num, size_t bufsize,
 	c->do_not_close = 0;
 	c->tcp_do_toggle_rw = 0;
 	c->tcp_check_nb_connect = 0;
+	c->tcp_write_prefixed = 0;
 	c->callback = NULL;
 	c->cb_arg = NULL;
 	evbits = EV_READ | EV_PERSIST;
@@ -1613,7 +1722,8 @@ comm_point_create_tcp_out(struct comm_base *base, size_t bufsize,
 	}
 	c->ev->base = base;
 	c->fd = -1;
-	c->buffer = ldns_buffer_new(bufsize);
+	c->buffer = comm_pool_get(base, comm_pool_size[0]);
+	c->buffer_max = bufsize;
 	if(!c->buffer) {
 		free(c->ev);
 		free(c);
@@ -1631,6 +1741,7 @@ comm_point_create_tcp_out(struct comm_base *base, size_t bufsize,
 	c->do_not_close = 0;
 	c->tcp_do_toggle_rw = 1;
 	c->tcp_check_nb_connect = 1;
+	c->tcp_write_prefixed = 0;
 	c->repinfo.c = c;
 	c->callback = callback;
 	c->cb_arg = callback_arg;
@@ -1665,7 +1776,8 @@ comm_point_create_local(struct comm_base *base, int fd, size_t bufsize,
 	}
 	c->ev->base = base;
 	c->fd = fd;
-	c->buffer = ldns_buffer_new(bufsize);
+	c->buffer = comm_pool_get(base, comm_pool_size[0]);
+	c->buffer_max = bufsize;
 	if(!c->buffer) {
 		free(c->ev);
 		free(c);
@@ -1683,6 +1795,7 @@ comm_point_create_local(struct comm_base *base, int fd, size_t bufsize,
 	c->do_not_close = 1;
 	c->tcp_do_toggle_rw = 0;
 	c->tcp_check_nb_connect = 0;
+	c->tcp_write_prefixed = 0;
 	c->callback = callback;
 	c->cb_arg = callback_arg;
 	/* libevent stuff */
@@ -1730,6 +1843,7 @@ comm_point_create_raw(struct comm_base* base, int fd, int writing,
 	c->do_not_close = 1;
 	c->tcp_do_toggle_rw = 0;
 	c->tcp_check_nb_connect = 0;
+	c->tcp_write_prefixed = 0;
 	c->callback = callback;
 	c->cb_arg = callback_arg;
 	/* libevent stuff */
@@ -1788,7 +1902,7 @@ comm_point_delete(struct comm_point* c)
 	}
 	free(c->timeout);
 	if(c->type == comm_tcp || c->type == comm_local)
-		ldns_buffer_free(c->buffer);
+		comm_pool_put(c->ev->base, c->buffer);
 	free(c->ev);
 	free(c);
 }
@@ -1946,10 +2060,31 @@ comm_timer_disable(struct comm_timer* timer)
 	timer->ev_timer->enabled = 0;
 }
 
+/** move the timeout later, to the next multiple of the slack, so that the
+ * timers with slack that are due in the same window run in one wakeup */
+static void
+comm_timer_coalesce(struct internal_timer* t, struct timeval* tv,
+	struct timeval* res)
+{
+	struct timeval* now = &t->base->eb->now;
+	uint64_t slack = (uint64_t)t->slack*1000;
+	uint64_t n = (uint64_t)now->tv_sec*1000000 + (uint64_t)now->tv_usec;
+	uint64_t due = n + (uint64_t)tv->tv_sec*1000000 +
+		(uint64_t)tv->tv_usec;
+	due = (due + slack - 1)/slack*slack;
+	res->tv_sec = (long)((due - n)/1000000);
+	res->tv_usec = (long)((due - n)%1000000);
+}
+
 void 
 comm_timer_set(struct comm_timer* timer, struct timeval* tv)
 {
+	struct timeval late;
 	log_assert(tv);
+	if(timer->ev_timer->slack > 0 && (tv->tv_sec > 0 || tv->tv_usec > 0)) {
+		comm_timer_coalesce(timer->ev_timer, tv, &late);
+		tv = &late;
+	}
 	if(timer->ev_timer->enabled)
 		comm_timer_disable(timer);
 	event_set(&timer->ev_timer->ev, -1, EV_TIMEOUT,
@@ -1984,6 +2119,12 @@ comm_timer_callback(int ATTR_UNUSED(fd), short event, void* arg)
 	(*tm->callback)(tm->cb_arg);
 }
 
+void 
+comm_timer_set_slack(struct comm_timer* timer, int msec)
+{
+	timer->ev_timer->slack = msec;
+}
+
 int 
 comm_timer_is_set(struct comm_timer* timer)
 {
@@ -139,6 +139,9 @@ struct comm_point {
 
 	/** buffer pointer. Either to perthread, or own buffer or NULL */
 	ldns_buffer* buffer;
+	/** for TCP, the own buffer is from the pool of the comm base, it
+	 * starts small and grows up to this size when it needs more */
+	size_t buffer_max;
 
 	/* -------- TCP Handler -------- */
 	/** Read/Write state for TCP */
@@ -211,6 +214,16 @@ struct comm_point {
 	/** if set, checks for pending error from nonblocking connect() call.*/
 	int tcp_check_nb_connect;
 
+	/** if set, the buffer to write holds one or more messages that
+	 * have their own two byte length prefix, it is written as is.
+	 * Used to pipeline queries on outgoing tcp. */
+	int tcp_write_prefixed;
+
+	/** time the nonblocking connect completed, zero if not yet */
+	struct timeval tcp_connect_time;
+	/** time the ssl handshake completed, zero if not yet */
+	struct timeval ssl_shake_time;
+
 	/** number of queries outstanding on this socket, used by
 	 * outside network for udp ports */
 	int inuse;
@@ -292,13 +305,22 @@ void comm_base_delete(struct comm_base* b);
 
 /**
  * Obtain two pointers. The pointers never change (until base_delete()).
- * The pointers point to time values that are updated regularly.
+ * The pointers point to time values that are updated regularly.  With the
+ * builtin event system they are from the monotonic clock if there is one,
+ * only the difference between them is the elapsed time.
  * @param b: the communication base that will update the time values.
  * @param tt: pointer to time in seconds is returned.
  * @param tv: pointer to time in microseconds is returned.
  */
 void comm_base_timept(struct comm_base* b, uint32_t** tt, struct timeval** tv);
 
+/**
+ * Get the number of times the event loop woke up from waiting.
+ * @param b: comm base.
+ * @return the number of wakeups, 0 if the event system does not count them.
+ */
+unsigned long long comm_base_wakeups(struct comm_base* b);
+
 /**
  * Dispatch the comm base events.
  * @param b: the communication to perform.
@@ -394,6 +416,17 @@ struct comm_point* comm_point_create_local(struct comm_base* base,
 	int fd, size_t bufsize, 
 	comm_point_callback_t* callback, void* callback_arg);
 
+/**
+ * Make the buffer of a TCP comm point large enough.  It is changed for a
+ * buffer of a larger size class from the pool of the comm base, with the
+ * contents, position and limit kept.  The old buffer goes to the pool.
+ * @param c: the TCP comm point, c->buffer can change.
+ * @param size: the capacity that is needed.
+ * @return false if size is larger than the max of the comm point, or
+ *	on alloc failure.
+ */
+int comm_point_buffer_reserve(struct comm_point* c, size_t size);
+
 /**
  * Create commpoint to listen to a local domain pipe descriptor.
  * @param base: in which base to alloc the commpoint.
@@ -497,6 +530,15 @@ void comm_timer_disable(struct comm_timer* timer);
  */
 void comm_timer_set(struct comm_timer* timer, struct timeval* tv);
 
+/**
+ * Set the slack of the timer, the timer may run that much later.  The
+ * timeout is moved to the next multiple of the slack, so that timers
+ * that are due in the same window run in one wakeup of the event loop.
+ * @param timer: the timer.
+ * @param msec: the slack, 0 for none.
+ */
+void comm_timer_set_slack(struct comm_timer* timer, int msec);
+
 /**
  * delete timer.
  * @param timer: to delete.
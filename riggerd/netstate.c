@@ -0,0 +1,320 @@
+/*
+ * netstate.c - dnssec-trigger probe results stored per network
+ *
+ * Copyright (c) 2011, NLnet Labs. All rights reserved.
+ *
+ * This software is open source.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the NLNET LABS nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file
+ *
+ * This file contains the last probe result for the networks that were
+ * seen.  The state file has a line per network:
+ * net <time> <state> <tcp> <msec> <dns servers> <working servers>
+ * with the IP lists separated by commas, or - if empty.
+ */
+#include "config.h"
+#include "netstate.h"
+#include "svr.h"
+#include "log.h"
+
+/** names of the results in the file */
+static const char*
+state2str(int state)
+{
+	switch(state) {
+		case res_cache: return "cache";
+		case res_auth: return "auth";
+		case res_tcp: return "tcp";
+		case res_ssl: return "ssl";
+		default: break;
+	}
+	return NULL;
+}
+
+/** result from the name in the file, -1 if not known */
+static int
+str2state(const char* s)
+{
+	if(strcmp(s, "cache") == 0) return res_cache;
+	if(strcmp(s, "auth") == 0) return res_auth;
+	if(strcmp(s, "tcp") == 0) return res_tcp;
+	if(strcmp(s, "ssl") == 0) return res_ssl;
+	return -1;
+}
+
+/** compare strings, for qsort */
+static int
+str_cmp(const void* a, const void* b)
+{
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+char* netstate_fingerprint(const char* ips)
+{
+	char buf[10240];
+	char* words[128];
+	char* fp, *now = buf, *next;
+	size_t n = 0, i, len = 0;
+	if(strlen(ips) >= sizeof(buf))
+		return NULL;
+	(void)strlcpy(buf, ips, sizeof(buf));
+	while(*now && n < sizeof(words)/sizeof(words[0])) {
+		while(*now == ' ' || *now == ',')
+			now++;
+		if(!*now)
+			break;
+		words[n++] = now;
+		next = now + strcspn(now, " ,");
+		if(*next)
+			*next++ = 0;
+		now = next;
+	}
+	qsort(words, n, sizeof(words[0]), &str_cmp);
+	fp = (char*)malloc(strlen(ips)+1);
+	if(!fp) {
+		log_err("out of memory");
+		return NULL;
+	}
+	fp[0] = 0;
+	for(i=0; i<n; i++) {
+		if(i > 0 && strcmp(words[i], words[i-1]) == 0)
+			continue;
+		len += (size_t)snprintf(fp+len, strlen(ips)+1-len, "%s%s",
+			len?" ":"", words[i]);
+	}
+	return fp;
+}
+
+struct netstate* netstate_find(struct netstate* list, const char* fp,
+	time_t now)
+{
+	struct netstate* s;
+	for(s = list; s; s = s->next) {
+		if(strcmp(s->fp, fp) == 0) {
+			if(now - s->time > NETSTATE_TTL || now < s->time)
+				return NULL;
+			return s;
+		}
+	}
+	return NULL;
+}
+
+/** delete a stored result */
+static void
+netstate_delete(struct netstate* s)
+{
+	if(!s) return;
+	free(s->fp);
+	free(s->servers);
+	free(s);
+}
+
+void netstate_list_delete(struct netstate* list)
+{
+	struct netstate* s = list, *ns;
+	while(s) {
+		ns = s->next;
+		netstate_delete(s);
+		s = ns;
+	}
+}
+
+void netstate_remove(struct netstate** list, const char* fp)
+{
+	struct netstate* s = *list, **ps = list;
+	while(s) {
+		if(strcmp(s->fp, fp) == 0) {
+			*ps = s->next;
+			netstate_delete(s);
+			return;
+		}
+		ps = &s->next;
+		s = s->next;
+	}
+}
+
+/** create a stored result */
+static struct netstate*
+netstate_create(const char* fp, int state, const char* servers, int tcp,
+	int msec, time_t t)
+{
+	struct netstate* s = (struct netstate*)calloc(1, sizeof(*s));
+	if(!s) {
+		log_err("out of memory");
+		return NULL;
+	}
+	s->fp = strdup(fp);
+	s->servers = strdup(servers);
+	if(!s->fp || !s->servers) {
+		log_err("out of memory");
+		netstate_delete(s);
+		return NULL;
+	}
+	s->state = state;
+	s->tcp = tcp;
+	s->msec = msec;
+	s->time = t;
+	return s;
+}
+
+void netstate_store(struct netstate** list, const char* fp, int state,
+	const char* servers, int tcp, int msec, time_t now)
+{
+	struct netstate* s;
+	int n = 1;
+	netstate_remove(list, fp);
+	if(!(s = netstate_create(fp, state, servers, tcp, msec, now)))
+		return;
+	s->next = *list;
+	*list = s;
+	/* keep the most recent ones */
+	while(s->next) {
+		if(++n > NETSTATE_MAX) {
+			netstate_list_delete(s->next);
+			s->next = NULL;
+			break;
+		}
+		s = s->next;
+	}
+}
+
+/** replace the separator characters in the string */
+static void
+str_replace_chr(char* s, char from, char to)
+{
+	while((s = strchr(s, from)) != NULL)
+		*s++ = to;
+}
+
+struct netstate* netstate_read(const char* file)
+{
+	struct netstate* list = NULL, *last = NULL, *s;
+	char buf[10240], state[32], fp[4096], servers[4096];
+	long long t;
+	int tcp, msec, n = 0;
+	FILE* in;
+	if(!file || !file[0])
+		return NULL;
+	if(!(in = fopen(file, "r"))) {
+		if(errno != ENOENT)
+			log_err("cannot read %s: %s", file, strerror(errno));
+		return NULL;
+	}
+	while(fgets(buf, (int)sizeof(buf), in) && n < NETSTATE_MAX) {
+		if(buf[0] == '#')
+			continue;
+		if(sscanf(buf, "net %lld %31s %d %d %4095s %4095s", &t, state,
+			&tcp, &msec, fp, servers) != 6 ||
+			str2state(state) == -1) {
+			verbose(VERB_ALGO, "%s: skip bad line: %s", file, buf);
+			continue;
+		}
+		if(strcmp(servers, "-") == 0)
+			servers[0] = 0;
+		str_replace_chr(fp, ',', ' ');
+		str_replace_chr(servers, ',', ' ');
+		s = netstate_create(fp, str2state(state), servers, tcp, msec,
+			(time_t)t);
+		if(!s)
+			break;
+		if(last) last->next = s;
+		else	list = s;
+		last = s;
+		n++;
+	}
+	fclose(in);
+	verbose(VERB_ALGO, "read %d networks from %s", n, file);
+	return list;
+}
+
+/** print an IP list, with commas, - if empty */
+static void
+print_ip_list(FILE* out, const char* ips)
+{
+	const char* p;
+	if(!ips[0]) {
+		fputc('-', out);
+		return;
+	}
+	for(p = ips; *p; p++)
+		fputc((*p==' ')?',':*p, out);
+}
+
+FILE* netstate_tmp_open(const char* file, char* tmp, size_t tmplen)
+{
+	FILE* out;
+	snprintf(tmp, tmplen, "%s.tmp", file);
+	if(!(out = fopen(tmp, "w")))
+		log_err("cannot write %s: %s", tmp, strerror(errno));
+	return out;
+}
+
+void netstate_tmp_commit(FILE* out, const char* tmp, const char* file)
+{
+	if(fclose(out) != 0) {
+		log_err("cannot write %s: %s", tmp, strerror(errno));
+		unlink(tmp);
+		return;
+	}
+#ifdef USE_WINSOCK
+	/* rename does not replace an existing file on windows */
+	unlink(file);
+#endif
+	if(rename(tmp, file) != 0) {
+		log_err("cannot rename %s to %s: %s", tmp, file,
+			strerror(errno));
+		unlink(tmp);
+	}
+}
+
+void netstate_write(struct netstate* list, const char* file)
+{
+	char tmp[1024];
+	struct netstate* s;
+	FILE* out;
+	if(!file || !file[0])
+		return;
+	if(!(out = netstate_tmp_open(file, tmp, sizeof(tmp))))
+		return;
+	fprintf(out, "# dnssec-trigger probe results per network\n");
+	for(s = list; s; s = s->next) {
+		if(!state2str(s->state))
+			continue;
+		fprintf(out, "net %lld %s %d %d ", (long long)s->time,
+			state2str(s->state), s->tcp, s->msec);
+		print_ip_list(out, s->fp);
+		fputc(' ', out);
+		print_ip_list(out, s->servers);
+		fputc('\n', out);
+	}
+	netstate_tmp_commit(out, tmp, file);
+}
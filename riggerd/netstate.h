@@ -0,0 +1,159 @@
+/*
+ * netstate.h - dnssec-trigger probe results stored per network
+ *
+ * Copyright (c) 2011, NLnet Labs. All rights reserved.
+ *
+ * This software is open source.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the NLNET LABS nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file
+ *
+ * This file contains the last probe result for the networks that were
+ * seen.  A network is known by the DNS servers that were submitted for it.
+ * The results are stored in a state file, so that on a known network the
+ * last result can be used at once while the probes confirm it.
+ */
+
+#ifndef NETSTATE_H
+#define NETSTATE_H
+
+/** max number of networks remembered */
+#define NETSTATE_MAX 32
+/** seconds a stored result is used */
+#define NETSTATE_TTL (7*86400)
+
+/** working tcp and ssl ports, bits in netstate tcp */
+#define NETSTATE_TCP80_IP4 0x01
+#define NETSTATE_TCP80_IP6 0x02
+#define NETSTATE_TCP443_IP4 0x04
+#define NETSTATE_TCP443_IP6 0x08
+#define NETSTATE_SSL443_IP4 0x10
+#define NETSTATE_SSL443_IP6 0x20
+
+/**
+ * Stored probe result for a network.
+ */
+struct netstate {
+	/** next in list, most recently used first */
+	struct netstate* next;
+	/** fingerprint of the network, sorted DNS server IPs */
+	char* fp;
+	/** the result, res_cache, res_auth, res_tcp or res_ssl */
+	int state;
+	/** the working cache servers (for res_cache), space separated */
+	char* servers;
+	/** the working tcp and ssl ports, NETSTATE_TCP80_IP4, ... */
+	int tcp;
+	/** msec the probe took to get the result */
+	int msec;
+	/** time the result was stored */
+	time_t time;
+};
+
+/**
+ * Create the fingerprint for the network from the submitted DNS servers.
+ * @param ips: the IP addresses, separated by spaces.
+ * @return malloced string with the sorted, unique IPs, or NULL on alloc
+ * 	failure.
+ */
+char* netstate_fingerprint(const char* ips);
+
+/**
+ * Find the stored result for the network.
+ * @param list: the stored results.
+ * @param fp: fingerprint of the network.
+ * @param now: the time now, old results are not returned.
+ * @return the result or NULL.
+ */
+struct netstate* netstate_find(struct netstate* list, const char* fp,
+	time_t now);
+
+/**
+ * Store the result for a network, it replaces an earlier result.
+ * @param list: the stored results, the new result is put in front and
+ * 	the list is kept to NETSTATE_MAX.
+ * @param fp: fingerprint of the network.
+ * @param state: the result.
+ * @param servers: working cache servers, space separated.
+ * @param tcp: working tcp and ssl ports.
+ * @param msec: time the probe took.
+ * @param now: the time now.
+ */
+void netstate_store(struct netstate** list, const char* fp, int state,
+	const char* servers, int tcp, int msec, time_t now);
+
+/**
+ * Remove the result for a network.
+ * @param list: the stored results.
+ * @param fp: fingerprint of the network.
+ */
+void netstate_remove(struct netstate** list, const char* fp);
+
+/**
+ * Read the stored results from file.
+ * @param file: the state file, if "" nothing is read.
+ * @return list of results, NULL if none.
+ */
+struct netstate* netstate_read(const char* file);
+
+/**
+ * Write the stored results to file.
+ * @param list: the stored results.
+ * @param file: the state file, if "" nothing is written.
+ */
+void netstate_write(struct netstate* list, const char* file);
+
+/**
+ * Open the temporary file to write a file, like the state file, so that
+ * readers never see a partly written file.
+ * @param file: the file to write.
+ * @param tmp: the name of the temporary file is returned here.
+ * @param tmplen: size of the tmp buffer.
+ * @return the open file, or NULL on error (logged).
+ */
+FILE* netstate_tmp_open(const char* file, char* tmp, size_t tmplen);
+
+/**
+ * Close the temporary file and rename it to the file.  On error the
+ * temporary file is removed.
+ * @param out: the file from netstate_tmp_open, it is closed.
+ * @param tmp: the name of the temporary file.
+ * @param file: the file to write.
+ */
+void netstate_tmp_commit(FILE* out, const char* tmp, const char* file);
+
+/**
+ * Delete the list of stored results.
+ * @param list: the list to delete.
+ */
+void netstate_list_delete(struct netstate* list);
+
+#endif /* NETSTATE_H */
@@ -0,0 +1,253 @@
+/*
+ * prewarm.c - dnssec-trigger pre-warm of the unbound cache
+ *
+ * Copyright (c) 2011, NLnet Labs. All rights reserved.
+ *
+ * This software is open source.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the NLNET LABS nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file
+ *
+ * This file contains the pre-warm of the unbound cache.  A mark is put in
+ * the command queue after the hooks that set up unbound, when it is done
+ * the queries are sent to unbound on 127.0.0.1, a few at a time.  Any
+ * answer from unbound is good, the chain of trust is in its cache then.
+ */
+#include "config.h"
+#include "prewarm.h"
+#include "probe.h"
+#include "svr.h"
+#include "cfg.h"
+#include "log.h"
+#include "cmdq.h"
+#include "stats.h"
+#include "netevent.h"
+#include <ldns/ldns.h>
+
+/** the address of unbound, that is pre-warmed */
+#define PREWARM_IP "127.0.0.1"
+
+struct prewarm* prewarm_create(void)
+{
+	struct prewarm* pw = (struct prewarm*)calloc(1, sizeof(*pw));
+	if(!pw) {
+		log_err("out of memory");
+		return NULL;
+	}
+	pw->warm = (struct probe_ip*)calloc(1, sizeof(*pw->warm));
+	if(!pw->warm) {
+		log_err("out of memory");
+		free(pw);
+		return NULL;
+	}
+	pw->warm->name = strdup(PREWARM_IP);
+	if(!pw->warm->name) {
+		log_err("out of memory");
+		free(pw->warm);
+		free(pw);
+		return NULL;
+	}
+	pw->warm->port = DNS_PORT;
+	return pw;
+}
+
+/** delete the queries in progress */
+static void
+prewarm_clear(struct prewarm* pw)
+{
+	int i;
+	for(i = 0; i < PREWARM_MAX_BUSY; i++) {
+		outq_delete(pw->busy[i]);
+		pw->busy[i] = NULL;
+		free(pw->name[i]);
+		pw->name[i] = NULL;
+	}
+	pw->num_busy = 0;
+	pw->running = 0;
+}
+
+void prewarm_delete(struct prewarm* pw)
+{
+	if(!pw)
+		return;
+	prewarm_clear(pw);
+	probe_delete(pw->warm);
+	free(pw);
+}
+
+void prewarm_stop(struct prewarm* pw)
+{
+	if(pw->running)
+		verbose(VERB_ALGO, "prewarm stopped");
+	pw->wanted = 0;
+	prewarm_clear(pw);
+}
+
+/** get the query with the index in the list, the root DNSKEY, the DNSKEY
+ * and DS of the TLDs and then the hot names.  false at the end of the list
+ * or on alloc failure */
+static int
+prewarm_get(struct cfg* cfg, int idx, char** name, int* type)
+{
+	const char* n;
+	if(idx == 0) {
+		n = ".";
+		*type = LDNS_RR_TYPE_DNSKEY;
+	} else if(idx-1 < 2*cfg->num_prewarm_tld) {
+		n = strlist_get_num(cfg->prewarm_tld, (unsigned)(idx-1)/2);
+		*type = ((idx-1)%2 == 0)?LDNS_RR_TYPE_DNSKEY:LDNS_RR_TYPE_DS;
+	} else if(idx-1-2*cfg->num_prewarm_tld < cfg->num_prewarm_name) {
+		n = strlist_get_num(cfg->prewarm_name,
+			(unsigned)(idx-1-2*cfg->num_prewarm_tld));
+		*type = LDNS_RR_TYPE_A;
+	} else	return 0;
+	if(!n)
+		return 0;
+	/* the query points to the name, that is kept over a reload */
+	*name = strdup(n);
+	if(!*name) {
+		log_err("out of memory");
+		return 0;
+	}
+	return 1;
+}
+
+/** the pre-warm is done, note the time it took */
+static void
+prewarm_finish(struct prewarm* pw, struct svr* svr)
+{
+	uint32_t* secs;
+	struct timeval* now;
+	int msec;
+	comm_base_timept(svr->base, &secs, &now);
+	msec = (int)(now->tv_sec - pw->start.tv_sec)*1000 +
+		(int)(now->tv_usec - pw->start.tv_usec)/1000;
+	pw->running = 0;
+	verbose(VERB_OPS, "prewarm took %d msec, %d queries, %d failed",
+		msec, pw->num_queries, pw->num_fail);
+	svr->stats->num_prewarm++;
+	svr->stats->num_prewarm_queries += (unsigned)pw->num_queries;
+	svr->stats->num_prewarm_fail += (unsigned)pw->num_fail;
+	svr->stats->prewarm_msec += (unsigned)msec;
+	svr->stats->last_prewarm_msec = (unsigned)msec;
+	stats_write(svr);
+}
+
+/** send queries until the concurrency is reached, or the list is done */
+static void
+prewarm_send(struct prewarm* pw, struct svr* svr)
+{
+	int max = svr->cfg->prewarm_concurrency, i, type;
+	char* name;
+	if(max < 1)
+		max = 1;
+	if(max > PREWARM_MAX_BUSY)
+		max = PREWARM_MAX_BUSY;
+	while(pw->num_busy < max &&
+		prewarm_get(svr->cfg, pw->next, &name, &type)) {
+		pw->next++;
+		pw->num_queries++;
+		for(i = 0; pw->busy[i]; i++)
+			; /* there is a free slot, num_busy < max */
+		pw->busy[i] = outq_create(PREWARM_IP, type, name, 1, pw->warm,
+			0, 0, DNS_PORT, 1, 0);
+		if(!pw->busy[i]) {
+			free(name);
+			pw->num_fail++;
+			continue;
+		}
+		pw->name[i] = name;
+		pw->num_busy++;
+	}
+	if(pw->num_busy == 0)
+		prewarm_finish(pw, svr);
+}
+
+/** the hooks before the mark are done, unbound has its new upstream */
+static void
+prewarm_mark_done(int ATTR_UNUSED(status), void* arg,
+	char* ATTR_UNUSED(data))
+{
+	struct svr* svr = (struct svr*)arg;
+	struct prewarm* pw = svr->prewarm;
+	uint32_t* secs;
+	struct timeval* now;
+	pw->num_marks--;
+	/* wait for the last mark, after the last change to unbound */
+	if(pw->num_marks > 0 || !pw->wanted)
+		return;
+	pw->wanted = 0;
+	prewarm_clear(pw);
+	comm_base_timept(svr->base, &secs, &now);
+	pw->start = *now;
+	pw->next = 0;
+	pw->num_queries = 0;
+	pw->num_fail = 0;
+	pw->running = 1;
+	verbose(VERB_ALGO, "prewarm the unbound cache");
+	prewarm_send(pw, svr);
+}
+
+void prewarm_queue(struct prewarm* pw, struct svr* svr)
+{
+	if(!svr->cfg->prewarm)
+		return;
+	pw->wanted = 1;
+	pw->num_marks++;
+	cmdq_add_mark(svr->cmdq, &prewarm_mark_done, svr);
+}
+
+void prewarm_outq_done(struct prewarm* pw, struct outq* outq,
+	const char* reason)
+{
+	int i;
+	for(i = 0; i < PREWARM_MAX_BUSY; i++) {
+		if(pw->busy[i] == outq)
+			break;
+	}
+	if(i == PREWARM_MAX_BUSY) {
+		outq_delete(outq);
+		return;
+	}
+	if(reason) {
+		char* t = ldns_rr_type2str(outq->qtype);
+		verbose(VERB_ALGO, "prewarm %s %s failed: %s", pw->name[i],
+			t?t:"", reason);
+		free(t);
+		pw->num_fail++;
+	}
+	outq_delete(outq);
+	pw->busy[i] = NULL;
+	free(pw->name[i]);
+	pw->name[i] = NULL;
+	pw->num_busy--;
+	prewarm_send(pw, global_svr);
+}
@@ -0,0 +1,117 @@
+/*
+ * prewarm.h - dnssec-trigger pre-warm of the unbound cache
+ *
+ * Copyright (c) 2011, NLnet Labs. All rights reserved.
+ *
+ * This software is open source.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the NLNET LABS nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file
+ *
+ * This file contains the pre-warm of the unbound cache.  After unbound is
+ * set up for a new upstream, the root DNSKEY, the DNSKEY and DS of a list
+ * of TLDs and a list of hot names are looked up through 127.0.0.1, so the
+ * first lookups of the user do not wait for the chain of trust.
+ */
+
+#ifndef PREWARM_H
+#define PREWARM_H
+struct svr;
+struct probe_ip;
+struct outq;
+
+/** max number of pre-warm queries that are sent at the same time */
+#define PREWARM_MAX_BUSY 32
+
+/**
+ * Pre-warm of the unbound cache.
+ */
+struct prewarm {
+	/** the queries point to this probe, it is not in the probe list */
+	struct probe_ip* warm;
+	/** the queries that are in progress, or NULL */
+	struct outq* busy[PREWARM_MAX_BUSY];
+	/** the names of the queries in progress, malloced */
+	char* name[PREWARM_MAX_BUSY];
+	/** number of queries in progress */
+	int num_busy;
+	/** the next query to send, index in the list of queries */
+	int next;
+	/** number of marks in the command queue, it starts when they are
+	 * done, after the hooks that change unbound */
+	int num_marks;
+	/** if a pre-warm is wanted when the marks are done */
+	int wanted;
+	/** if a pre-warm is in progress */
+	int running;
+	/** number of queries and failures in this pre-warm */
+	int num_queries, num_fail;
+	/** when the pre-warm started */
+	struct timeval start;
+};
+
+/**
+ * Create the pre-warm.
+ * @return new structure or NULL on alloc failure.
+ */
+struct prewarm* prewarm_create(void);
+
+/**
+ * Delete the pre-warm, the queries in progress are stopped.
+ * @param pw: the structure to delete.
+ */
+void prewarm_delete(struct prewarm* pw);
+
+/**
+ * Unbound is set up for a new upstream, pre-warm its cache when the
+ * hooks that are queued are done.  Nothing if the pre-warm is not
+ * configured.
+ * @param pw: the pre-warm.
+ * @param svr: the server with the command queue and the config.
+ */
+void prewarm_queue(struct prewarm* pw, struct svr* svr);
+
+/**
+ * Stop the pre-warm, a new probe starts.
+ * @param pw: the pre-warm.
+ */
+void prewarm_stop(struct prewarm* pw);
+
+/**
+ * A query of the pre-warm is done.
+ * @param pw: the pre-warm, the query is deleted.
+ * @param outq: the query.
+ * @param reason: NULL on success, or the failure.
+ */
+void prewarm_outq_done(struct prewarm* pw, struct outq* outq,
+	const char* reason);
+
+#endif /* PREWARM_H */
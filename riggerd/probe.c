@@ -49,8 +49,22 @@
 #include "reshook.h"
 #include "http.h"
 #include "update.h"
+#include "wirescan.h"
+#include "rtt.h"
+#include "netstate.h"
+#include "health.h"
+#include "timeline.h"
+#include "stats.h"
+#include "prewarm.h"
+#include "ednsize.h"
+#include "mini_event.h"
 #include <ldns/ldns.h>
 
+/** probe stages, in order of preference */
+#define PROBE_STAGE_CACHE 0
+#define PROBE_STAGE_AUTH 1
+#define PROBE_STAGE_TCP 2
+
 /* create probes for the ip addresses in the string */
 static void probe_spawn(const char* ip, int recurse, int dnstcp,
 	struct ssllist* ssldns, int port);
@@ -58,16 +72,68 @@ static void probe_spawn(const char* ip, int recurse, int dnstcp,
 static int outq_settimeout_and_send(struct outq* outq);
 /* send outq over tcp */
 static int outq_send_tcp(struct outq* outq);
+/** remove query from its TCP connection */
+static void probe_conn_remove(struct outq* outq);
 /* a query is done, check probe to see if failed, succeed or wait */
 static void probe_partial_done(struct probe_ip* p, const char* in,
 	const char* reason);
 /* a probe is done (fail or success) see global progress */
 static void probe_done(struct probe_ip* p);
+/* start the probes for tcp and ssl resolvers */
+static int probe_spawn_tcp_stage(struct svr* svr);
+/* start the next probe stage before the current one is done */
+static void probe_stage_next(struct svr* svr);
+/* set the timer for the next probe stage */
+static void probe_stage_timer_set(struct svr* svr);
+
+/** use the stored result of a known network, the probes confirm it */
+static void
+probe_use_netstate(struct svr* svr, struct netstate* ns)
+{
+	if(ns->state == res_cache && !ns->servers[0]) {
+		/* no server to forward to, the full probe decides */
+		verbose(VERB_ALGO, "known network has no cache servers "
+			"stored, probe it");
+		return;
+	}
+	verbose(VERB_OPS, "known network, use the last result while "
+		"probing");
+	if(svr->insecure_state) hook_resolv_flush(svr->cfg);
+	svr->insecure_state = 0;
+	switch(ns->state) {
+		case res_cache:
+			hook_unbound_cache(svr->cfg, ns->servers);
+			break;
+		case res_auth:
+			hook_unbound_auth(svr->cfg);
+			break;
+		case res_tcp:
+			hook_unbound_tcp_upstream(svr->cfg,
+				(ns->tcp&NETSTATE_TCP80_IP4)!=0,
+				(ns->tcp&NETSTATE_TCP80_IP6)!=0,
+				(ns->tcp&NETSTATE_TCP443_IP4)!=0,
+				(ns->tcp&NETSTATE_TCP443_IP6)!=0, NULL);
+			break;
+		case res_ssl:
+			hook_unbound_ssl_upstream(svr->cfg,
+				(ns->tcp&NETSTATE_SSL443_IP4)!=0,
+				(ns->tcp&NETSTATE_SSL443_IP6)!=0, NULL);
+			break;
+		default:
+			return;
+	}
+	svr->res_state = ns->state;
+	/* set resolv.conf to 127.0.0.1 */
+	hook_resolv_localhost(svr->cfg);
+}
 
 void probe_start(char* ips)
 {
-	char* next;
+	char* next, *fp;
 	struct svr* svr = global_svr;
+	struct netstate* known = NULL;
+	uint32_t* secs;
+	struct timeval* tv;
 	if(svr->http) {
 		http_general_delete(svr->http);
 		svr->http = NULL;
@@ -83,6 +149,31 @@ void probe_start(char* ips)
 		svr->num_probes_done = 0;
 		svr->num_probes = 0;
 	}
+	/* the probe checks the upstream now */
+	health_stop(svr->health);
+	prewarm_stop(svr->prewarm);
+	ednsize_stop(svr->ednsize);
+	/* new source ports for the new network */
+	outq_udp_reopen(svr);
+	comm_timer_disable(svr->stage_timer);
+	comm_timer_disable(svr->race_timer);
+	memset(svr->race_started, 0, sizeof(svr->race_started));
+	svr->stage_wait_http = 0;
+	comm_base_timept(svr->base, &secs, &tv);
+	svr->probe_start_tv = *tv;
+	svr->probe_queries = 0;
+	svr->probe_resent = 0;
+	svr->stats->num_rounds++;
+	timeline_start(svr->timeline, tv);
+
+	/* a known network that was not probed just before */
+	fp = netstate_fingerprint(ips);
+	if(fp && fp[0] && (!svr->net_fp || strcmp(fp, svr->net_fp) != 0))
+		known = netstate_find(svr->netstates, fp, time(NULL));
+	free(svr->net_fp);
+	svr->net_fp = fp;
+	if(known && !svr->forced_insecure)
+		probe_use_netstate(svr, known);
 
 	/* spawn a probe for every IP address in the list */
 	svr->saw_first_working = 0;
@@ -116,7 +207,146 @@ void probe_start(char* ips)
 			if(!svr->http) log_err("out of memory");
 			svr->http->saw_http_work = 0;
 		}
+		probe_stage_timer_set(svr);
+	}
+}
+
+/** true if the ip is in the space separated list */
+static int
+iplist_has(const char* list, const char* ip)
+{
+	size_t len = strlen(ip);
+	const char* s = list;
+	while((s = strstr(s, ip)) != NULL) {
+		if((s == list || s[-1] == ' ') && (s[len] == 0 || s[len] == ' '))
+			return 1;
+		s += len;
+	}
+	return 0;
+}
+
+/** find the cache probe for the ip */
+static struct probe_ip*
+probe_find_cache(struct svr* svr, const char* ip)
+{
+	struct probe_ip* p;
+	for(p = svr->probes; p; p = p->next) {
+		if(probe_is_cache(p) && strcmp(p->name, ip) == 0)
+			return p;
+	}
+	return NULL;
+}
+
+/** probe the servers that were added, and drop the servers that were
+ * removed, fp is the fingerprint of the new IPs and it is taken */
+static void
+probe_incremental(struct svr* svr, char* ips, char* fp)
+{
+	struct probe_ip* p, *prev = NULL, *np;
+	char* next;
+	int nump;
+	verbose(VERB_QUERY, "submit: probe the changed servers");
+	/* drop the removed servers, and the ones that failed, those are
+	 * probed again */
+	for(p = svr->probes; p; p = np) {
+		np = p->next;
+		if(probe_is_cache(p) && (!iplist_has(fp, p->name) ||
+			(p->finished && !p->works))) {
+			if(prev) prev->next = p->next;
+			else	svr->probes = p->next;
+			verbose(VERB_ALGO, "stop %s: %s", p->name,
+				p->finished&&!p->works?"failed":"removed");
+			if(p->finished)
+				svr->num_probes_done--;
+			svr->num_probes--;
+			svr->num_probes_to_cache--;
+			probe_delete(p);
+		} else {
+			prev = p;
+		}
+	}
+	/* probe the added servers */
+	nump = svr->num_probes;
+	while(*ips == ' ')
+		ips++;
+	while(ips && *ips) {
+		if((next = strchr(ips, ' ')) != NULL) {
+			*next++ = 0;
+			while(*next == ' ')
+				next++;
+		}
+		if(!probe_find_cache(svr, ips))
+			probe_spawn(ips, 1, 0, 0, DNS_PORT);
+		ips = next;
+	}
+	svr->num_probes_to_cache += svr->num_probes - nump;
+	free(svr->net_fp);
+	svr->net_fp = fp;
+
+	/* the first working cache may have been removed */
+	svr->saw_first_working = 0;
+	for(p = svr->probes; p; p = p->next) {
+		if(probe_is_cache(p) && p->finished && p->works)
+			svr->saw_first_working = 1;
+	}
+	if(svr->num_probes_done < svr->num_probes) {
+		if(!svr->saw_first_working)
+			probe_stage_timer_set(svr);
+		return;
+	}
+	/* nothing to wait for, decide with the kept results */
+	probe_cache_done();
+}
+
+void probe_submit(char* ips)
+{
+	struct svr* svr = global_svr;
+	struct probe_ip* p;
+	char* fp = netstate_fingerprint(ips);
+	int busy = (svr->num_probes_done < svr->num_probes);
+	int recent = (svr->probetime != 0 &&
+		time(NULL) - svr->probetime < PROBE_FRESH_TIME);
+	int kept = 0;
+	if(!fp || !svr->net_fp || !svr->net_fp[0] || svr->forced_insecure) {
+		free(fp);
+		probe_start(ips);
+		return;
+	}
+	if(strcmp(fp, svr->net_fp) == 0) {
+		if(busy) {
+			verbose(VERB_QUERY, "submit: same servers, the "
+				"probe continues");
+			free(fp);
+			return;
+		}
+		if(recent && svr->res_state != res_disconn) {
+			verbose(VERB_QUERY, "submit: same servers, the "
+				"result is recent");
+			free(fp);
+			return;
+		}
 	}
+	/* the link was down, the old results say nothing about it now */
+	if(svr->res_state == res_disconn) {
+		free(fp);
+		probe_start(ips);
+		return;
+	}
+	/* the probe results can be kept if they are recent and from the
+	 * cache stage, and some servers are the same and work */
+	if(!svr->probe_direct && !svr->probe_dnstcp && (busy || recent)) {
+		for(p = svr->probes; p; p = p->next) {
+			if(probe_is_cache(p) && p->works &&
+				iplist_has(fp, p->name))
+				kept++;
+		}
+	}
+	if(!kept) {
+		free(fp);
+		probe_start(ips);
+		return;
+	}
+	probe_incremental(svr, ips, fp);
 }
 
 void probe_delete(struct probe_ip* p)
@@ -125,7 +355,6 @@ void probe_delete(struct probe_ip* p)
 	free(p->name);
 	free(p->reason);
 	free(p->http_desc);
-	SSL_CTX_free(p->sslctx);
 	outq_delete(p->ds_c);
 	outq_delete(p->dnskey_c);
 	outq_delete(p->nsec3_c);
@@ -163,95 +392,260 @@ get_random_nsec3_dest(void)
 /** the NSEC3 qtype to elicit it (a nodata answer) */
 #define PROBE_NSEC3_QTYPE LDNS_RR_TYPE_NULL
 
-/** get random authority server */
-static const char*
-get_random_auth_ip4(void)
-{
-	/* list of root servers */
-	const char* choices[] = {
-		"198.41.0.4", /* a */
-		"192.228.79.201", /* b */
-		"192.33.4.12", /* c */
-		"199.7.91.13", /* d */
-		"192.203.230.10", /* e */
-		"192.5.5.241", /* f */
-		"192.112.36.4", /* g */
-		"128.63.2.53", /* h */
-		"192.36.148.17", /* i */
-		"192.58.128.30", /* j */
-		"193.0.14.129", /* k */
-		"199.7.83.42", /* l */
-		"202.12.27.33" /* m */
-	};
-	return choices[ ldns_get_random() % 13 ];
-}
-
-/** get random authority server */
+/** the score of a root server, its expected latency in msec, with the
+ * timeouts backed off.  Not known is scored as the unknown timeout. */
+static int
+probe_root_score(struct svr* svr, const char* str, time_t now, int* known)
+{
+	struct sockaddr_storage addr;
+	socklen_t len;
+	if(!ipstrtoaddr(str, DNS_PORT, &addr, &len)) {
+		*known = 0;
+		return RTT_MAX_TIMEOUT;
+	}
+	*known = rtt_known(svr->rtts, &addr, len, now);
+	return rtt_timeout(svr->rtts, &addr, len, now);
+}
+
+/** pick a root server from the list, the fastest, ties broken at random,
+ * and sometimes a random one to measure it.  Returns NULL if the list is
+ * empty.  In best is the score of the fastest that is known, or
+ * RTT_UNKNOWN_TIMEOUT if none are known. */
 static const char*
-get_random_auth_ip6(void)
-{
-	/* list of root servers */
-	const char* choices[] = {
-		"2001:503:ba3e::2:30", /* a */
-		"2001:500:2::c", /* c */
-		"2001:500:2d::d", /* d */
-		"2001:500:2f::f", /* f */
-		"2001:500:1::803f:235", /* h */
-		"2001:7fe::53", /* i */
-		"2001:503:c27::2:30", /* j */
-		"2001:7fd::1", /* k */
-		"2001:500:3::42", /* l */
-		"2001:dc3::35" /* m */
-	};
-	return choices[ ldns_get_random() % 10 ];
-}
-
-static const char* get_random_tcp80_ip4(struct cfg* cfg)
-{
-	if(cfg->num_tcp80_ip4 == 0)
-		return NULL;
-	return strlist_get_num(cfg->tcp80_ip4,
-		((unsigned)ldns_get_random())%((unsigned)cfg->num_tcp80_ip4));
+probe_root_pick(struct svr* svr, struct strlist* list, int num, int* best)
+{
+	struct strlist* e, *pick = NULL;
+	time_t now = time(NULL);
+	int score, known, pickscore = 0, ties = 0, haveknown = 0;
+	*best = RTT_UNKNOWN_TIMEOUT;
+	for(e = list; e; e = e->next) {
+		score = probe_root_score(svr, e->str, now, &known);
+		if(known && (!haveknown || score < *best)) {
+			*best = score;
+			haveknown = 1;
+		}
+		if(!pick || score < pickscore) {
+			pick = e;
+			pickscore = score;
+			ties = 1;
+		} else if(score == pickscore && ldns_get_random()%(++ties) == 0) {
+			/* every one of the ties has the same chance */
+			pick = e;
+		}
+	}
+	if(num > 0 && ldns_get_random()%100 < PROBE_ROOT_EXPLORE) {
+		char* s = strlist_get_num(list,
+			(unsigned)(ldns_get_random()%num));
+		if(s) return s;
+	}
+	return pick?pick->str:NULL;
 }
 
-static const char* get_random_tcp80_ip6(struct cfg* cfg)
+/** number of race groups, tcp80, tcp443 and ssl443 on ip4 and ip6 */
+#define PROBE_RACE_GROUPS 6
+
+/** get the configured resolvers of a race group, and their number */
+static struct strlist*
+probe_race_list(struct cfg* cfg, int g, int* num)
 {
-	if(cfg->num_tcp80_ip6 == 0)
-		return NULL;
-	return strlist_get_num(cfg->tcp80_ip6,
-		((unsigned)ldns_get_random())%((unsigned)cfg->num_tcp80_ip6));
+	switch(g) {
+	case 0: *num = cfg->num_tcp80_ip4; return cfg->tcp80_ip4;
+	case 1: *num = cfg->num_tcp80_ip6; return cfg->tcp80_ip6;
+	case 2: *num = cfg->num_tcp443_ip4; return cfg->tcp443_ip4;
+	case 3: *num = cfg->num_tcp443_ip6; return cfg->tcp443_ip6;
+	/* the ssllist starts like a strlist */
+	case 4: *num = cfg->num_ssl443_ip4;
+		return (struct strlist*)cfg->ssl443_ip4;
+	case 5: *num = cfg->num_ssl443_ip6;
+		return (struct strlist*)cfg->ssl443_ip6;
+	default: break;
+	}
+	*num = 0;
+	return NULL;
 }
 
-static const char* get_random_tcp443_ip4(struct cfg* cfg)
+/** port number of the race group */
+static int
+probe_race_port(int g)
 {
-	if(cfg->num_tcp443_ip4 == 0)
-		return NULL;
-	return strlist_get_num(cfg->tcp443_ip4,
-		((unsigned)ldns_get_random())%((unsigned)cfg->num_tcp443_ip4));
+	return (g == 0 || g == 1)?80:443;
 }
 
-static const char* get_random_tcp443_ip6(struct cfg* cfg)
+/** race group of the probe, or -1 if not a tcp80, tcp443, ssl443 probe */
+static int
+probe_race_group(struct probe_ip* p)
 {
-	if(cfg->num_tcp443_ip6 == 0)
-		return NULL;
-	return strlist_get_num(cfg->tcp443_ip6,
-		((unsigned)ldns_get_random())%((unsigned)cfg->num_tcp443_ip6));
+	int ip6;
+	if(!p->dnstcp || p->to_http)
+		return -1;
+	ip6 = (strchr(p->name, ':') != NULL);
+	if(p->ssldns)
+		return 4 + ip6;
+	return (p->port == 80?0:2) + ip6;
 }
 
-static struct ssllist* get_random_ssl443_ip4(struct cfg* cfg)
+/** find the probe of a resolver in the race group */
+static struct probe_ip*
+probe_race_find(struct svr* svr, int g, const char* name)
 {
-	if(cfg->num_ssl443_ip4 == 0)
-		return NULL;
-	return ssllist_get_num(cfg->ssl443_ip4,
-		((unsigned)ldns_get_random())%((unsigned)cfg->num_ssl443_ip4));
+	struct probe_ip* p;
+	for(p = svr->probes; p; p = p->next) {
+		if(probe_race_group(p) == g && strcmp(p->name, name) == 0)
+			return p;
+	}
+	return NULL;
 }
 
-static struct ssllist* get_random_ssl443_ip6(struct cfg* cfg)
+/** see if a resolver in the race group works */
+static int
+probe_race_won(struct svr* svr, int g)
 {
-	if(cfg->num_ssl443_ip6 == 0)
-		return NULL;
-	return ssllist_get_num(cfg->ssl443_ip6,
-		((unsigned)ldns_get_random())%((unsigned)cfg->num_ssl443_ip6));
+	struct probe_ip* p;
+	for(p = svr->probes; p; p = p->next) {
+		if(p->works && probe_race_group(p) == g)
+			return 1;
+	}
+	return 0;
+}
+
+/** see if the race group can start another resolver */
+static int
+probe_race_more(struct svr* svr, int g)
+{
+	int num, max = svr->cfg->tcp_race;
+	(void)probe_race_list(svr->cfg, g, &num);
+	if(svr->saw_first_working || svr->saw_direct_work ||
+		!svr->probe_dnstcp)
+		return 0; /* the tcp stage is not used */
+	if(svr->race_started[g] >= num ||
+		(max > 0 && svr->race_started[g] >= max))
+		return 0;
+	return !probe_race_won(svr, g);
+}
+
+/** start the next resolver of the race group, false if there is none */
+static int
+probe_race_spawn(struct svr* svr, int g)
+{
+	int num, i;
+	struct strlist* list = probe_race_list(svr->cfg, g, &num);
+	struct strlist* e;
+	if(!probe_race_more(svr, g))
+		return 0;
+	/* walk the list from the random start position */
+	i = (int)((svr->race_start + (unsigned)svr->race_started[g]) %
+		(unsigned)num);
+	for(e = list; e && i > 0; e = e->next)
+		i--;
+	svr->race_started[g]++;
+	if(!e)
+		return 0;
+	if(g >= 4)
+		probe_spawn(e->str, 1, 1, (struct ssllist*)e, 443);
+	else	probe_spawn(e->str, 1, 1, 0, probe_race_port(g));
+	return 1;
+}
+
+/** set the timer for the next staggered start, if one is needed */
+static void
+probe_race_timer_set(struct svr* svr)
+{
+	struct timeval tv;
+	int g;
+	for(g = 0; g < PROBE_RACE_GROUPS; g++) {
+		if(svr->race_started[g] > 0 && probe_race_more(svr, g))
+			break;
+	}
+	if(g == PROBE_RACE_GROUPS)
+		return;
+	tv.tv_sec = PROBE_RACE_STAGGER/1000;
+	tv.tv_usec = (PROBE_RACE_STAGGER%1000)*1000;
+	comm_timer_set(svr->race_timer, &tv);
+}
+
+void probe_race_timeout(void* arg)
+{
+	struct svr* svr = (struct svr*)arg;
+	int g;
+	/* the groups that take part, start their next resolver */
+	for(g = 0; g < PROBE_RACE_GROUPS; g++) {
+		if(svr->race_started[g] > 0)
+			(void)probe_race_spawn(svr, g);
+	}
+	probe_race_timer_set(svr);
+}
+
+/** a resolver in the race group works, stop the others in the group */
+static void
+probe_race_stop(struct svr* svr, struct probe_ip* winner)
+{
+	struct probe_ip* p, *prev = NULL, *np;
+	int g = probe_race_group(winner);
+	for(p = svr->probes; p; p = np) {
+		np = p->next;
+		if(!p->finished && p != winner && probe_race_group(p) == g) {
+			if(prev) prev->next = p->next;
+			else	svr->probes = p->next;
+			verbose(VERB_ALGO, "stop %s: %s was faster", p->name,
+				winner->name);
+			probe_delete(p);
+			svr->num_probes--;
+		} else {
+			prev = p;
+		}
+	}
+}
+
+/** append server to the forward list */
+static void
+probe_race_append(char* buf, char** now, size_t* left, const char* str,
+	int port)
+{
+	size_t len;
+	if(*left < strlen(str)+8)
+		return; /* no more space */
+	snprintf(*now, *left, "%s%s@%d", *now == buf?"":" ", str, port);
+	len = strlen(*now);
+	(*left) -= len;
+	(*now) += len;
+}
+
+/** append the resolvers of the race group to the forward list, the ones
+ * that worked, fastest first, then the ones that were not tried.  The
+ * ones that failed are left out. */
+static void
+probe_race_forwards(struct svr* svr, int g, char* buf, char** now,
+	size_t* left)
+{
+	int num, n = 0, i;
+	struct strlist* list = probe_race_list(svr->cfg, g, &num), *e;
+	struct probe_ip** fast;
+	struct probe_ip* p;
+	if(num == 0)
+		return;
+	fast = (struct probe_ip**)calloc((size_t)num, sizeof(*fast));
+	if(!fast) {
+		log_err("out of memory");
+		return;
+	}
+	for(e = list; e && n < num; e = e->next) {
+		if(!(p = probe_race_find(svr, g, e->str)) || !p->works)
+			continue;
+		/* insertion sort on latency */
+		for(i = n; i > 0 && fast[i-1]->msec > p->msec; i--)
+			fast[i] = fast[i-1];
+		fast[i] = p;
+		n++;
+	}
+	for(i = 0; i < n; i++)
+		probe_race_append(buf, now, left, fast[i]->name,
+			probe_race_port(g));
+	for(e = list; e; e = e->next) {
+		if(!(p = probe_race_find(svr, g, e->str)) || !p->finished)
+			probe_race_append(buf, now, left, e->str,
+				probe_race_port(g));
+	}
+	free(fast);
 }
 
 int probe_is_cache(struct probe_ip* p)
@@ -316,13 +710,26 @@ check_ssl(struct outq* outq)
 	 * verification, we simply check the entire self-signed cert with
 	 * a stored hash, you can compute this hash with the command
 	 * openssl x509 -sha256 -fingerprint -in server.pem */
-	X509* x = SSL_get_peer_certificate(outq->c->ssl);
-	if(!outq->probe->ssldns->hashes) {
+	struct ssllist* e = outq->probe->ssldns;
+	X509* x = NULL;
+	if(outq->conn && outq->conn->c->ssl)
+		x = SSL_get_peer_certificate(outq->conn->c->ssl);
+	if(!e->hashes) {
 		/* no stored hash */
 		X509_free(x);
 	} else if(x) {
-		char* reason = match_hashes(outq->probe->ssldns->hashes, x);
-		X509_free(x);
+		char* reason;
+		/* a resumed session has the same certificate, the result
+		 * of the hash check is cached for it */
+		if(e->cert && X509_cmp(e->cert, x) == 0) {
+			X509_free(x);
+			return e->cert_reason;
+		}
+		reason = match_hashes(e->hashes, x);
+		if(e->cert)
+			X509_free(e->cert);
+		e->cert = x;
+		e->cert_reason = reason;
 		if(reason) 
 			return reason;
 		
@@ -333,19 +740,80 @@ check_ssl(struct outq* outq)
 	return NULL;
 }
 
+/** note the time of an event of the query, the first time only */
+static void
+outq_stamp(struct timeval* t)
+{
+	uint32_t* secs;
+	struct timeval* now;
+	if(t->tv_sec != 0 || t->tv_usec != 0)
+		return;
+	comm_base_timept(global_svr->base, &secs, &now);
+	*t = *now;
+}
+
+/** add the query to the timeline of the probe round */
+static void
+outq_timeline(struct outq* outq, const char* reason)
+{
+	struct timeline* tl = global_svr->timeline;
+	struct outq_times* t = &outq->times;
+	char* tp = ldns_rr_type2str(outq->qtype);
+	if(outq->conn) {
+		t->connected = outq->conn->c->tcp_connect_time;
+		t->handshake = outq->conn->c->ssl_shake_time;
+	}
+	timeline_add(tl, "query %s %s %s created=%d sent=%d sends=%d "
+		"resent=%d tc=%d connect=%d handshake=%d done=%d %s%s",
+		outq->probe->name, tp?tp:"?",
+		outq->on_ssl?"ssl":(outq->on_tcp?"tcp":"udp"),
+		timeline_msec(tl, &t->created), timeline_msec(tl, &t->sent),
+		t->sends, timeline_msec(tl, &t->resent),
+		timeline_msec(tl, &t->tc), timeline_msec(tl, &t->connected),
+		timeline_msec(tl, &t->handshake),
+		timeline_msec(tl, &t->done), reason?"error: ":"ok",
+		reason?reason:"");
+	free(tp);
+}
+
+/** see if the query is for a probe, and not a health check, pre-warm or
+ * EDNS size check */
+static int
+outq_is_probe(struct probe_ip* p)
+{
+	return p && p != global_svr->health->check &&
+		p != global_svr->prewarm->warm &&
+		p != global_svr->ednsize->check;
+}
+
 /** outq is done, NULL reason for success */
 static void
 outq_done(struct outq* outq, const char* reason)
 {
 	struct probe_ip* p = outq->probe;
 	const char* in = NULL;
+	outq_stamp(&outq->times.done);
+	if(outq_is_probe(p))
+		outq_timeline(outq, reason);
 	if(!p) {
 		selfupdate_outq_done(global_svr->update, outq, NULL, reason);
 		return;
 	}
+	if(p == global_svr->prewarm->warm) {
+		prewarm_outq_done(global_svr->prewarm, outq, reason);
+		return;
+	}
+	if(p == global_svr->ednsize->check) {
+		ednsize_outq_done(global_svr->ednsize, reason);
+		return;
+	}
 	if(p->sslctx && !reason) {
 		reason = check_ssl(outq);
 	}
+	if(p == global_svr->health->check) {
+		health_outq_done(global_svr->health, reason);
+		return;
+	}
 	if(p->nsec3_c == outq) {
 		outq_delete(p->nsec3_c);
 		p->nsec3_c = NULL;
@@ -369,67 +837,13 @@ outq_done(struct outq* outq, const char* reason)
 	probe_partial_done(p, in, reason);
 }
 
-/** test if type is present in authority section of returned packet */
-static int
-check_type_in_authority(ldns_pkt* p, int t)
-{
-	ldns_rr_list *l = ldns_pkt_rr_list_by_type(p, t,
-		LDNS_SECTION_AUTHORITY);
-	if(!l) {
-		return 0;
-	}
-	ldns_rr_list_deep_free(l);
-	return 1;
-}
-
-/** test if type is present in returned packet */
-static int
-check_type_in_answer(ldns_pkt* p, int t)
-{
-	ldns_rr_list *l = ldns_pkt_rr_list_by_type(p, t, LDNS_SECTION_ANSWER);
-	if(!l) {
-		return 0;
-	}
-	ldns_rr_list_deep_free(l);
-	return 1;
-}
-
-/** test if the right denial (from parent) is in the returned packet */
-static int
-check_denial_in_answer(ldns_pkt* p, const char* dname)
-{
-	size_t i;
-	ldns_rdf* d = ldns_dname_new_frm_str(dname);
-	ldns_rr_list *l = ldns_pkt_rr_list_by_type(p, LDNS_RR_TYPE_SOA,
-		LDNS_SECTION_AUTHORITY);
-	if(!d) {
-		ldns_rr_list_deep_free(l);
-		return 0; /* robustness, the name should parse */
-	}
-	if(!l) {
-		ldns_rdf_deep_free(d);
-		return 0;
-	}
-	for(i=0; i<ldns_rr_list_rr_count(l); i++) {
-		/* note that subdomain test is false if names are equal,
-		 * the SOA must be from a parent server */
-		if(ldns_dname_is_subdomain(d, ldns_rr_owner(ldns_rr_list_rr(
-			l, i)))) {
-			ldns_rr_list_deep_free(l);
-			ldns_rdf_deep_free(d);
-			return 1;
-		}
-	}
-	ldns_rr_list_deep_free(l);
-	ldns_rdf_deep_free(d);
-	return 0;
-}
-
 static void
 outq_check_packet(struct outq* outq, uint8_t* wire, size_t len)
 {
 	char reason[512];
 	int rrsig_in_auth = 0;
+	struct wirescan ws;
+	const char* r;
 	ldns_pkt *p = NULL;
 	ldns_status s;
 	if(verbosity >= VERB_ALGO) {
@@ -461,8 +875,16 @@ outq_check_packet(struct outq* outq, uint8_t* wire, size_t len)
 		outq_done(outq, "reply without QR flag");
 		return;
 	}
+	if(outq->probe && outq->probe == global_svr->ednsize->check) {
+		/* a truncated or short reply moves on to the next size */
+		outq_done(outq, ednsize_check_reply(global_svr->ednsize,
+			wire, len));
+		return;
+	}
 	if(LDNS_TC_WIRE(wire)) {
 		/* start TCP query and wait for it */
+		outq_stamp(&outq->times.tc);
+		global_svr->stats->num_tc++;
 		verbose(VERB_ALGO, "%s: TC flag, switching to TCP",
 			outq->probe?outq->probe->name:outq->qname);
 		if(!outq_send_tcp(outq)) {
@@ -470,101 +892,104 @@ outq_check_packet(struct outq* outq, uint8_t* wire, size_t len)
 		}
 		return;
 	}
-	if( (s=ldns_wire2pkt(&p, wire, len)) != LDNS_STATUS_OK) {
+	if( (r=wirescan_scan(&ws, wire, len)) != NULL) {
 		snprintf(reason, sizeof(reason), "cannot disassemble reply: %s",
-			ldns_get_errorstr_by_id(s));
+			r);
 		outq_done(outq, reason);
 		return;
 	}
-	if(!p) {
-		outq_done(outq, "out of memory");
-		return;
-	}
 	if(verbosity >= VERB_ALGO) {
-		char* desc = ldns_pkt2str(p);
-		if(desc) verbose(VERB_ALGO, "%s", desc);
-		free(desc);
+		if(ldns_wire2pkt(&p, wire, len) == LDNS_STATUS_OK && p) {
+			char* desc = ldns_pkt2str(p);
+			if(desc) verbose(VERB_ALGO, "%s", desc);
+			free(desc);
+		}
+		ldns_pkt_free(p);
+		p = NULL;
 	}
 
 	/* does DNS work? */
-	if(ldns_pkt_get_rcode(p) != LDNS_RCODE_NOERROR) {
-		char* r = ldns_pkt_rcode2str(ldns_pkt_get_rcode(p));
+	if(LDNS_RCODE_WIRE(wire) != LDNS_RCODE_NOERROR) {
+		char* rc = ldns_pkt_rcode2str(
+			(ldns_pkt_rcode)LDNS_RCODE_WIRE(wire));
 		snprintf(reason, sizeof(reason), "no answer, %s",
-			r?r:"(out of memory)");
+			rc?rc:"(out of memory)");
 		outq_done(outq, reason);
-		LDNS_FREE(r);
-		ldns_pkt_free(p);
+		LDNS_FREE(rc);
 		return;
 	}
-	if(!outq->probe) {
-		selfupdate_outq_done(global_svr->update, outq, p, NULL);
+	if(outq->probe == global_svr->prewarm->warm) {
+		/* the answer is in the cache of unbound now */
+		outq_done(outq, NULL);
 		return;
 	}
-	/* if this all OK, and addr, then use http addr process */
-	if(outq == outq->probe->host_c) {
+	if(!outq->probe || outq == outq->probe->host_c) {
+		/* the selfupdate and http lookups use the parsed packet */
+		if( (s=ldns_wire2pkt(&p, wire, len)) != LDNS_STATUS_OK) {
+			snprintf(reason, sizeof(reason), "cannot "
+				"disassemble reply: %s",
+				ldns_get_errorstr_by_id(s));
+			outq_done(outq, reason);
+			return;
+		}
+		if(!p) {
+			outq_done(outq, "out of memory");
+			return;
+		}
+		if(!outq->probe) {
+			selfupdate_outq_done(global_svr->update, outq, p,
+				NULL);
+			return;
+		}
+		/* if this all OK, and addr, then use http addr process */
 		/* this routine frees pkt */
 		http_host_outq_result(outq->probe, p);
 		return;
 	}
 
 	/* test EDNS0 presence, of OPT record */
-	/* LDNS forgets during pkt parse, but we test the ARCOUNT;
- 	 * 0 additionals means no EDNS(on the wire), and after parsing the
- 	 * same additional RRs as before means no EDNS OPT */
-	if(LDNS_ARCOUNT(wire) == 0 ||
-		ldns_pkt_arcount(p) == LDNS_ARCOUNT(wire)) {
+	if(!ws.have_opt) {
 		outq_done(outq, "no EDNS");
-		ldns_pkt_free(p);
 		return;
 	}
 
 	/* test if the type, RRSIG present */
 	if(outq->qtype == PROBE_NSEC3_QTYPE) {
-		if(!check_type_in_authority(p, LDNS_RR_TYPE_NSEC3)) {
+		if(!wirescan_has_type(&ws, LDNS_SECTION_AUTHORITY,
+			LDNS_RR_TYPE_NSEC3)) {
 			outq_done(outq, "no NSEC3 in nodata reply");
-			ldns_pkt_free(p);
 			return;
 		}
 		rrsig_in_auth = 1;
-	} else if(!check_type_in_answer(p, (int)outq->qtype)) {
+	} else if(!wirescan_has_type(&ws, LDNS_SECTION_ANSWER, outq->qtype)) {
 		if(outq->qtype == LDNS_RR_TYPE_DS) {
 			/* if type DS, and it is not present, it is OK if
 			 * we get a proper denial from the parent with NSEC */
-			if(!check_denial_in_answer(p, outq->qname)) {
+			if(!wirescan_soa_from_parent(&ws, outq->qname)) {
 				outq_done(outq, "no DS and no proper "
 					"denial in reply");
-				ldns_pkt_free(p);
 				return;
 			}
-			if(!check_type_in_authority(p, LDNS_RR_TYPE_NSEC)) {
+			if(!wirescan_has_type(&ws, LDNS_SECTION_AUTHORITY,
+				LDNS_RR_TYPE_NSEC)) {
 				outq_done(outq, "no NSEC in denial reply");
-				ldns_pkt_free(p);
 				return;
 			}
 			rrsig_in_auth = 1;
 		} else {
 			/* failed to find type */
-			char* r = ldns_rr_type2str(outq->qtype);
+			char* rt = ldns_rr_type2str(outq->qtype);
 			snprintf(reason, sizeof(reason),
-				"no %s in reply", r?r:"DNSSEC-RRTYPE");
+				"no %s in reply", rt?rt:"DNSSEC-RRTYPE");
 			outq_done(outq, reason);
-			LDNS_FREE(r);
-			ldns_pkt_free(p);
+			LDNS_FREE(rt);
 			return;
 		}
 	}
-	if(rrsig_in_auth) {
-		if(!check_type_in_authority(p, LDNS_RR_TYPE_RRSIG)) {
-			outq_done(outq, "no RRSIGs in reply");
-			ldns_pkt_free(p);
-			return;
-		}
-	} else {
-		if(!check_type_in_answer(p, LDNS_RR_TYPE_RRSIG)) {
-			outq_done(outq, "no RRSIGs in reply");
-			ldns_pkt_free(p);
-			return;
-		}
+	if(!wirescan_has_type(&ws, rrsig_in_auth?LDNS_SECTION_AUTHORITY:
+		LDNS_SECTION_ANSWER, LDNS_RR_TYPE_RRSIG)) {
+		outq_done(outq, "no RRSIGs in reply");
+		return;
 	}
 
 	/* for authoritative probes we try to detect transparent proxies
@@ -573,68 +998,189 @@ outq_check_packet(struct outq* outq, uint8_t* wire, size_t len)
 	if(!outq->recurse) {
 		if(LDNS_RA_WIRE(wire)) {
 			outq_done(outq, "authority response has RA flag");
-			ldns_pkt_free(p);
 			return;
 		}
 		if(!LDNS_AA_WIRE(wire)) {
 			outq_done(outq, "authority response misses AA flag");
-			ldns_pkt_free(p);
 			return;
 		}
 	}
 
-	outq_done(outq, NULL);
-	ldns_pkt_free(p);
+	outq_done(outq, NULL);
+}
+
+/** measure the round trip time of the UDP query, for the server rtt */
+static void
+outq_rtt_sample(struct outq* outq)
+{
+	uint32_t* secs;
+	struct timeval* now;
+	int ms;
+	comm_base_timept(global_svr->base, &secs, &now);
+	ms = (int)(now->tv_sec - outq->sendtime.tv_sec)*1000 +
+		(int)(now->tv_usec - outq->sendtime.tv_usec)/1000;
+	rtt_update(global_svr->rtts, &outq->addr, outq->addrlen, ms,
+		time(NULL));
+	stats_hist_add(&global_svr->stats->rtt, ms);
+}
+
+int outq_handle_udp(struct comm_point* c, void* ATTR_UNUSED(my_arg),
+	int error, struct comm_reply *reply_info)
+{
+	struct outq key, *outq;
+	rbnode_t* n;
+	uint8_t* wire = ldns_buffer_begin(c->buffer);
+	size_t len = ldns_buffer_limit(c->buffer);
+	if(error != NETEVENT_NOERROR) {
+		verbose(VERB_ALGO, "udp receive error");
+		return 0;
+	}
+	/* quick sanity check */
+	if(len < LDNS_HEADER_SIZE || !LDNS_QR_WIRE(wire)) {
+		verbose(VERB_ALGO, "ignored bad reply (tooshort or noQR)");
+		return 0;
+	}
+	/* find the query by qid and source address */
+	memset(&key, 0, sizeof(key));
+	key.qid = LDNS_ID_WIRE(wire);
+	memmove(&key.addr, &reply_info->addr, reply_info->addrlen);
+	key.addrlen = reply_info->addrlen;
+	n = rbtree_search(global_svr->outqs, &key);
+	if(!n) {
+		/* wrong qid or from wrong source, wait for the real reply */
+		verbose(VERB_ALGO, "%4.4x wire, no outstanding query",
+			LDNS_ID_WIRE(wire));
+		log_addr(VERB_ALGO, "ignored reply from",
+			&reply_info->addr, reply_info->addrlen);
+		return 0;
+	}
+	outq = (struct outq*)n->key;
+	comm_timer_disable(outq->timer);
+	/* the pre-warm measures unbound, not the network */
+	if(!outq->resent && outq->probe != global_svr->prewarm->warm)
+		outq_rtt_sample(outq);
+	outq_check_packet(outq, wire, len);
+	return 0;
+}
+
+int outq_cmp(const void* a, const void* b)
+{
+	struct outq* x = (struct outq*)a;
+	struct outq* y = (struct outq*)b;
+	if(x->qid != y->qid)
+		return (x->qid < y->qid)?-1:1;
+	return sockaddr_cmp(&x->addr, x->addrlen, &y->addr, y->addrlen);
+}
+
+/** get the shared UDP commpoint for ip4 or ip6, it is opened if needed */
+static struct comm_point*
+outq_get_udp(int ip6)
+{
+	struct comm_point** cp = ip6?&global_svr->udp6:&global_svr->udp4;
+	int fd;
+	if(*cp)
+		return *cp;
+	fd = socket(ip6?PF_INET6:PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if(fd == -1) {
+#ifndef USE_WINSOCK
+		if(errno == EAFNOSUPPORT || errno == EPROTONOSUPPORT) {
+			if(verbosity <= 2) {
+				return NULL;
+			}
+		}
+#else
+		if(WSAGetLastError() == WSAEAFNOSUPPORT ||
+			WSAGetLastError() == WSAEPROTONOSUPPORT) {
+			if(verbosity <= 2) {
+				return NULL;
+			}
+		}
+#endif
+		log_err("socket %s udp: %s", ip6?"ip6":"ip4",
+			strerror(errno));
+		return NULL;
+	}
+	*cp = comm_point_create_udp(global_svr->base, fd,
+		global_svr->udp_buffer, &outq_handle_udp, NULL);
+	if(!*cp) {
+		log_err("out of memory");
+#ifndef USE_WINSOCK
+		close(fd);
+#else
+		closesocket(fd);
+#endif
+		return NULL;
+	}
+	return *cp;
+}
+
+/** add outq to the tree of outstanding UDP queries, with a free qid */
+static void
+outq_udp_insert(struct outq* outq)
+{
+	outq->node.key = outq;
+	while(!rbtree_insert(global_svr->outqs, &outq->node))
+		outq->qid = (uint16_t)ldns_get_random();
+}
+
+/** remove outq from the tree of outstanding UDP queries */
+static void
+outq_udp_remove(struct outq* outq)
+{
+	if(!outq->node.key)
+		return;
+	(void)rbtree_delete(global_svr->outqs, outq);
+	outq->node.key = NULL;
 }
 
-int outq_handle_udp(struct comm_point* c, void* my_arg, int error,
-	struct comm_reply *reply_info)
+void outq_udp_reopen(struct svr* svr)
 {
-	struct outq* outq = (struct outq*)my_arg;
-	uint8_t* wire = ldns_buffer_begin(c->buffer);
-	size_t len = ldns_buffer_limit(c->buffer);
-	if(error != NETEVENT_NOERROR) {
-		verbose(VERB_ALGO, "udp receive error");
-		return 0;
-	}
-	if(sockaddr_cmp(&outq->addr, outq->addrlen, &reply_info->addr,
-		reply_info->addrlen) != 0) {
-		/* from wrong source, keep listening for the real one */
-		log_addr(VERB_ALGO, "reply from wrong source",
-			&reply_info->addr, reply_info->addrlen);
-		return 0;
-	}
-	/* quick sanity check */
-	if(len < LDNS_HEADER_SIZE || LDNS_ID_WIRE(wire) != outq->qid
-		|| !LDNS_QR_WIRE(wire)) {
-		verbose(VERB_ALGO, "%4.4x wire, qid %4.4x, qr %s",
-			LDNS_ID_WIRE(wire), outq->qid,
-			LDNS_QR_WIRE(wire)?"yes":"no");
-		/* wait for the real reply */
-		verbose(VERB_ALGO, "ignored bad reply (tooshort, wrong qid or noQR)");
-		return 0;
+	if(svr->outqs->count != 0)
+		return;
+	comm_point_delete(svr->udp4);
+	svr->udp4 = NULL;
+	comm_point_delete(svr->udp6);
+	svr->udp6 = NULL;
+}
+
+void probe_tmpl_list_delete(struct probe_tmpl* list)
+{
+	struct probe_tmpl* t = list, *nt;
+	while(t) {
+		nt = t->next;
+		free(t->qname);
+		LDNS_FREE(t->wire);
+		free(t);
+		t = nt;
 	}
-	comm_timer_disable(outq->timer);
-	outq_check_packet(outq, wire, len);
-	return 0;
 }
 
-static int
-create_probe_query(struct outq* outq, ldns_buffer* buffer)
+/** create the query template for the outq, the ID and flags are zero */
+static struct probe_tmpl*
+probe_tmpl_create(struct outq* outq)
 {
-	uint16_t flags = 0;
 	ldns_pkt* pkt = NULL;
 	ldns_status status;
-	if(outq->recurse)
-		flags |= LDNS_RD;
-	if(outq->cdflag)
-		flags |= LDNS_CD;
+	struct probe_tmpl* t = (struct probe_tmpl*)calloc(1, sizeof(*t));
+	if(!t) {
+		log_err("out of memory");
+		return NULL;
+	}
+	t->qname = strdup(outq->qname);
+	if(!t->qname) {
+		log_err("out of memory");
+		free(t);
+		return NULL;
+	}
+	t->qtype = outq->qtype;
+	t->edns = outq->edns;
 	status = ldns_pkt_query_new_frm_str(&pkt, outq->qname, outq->qtype,
-		LDNS_RR_CLASS_IN, flags);
+		LDNS_RR_CLASS_IN, 0);
 	if(status != LDNS_STATUS_OK) {
 		log_err("could not pkt_query_new %s",
 			ldns_get_errorstr_by_id(status));
-		return 0;
+		probe_tmpl_list_delete(t);
+		return NULL;
 	}
 	if(outq->edns) {
 		ldns_pkt_set_edns_do(pkt, 1);
@@ -642,17 +1188,85 @@ create_probe_query(struct outq* outq, ldns_buffer* buffer)
 	} else {
 		ldns_pkt_set_edns_do(pkt, 0);
 	}
-	ldns_pkt_set_id(pkt, outq->qid);
-	ldns_buffer_clear(buffer);
-	status = ldns_pkt2buffer_wire(buffer, pkt);
-	if(status != LDNS_STATUS_OK) {
+	ldns_pkt_set_id(pkt, 0);
+	status = ldns_pkt2wire(&t->wire, pkt, &t->len);
+	ldns_pkt_free(pkt);
+	if(status != LDNS_STATUS_OK || t->len < LDNS_HEADER_SIZE) {
 		log_err("could not host2wire packet %s",
 			ldns_get_errorstr_by_id(status));
-		ldns_pkt_free(pkt);
+		probe_tmpl_list_delete(t);
+		return NULL;
+	}
+	/* the OPT record is last, with the size in the class field */
+	if(t->edns && t->len >= LDNS_HEADER_SIZE+11 &&
+		t->wire[t->len-11] == 0 &&
+		ldns_read_uint16(t->wire+t->len-10) == LDNS_RR_TYPE_OPT &&
+		ldns_read_uint16(t->wire+t->len-2) == 0)
+		t->opt_class = t->len-8;
+	return t;
+}
+
+/** find the query template for the outq, or create it */
+static struct probe_tmpl*
+probe_tmpl_get(struct outq* outq)
+{
+	struct svr* svr = global_svr;
+	struct probe_tmpl* t;
+	for(t = svr->tmpls; t; t = t->next) {
+		if(t->qtype == outq->qtype && t->edns == outq->edns &&
+			strcmp(t->qname, outq->qname) == 0)
+			return t;
+	}
+	if(!(t = probe_tmpl_create(outq)))
+		return NULL;
+	if(svr->num_tmpls >= PROBE_TMPL_MAX) {
+		/* the names are from the config, this is not reached
+		 * unless there are very many, start over */
+		probe_tmpl_list_delete(svr->tmpls);
+		svr->tmpls = NULL;
+		svr->num_tmpls = 0;
+	}
+	t->next = svr->tmpls;
+	svr->tmpls = t;
+	svr->num_tmpls++;
+	return t;
+}
+
+/** write the probe query at the current position of the buffer */
+static int
+write_probe_query(struct outq* outq, ldns_buffer* buffer)
+{
+	struct probe_tmpl* t = probe_tmpl_get(outq);
+	uint8_t* wire;
+	if(!t)
+		return 0;
+	if(!ldns_buffer_available(buffer, t->len)) {
+		log_err("query too large for buffer");
 		return 0;
 	}
+	/* copy the template and patch the ID and flags */
+	wire = ldns_buffer_current(buffer);
+	ldns_buffer_write(buffer, t->wire, t->len);
+	ldns_write_uint16(wire, outq->qid);
+	if(outq->recurse)
+		LDNS_RD_SET(wire);
+	else	LDNS_RD_CLR(wire);
+	if(outq->cdflag)
+		LDNS_CD_SET(wire);
+	else	LDNS_CD_CLR(wire);
+	if(outq->probe && outq->probe->udp_size && t->opt_class)
+		ldns_write_uint16(wire+t->opt_class,
+			(uint16_t)outq->probe->udp_size);
+	return 1;
+}
+
+static int
+create_probe_query(struct outq* outq, ldns_buffer* buffer)
+{
+	ldns_buffer_clear(buffer);
+	if(!write_probe_query(outq, buffer))
+		return 0;
 	ldns_buffer_flip(buffer);
-	ldns_pkt_free(pkt);
 	return 1;
 }
 
@@ -660,7 +1274,6 @@ struct outq*
 outq_create(const char* ip, int tp, const char* domain, int recurse,
 	struct probe_ip* p, int tcp, int onssl, int port, int edns, int cdflag)
 {
-	int fd;
 	struct outq* outq = (struct outq*)calloc(1, sizeof(*outq));
 	/* open UDP socket */
 	if(!outq) {
@@ -676,6 +1289,10 @@ outq_create(const char* ip, int tp, const char* domain, int recurse,
 	outq->port = port;
 	outq->edns = edns;
 	outq->cdflag = cdflag;
+	outq_stamp(&outq->times.created);
+	global_svr->stats->num_queries++;
+	if(outq_is_probe(p))
+		global_svr->probe_queries++;
 
 	if(!ipstrtoaddr(ip, port, &outq->addr, &outq->addrlen)) {
 		log_err("could not parse ip %s", ip);
@@ -688,6 +1305,7 @@ outq_create(const char* ip, int tp, const char* domain, int recurse,
 		outq_delete(outq);
 		return NULL;
 	}
+	comm_timer_set_slack(outq->timer, QUERY_TIMER_SLACK);
 
 	if(tcp || onssl){
 		/* also sets timeout, timer */
@@ -701,42 +1319,15 @@ outq_create(const char* ip, int tp, const char* domain, int recurse,
 		return outq;
 	}
 
-	fd = socket(strchr(ip, ':')?PF_INET6:PF_INET, SOCK_DGRAM, IPPROTO_UDP);
-	if(fd == -1) {
-#ifndef USE_WINSOCK
-		if(errno == EAFNOSUPPORT || errno == EPROTONOSUPPORT) {
-			if(verbosity <= 2) {
-				free(outq);
-				return NULL;
-			}
-		}
-#else
-		if(WSAGetLastError() == WSAEAFNOSUPPORT ||
-			WSAGetLastError() == WSAEPROTONOSUPPORT) {
-			if(verbosity <= 2) {
-				free(outq);
-				return NULL;
-			}
-		}
-#endif
-		log_err("socket %s udp: %s", strchr(ip, ':')?"ip6":"ip4",
-			strerror(errno));
-		free(outq);
-		return NULL;
-	}
-	outq->c = comm_point_create_udp(global_svr->base, fd,
-		global_svr->udp_buffer, &outq_handle_udp, outq);
-	if(!outq->c) {
-#ifndef USE_WINSOCK
-		close(fd);
-#else
-		closesocket(fd);
-#endif
-		free(outq);
+	/* use the shared UDP socket, replies are found by qid and address */
+	if(!outq_get_udp(addr_is_ip6(&outq->addr, outq->addrlen))) {
+		outq_delete(outq);
 		return NULL;
 	}
+	outq_udp_insert(outq);
 	/* set timeout on commpoint */
-	outq->timeout = QUERY_START_TIMEOUT; /* msec */
+	outq->timeout = rtt_timeout(global_svr->rtts, &outq->addr,
+		outq->addrlen, time(NULL)); /* msec */
 	if(!outq_settimeout_and_send(outq)) {
 		outq_delete(outq);
 		return NULL;
@@ -747,8 +1338,9 @@ outq_create(const char* ip, int tp, const char* domain, int recurse,
 void outq_delete(struct outq* outq)
 {
 	if(!outq) return;
+	outq_udp_remove(outq);
+	probe_conn_remove(outq);
 	comm_timer_delete(outq->timer);
-	comm_point_delete(outq->c);
 	free(outq);
 }
 
@@ -763,7 +1355,15 @@ static void outq_settimer(struct outq* outq)
 static int outq_settimeout_and_send(struct outq* outq)
 {
 	ldns_buffer* udpbuf = global_svr->udp_buffer;
+	struct comm_point* c;
+	uint32_t* secs;
+	struct timeval* now;
 	outq_settimer(outq);
+	comm_base_timept(global_svr->base, &secs, &now);
+	outq->sendtime = *now;
+	if(outq->times.sends++ == 0)
+		outq->times.sent = *now;
+	else	outq->times.resent = *now;
 
 	/* create and send a message over the fd */
 	if(!create_probe_query(outq, udpbuf)) {
@@ -771,9 +1371,11 @@ static int outq_settimeout_and_send(struct outq* outq)
 		return 0;
 	}
 	/* send it */
-	if(!comm_point_send_udp_msg(outq->c, udpbuf,
+	if(!(c = outq_get_udp(addr_is_ip6(&outq->addr, outq->addrlen))) ||
+		!comm_point_send_udp_msg(c, udpbuf,
 		(struct sockaddr*)&outq->addr, outq->addrlen)) {
-		log_err("could not UDP send to ip %s", outq->probe->name);
+		log_err("could not UDP send to ip %s",
+			outq->probe?outq->probe->name:outq->qname);
 		return 0;
 	}
 	return 1;
@@ -782,31 +1384,149 @@ static int outq_settimeout_and_send(struct outq* outq)
 void outq_timeout(void* arg)
 {
 	struct outq* outq = (struct outq*)arg;
-	char *t = ldns_rr_type2str(outq->qtype);
-	verbose(VERB_ALGO, "%s %s: UDP timeout after %d msec",
-		outq->probe?outq->probe->name:outq->qname, t, outq->timeout);
+	char *t;
+	if(outq->conn_err) {
+		/* the TCP connection it was on has failed */
+		outq_done(outq, outq->conn_err);
+		return;
+	}
+	t = ldns_rr_type2str(outq->qtype);
+	verbose(VERB_ALGO, "%s %s: %s timeout after %d msec",
+		outq->probe?outq->probe->name:outq->qname, t,
+		outq->on_tcp?"TCP":"UDP", outq->timeout);
 	free(t);
-	if(outq->timeout > QUERY_END_TIMEOUT) {
+	global_svr->stats->num_timeouts++;
+	if(outq->on_tcp) {
+		outq_done(outq, "timeout");
+		return;
+	}
+	outq->waited += outq->timeout;
+	rtt_lost(global_svr->rtts, &outq->addr, outq->addrlen,
+		outq->timeout, time(NULL));
+	if(outq->waited + RTT_MIN_TIMEOUT > QUERY_END_TIMEOUT) {
 		/* too many timeouts */
 		outq_done(outq, "timeout");
 		return;
 	}
-	/* resend */
+	/* resend, with backoff, within the total time for the query */
+	outq->resent = 1;
+	global_svr->stats->num_resent++;
+	if(outq_is_probe(outq->probe))
+		global_svr->probe_resent++;
 	outq->timeout *= 2;
+	if(outq->timeout > RTT_MAX_TIMEOUT)
+		outq->timeout = RTT_MAX_TIMEOUT;
+	if(outq->timeout > QUERY_END_TIMEOUT - outq->waited)
+		outq->timeout = QUERY_END_TIMEOUT - outq->waited;
 	if(!outq_settimeout_and_send(outq)) {
 		outq_done(outq, "could not resend after timeout");
 		return;
 	}
 }
 
-/** use next free buffer to service a tcp query */ 
-static int 
-outq_tcp_take_into_use(struct outq* outq) 
-{ 
+/** delete TCP connection, the queries must have been removed from it */
+static void
+probe_conn_delete(struct probe_conn* conn)
+{
+	struct probe_conn** pp;
+	if(!conn) return;
+	for(pp = &global_svr->conns; *pp; pp = &(*pp)->next) {
+		if(*pp == conn) {
+			*pp = conn->next;
+			break;
+		}
+	}
+	comm_timer_delete(conn->timer);
+	comm_point_delete(conn->c);
+	free(conn);
+}
+
+static void
+probe_conn_remove(struct outq* outq)
+{
+	struct probe_conn* conn = outq->conn;
+	struct outq** pp;
+	if(!conn) return;
+	for(pp = &conn->queries; *pp; pp = &(*pp)->conn_next) {
+		if(*pp == outq) {
+			*pp = outq->conn_next;
+			break;
+		}
+	}
+	outq->conn = NULL;
+	outq->conn_next = NULL;
+	/* close the connection when its last query is done */
+	if(!conn->queries)
+		probe_conn_delete(conn);
+}
+
+/** find query on the TCP connection by qid */
+static struct outq*
+probe_conn_lookup(struct probe_conn* conn, uint16_t qid)
+{
+	struct outq* o;
+	for(o = conn->queries; o; o = o->conn_next)
+		if(o->qid == qid)
+			return o;
+	return NULL;
+}
+
+/** find a connection to the server of the query that has not started
+ * to write, the query can be pipelined on it */
+static struct probe_conn*
+probe_conn_find(struct outq* outq)
+{
+	struct probe_conn* conn;
+	void* sslctx = (outq->on_ssl && outq->probe)?outq->probe->sslctx:NULL;
+	for(conn = global_svr->conns; conn; conn = conn->next) {
+		if(conn->on_ssl == outq->on_ssl && conn->sslctx == sslctx &&
+			!conn->replied && conn->c->tcp_byte_count == 0 &&
+			!conn->c->tcp_is_reading &&
+			sockaddr_cmp(&conn->addr, conn->addrlen, &outq->addr,
+			outq->addrlen) == 0)
+			return conn;
+	}
+	return NULL;
+}
+
+/** copy the connect and handshake times of the connection to the query */
+static void
+probe_conn_times(struct probe_conn* conn, struct outq* outq)
+{
+	outq->times.connected = conn->c->tcp_connect_time;
+	outq->times.handshake = conn->c->ssl_shake_time;
+}
+
+/** the TCP connection has failed, its queries fail with the reason.
+ * They fail from their timer, because outq_done can delete the other
+ * queries on the connection */
+static void
+probe_conn_fail(struct probe_conn* conn, const char* reason)
+{
+	struct outq* o, *next;
+	struct timeval tv;
+	tv.tv_sec = 0;
+	tv.tv_usec = 0;
+	for(o = conn->queries; o; o = next) {
+		next = o->conn_next;
+		probe_conn_times(conn, o);
+		o->conn = NULL;
+		o->conn_next = NULL;
+		o->conn_err = reason;
+		comm_timer_set(o->timer, &tv);
+	}
+	conn->queries = NULL;
+	probe_conn_delete(conn);
+}
+
+/** open socket for the TCP connection and start to connect */
+static int
+probe_conn_open(struct probe_conn* conn)
+{
 	int s;
 	/* open socket */
 #ifdef INET6
-	if(strchr(outq->probe->name, ':'))
+	if(addr_is_ip6(&conn->addr, conn->addrlen))
 		s = socket(PF_INET6, SOCK_STREAM, IPPROTO_TCP);
 	else
 #endif
@@ -830,12 +1550,12 @@ outq_tcp_take_into_use(struct outq* outq)
 			wsa_strerror(WSAGetLastError()));
 #endif
 		log_addr(VERB_QUERY, "failed address",
-			&outq->addr, outq->addrlen);
+			&conn->addr, conn->addrlen);
 		return 0;
 	}
 
 	fd_set_nonblock(s);
-	if(connect(s, (struct sockaddr*)&outq->addr, outq->addrlen) == -1) {
+	if(connect(s, (struct sockaddr*)&conn->addr, conn->addrlen) == -1) {
 #ifndef USE_WINSOCK
 #ifdef EINPROGRESS
 		if(errno != EINPROGRESS) {
@@ -850,47 +1570,159 @@ outq_tcp_take_into_use(struct outq* outq)
 			closesocket(s);
 #endif
 			log_addr(VERB_OPS, "failed address",
-				&outq->addr, outq->addrlen);
+				&conn->addr, conn->addrlen);
 			return 0;
 		}
 	}
-	if(outq->on_ssl) {
-		outq->c->ssl = outgoing_ssl_fd(outq->probe->sslctx, s);
-		if(!outq->c->ssl) {
-			outq->c->fd = s;
-			comm_point_close(outq->c);
+	if(conn->on_ssl) {
+		struct ssllist* e;
+		conn->c->ssl = outgoing_ssl_fd(conn->sslctx, s);
+		if(!conn->c->ssl) {
+			conn->c->fd = s;
+			comm_point_close(conn->c);
 			return 0;
 		}
+		/* resume the session of the previous connection */
+		e = (struct ssllist*)SSL_CTX_get_app_data(
+			(SSL_CTX*)conn->sslctx);
+		if(e && e->session)
+			(void)SSL_set_session(conn->c->ssl, e->session);
 #ifdef USE_WINSOCK
-		comm_point_tcp_win_bio_cb(outq->c, outq->c->ssl);
+		comm_point_tcp_win_bio_cb(conn->c, conn->c->ssl);
 #endif
-		outq->c->ssl_shake_state = comm_ssl_shake_write;
+		conn->c->ssl_shake_state = comm_ssl_shake_write;
 	}
-	outq->c->repinfo.addrlen = outq->addrlen;
-	memcpy(&outq->c->repinfo.addr, &outq->addr, outq->addrlen);
-	outq->c->tcp_is_reading = 0;
-	outq->c->tcp_byte_count = 0;
-	comm_point_start_listening(outq->c, s, -1);
+	conn->c->repinfo.addrlen = conn->addrlen;
+	memcpy(&conn->c->repinfo.addr, &conn->addr, conn->addrlen);
+	conn->c->tcp_is_reading = 0;
+	conn->c->tcp_byte_count = 0;
+	comm_point_start_listening(conn->c, s, -1);
 	return 1;
 }
 
+/** create TCP connection to the server of the query */
+static struct probe_conn*
+probe_conn_create(struct outq* outq)
+{
+	struct probe_conn* conn = (struct probe_conn*)calloc(1,
+		sizeof(*conn));
+	if(!conn) {
+		log_err("out of memory");
+		return NULL;
+	}
+	memcpy(&conn->addr, &outq->addr, outq->addrlen);
+	conn->addrlen = outq->addrlen;
+	conn->on_ssl = outq->on_ssl;
+	if(outq->on_ssl && outq->probe)
+		conn->sslctx = outq->probe->sslctx;
+	conn->c = comm_point_create_tcp_out(global_svr->base, 65553,
+		outq_handle_tcp, conn);
+	if(!conn->c) {
+		log_err("cannot create tcp comm point, out of memory");
+		free(conn);
+		return NULL;
+	}
+	/* the queries are put in the buffer with their length prefix */
+	conn->c->tcp_write_prefixed = 1;
+	ldns_buffer_clear(conn->c->buffer);
+	ldns_buffer_flip(conn->c->buffer);
+	conn->timer = comm_timer_create(global_svr->base,
+		&probe_conn_pending, conn);
+	if(!conn->timer) {
+		log_err("cannot create timer");
+		probe_conn_delete(conn);
+		return NULL;
+	}
+	if(!probe_conn_open(conn)) {
+		probe_conn_delete(conn);
+		return NULL;
+	}
+	conn->next = global_svr->conns;
+	global_svr->conns = conn;
+	return conn;
+}
+
+/** append the query, with length prefix, to the queries to write */
+static int
+probe_conn_add(struct probe_conn* conn, struct outq* outq)
+{
+	struct probe_tmpl* t = probe_tmpl_get(outq);
+	ldns_buffer* buf;
+	size_t at;
+	/* the buffer of the connection starts small, it grows for the
+	 * queries that are pipelined on it */
+	if(!t || !comm_point_buffer_reserve(conn->c, ldns_buffer_limit(
+		conn->c->buffer) + sizeof(uint16_t) + t->len))
+		return 0;
+	buf = conn->c->buffer;
+	at = ldns_buffer_limit(buf);
+	ldns_buffer_set_limit(buf, ldns_buffer_capacity(buf));
+	ldns_buffer_set_position(buf, at);
+	if(ldns_buffer_available(buf, sizeof(uint16_t))) {
+		ldns_buffer_skip(buf, sizeof(uint16_t));
+		if(write_probe_query(outq, buf)) {
+			ldns_buffer_write_u16_at(buf, at, (uint16_t)(
+				ldns_buffer_position(buf) - at -
+				sizeof(uint16_t)));
+			ldns_buffer_flip(buf);
+			outq->conn = conn;
+			outq->conn_next = conn->queries;
+			conn->queries = outq;
+			return 1;
+		}
+	}
+	/* leave the queries that are already in the buffer */
+	ldns_buffer_set_limit(buf, at);
+	ldns_buffer_set_position(buf, 0);
+	return 0;
+}
+
+/** wait for the next reply on the TCP connection */
+static void
+probe_conn_read_next(struct probe_conn* conn)
+{
+	struct comm_point* c = conn->c;
+	ldns_buffer_clear(c->buffer);
+	c->tcp_is_reading = 1;
+	c->tcp_byte_count = 0;
+	comm_point_start_listening(c, -1, -1);
+	if(c->ssl && SSL_pending(c->ssl) > 0) {
+		/* the fd does not signal data that SSL has read already */
+		struct timeval tv;
+		tv.tv_sec = 0;
+		tv.tv_usec = 0;
+		comm_timer_set(conn->timer, &tv);
+	}
+}
+
+void probe_conn_pending(void* arg)
+{
+	struct probe_conn* conn = (struct probe_conn*)arg;
+	comm_point_tcp_handle_callback(conn->c->fd, EV_READ, conn->c);
+}
+
 static int outq_send_tcp(struct outq* outq)
 {
+	struct probe_conn* conn;
 	/* send outq over tcp, stop UDP in progress (if any) */
-	if(outq->c) comm_point_delete(outq->c);
+	outq_udp_remove(outq);
+	probe_conn_remove(outq);
 	outq->timeout = QUERY_TCP_TIMEOUT;
 	outq->on_tcp = 1;
-	outq->qid = (uint16_t)ldns_get_random();
-	outq->c = comm_point_create_tcp_out(global_svr->base, 65553,
-		outq_handle_tcp, outq);
-	if(!outq->c) {
-		log_err("cannot create tcp comm point, out of memory");
-		return 0;
-	}
-	if(!create_probe_query(outq, outq->c->buffer))
+	/* pipeline the query on a connection to the same server, if
+	 * there is one that has not started writing */
+	conn = probe_conn_find(outq);
+	if(!conn && !(conn = probe_conn_create(outq)))
 		return 0;
-	if(!outq_tcp_take_into_use(outq))
+	outq_stamp(&outq->times.sent);
+	do {
+		outq->qid = (uint16_t)ldns_get_random();
+	} while(probe_conn_lookup(conn, outq->qid));
+	if(!probe_conn_add(conn, outq)) {
+		if(!conn->queries)
+			probe_conn_delete(conn);
 		return 0;
+	}
 	outq_settimer(outq);
 	return 1;
 }
@@ -898,25 +1730,31 @@ static int outq_send_tcp(struct outq* outq)
 int outq_handle_tcp(struct comm_point* c, void* my_arg, int error,
 	struct comm_reply* ATTR_UNUSED(reply_info))
 {
-	struct outq* outq = (struct outq*)my_arg;
+	struct probe_conn* conn = (struct probe_conn*)my_arg;
 	uint8_t* wire = ldns_buffer_begin(c->buffer);
 	size_t len = ldns_buffer_limit(c->buffer);
+	struct outq* outq;
 	if(error != NETEVENT_NOERROR) {
 		if(error == NETEVENT_CLOSED)
-			outq_done(outq, "TCP connection failure");
-		else	outq_done(outq, "TCP receive error");
+			probe_conn_fail(conn, "TCP connection failure");
+		else	probe_conn_fail(conn, "TCP receive error");
 		return 0;
 	}
 	/* quick sanity check */
 	if(len < LDNS_HEADER_SIZE) {
-		outq_done(outq, "TCP reply with short header");
+		probe_conn_fail(conn, "TCP reply with short header");
 		return 0;
 	}
-	if(LDNS_ID_WIRE(wire) != outq->qid) {
-		outq_done(outq, "TCP reply with wrong ID");
+	/* the replies can come in any order */
+	if(!(outq = probe_conn_lookup(conn, LDNS_ID_WIRE(wire)))) {
+		probe_conn_fail(conn, "TCP reply with wrong ID");
 		return 0;
 	}
+	conn->replied = 1;
 	comm_timer_disable(outq->timer);
+	/* the reply stays in the buffer until the next read */
+	if(conn->queries->conn_next)
+		probe_conn_read_next(conn);
 	outq_check_packet(outq, wire, len);
 	return 0;
 }
@@ -951,6 +1789,8 @@ static void probe_spawn(const char* ip, int recurse, int dnstcp,
 {
 	const char* dest;
 	struct probe_ip* p;
+	uint32_t* secs;
+	struct timeval* now;
 	if(!ip || ip[0]==0) return;
 
 	/* create a probe for this IP */
@@ -973,6 +1813,8 @@ static void probe_spawn(const char* ip, int recurse, int dnstcp,
 	p->ssldns = ssldns;
 	p->port = port;
 	p->got_packet = 0;
+	comm_base_timept(global_svr->base, &secs, &now);
+	p->start = *now;
 	p->name = strdup(ip);
 	if(!p->name) {
 		free(p);
@@ -980,8 +1822,8 @@ static void probe_spawn(const char* ip, int recurse, int dnstcp,
 		return;
 	}
 	if(p->ssldns) {
-		/* this could contain verification certificates */
-		p->sslctx = connect_sslctx_create(NULL, NULL, NULL);
+		/* shared by the probes to this server, for session reuse */
+		p->sslctx = p->ssldns->sslctx;
 		if(!p->sslctx) {
 			log_err("could not create sslctx for %s", p->name);
 			probe_delete(p);
@@ -1023,19 +1865,44 @@ static void probe_spawn(const char* ip, int recurse, int dnstcp,
 	global_svr->num_probes++;
 }
 
-/** start probes for direct DNS authority server connection */
-static void probe_spawn_direct(void)
+/** start probes for direct DNS authority server connection,
+ * returns false if no probes could be created */
+static int probe_spawn_direct(void)
 {
-	int nump = global_svr->num_probes;
-	/* try both IP4 and IP6, one that works is enough */
-	verbose(VERB_ALGO, "probe authority servers");
-	probe_spawn(get_random_auth_ip4(), 0, 0, 0, DNS_PORT);
-	probe_spawn(get_random_auth_ip6(), 0, 0, 0, DNS_PORT);
-	if(global_svr->num_probes == nump) {
-		/* failed to create the probes */
-		/* not a loop since svr->probe_direct is true */
-		probe_cache_done();
+	struct svr* svr = global_svr;
+	int nump = svr->num_probes, best4, best6;
+	const char* ip4 = probe_root_pick(svr, svr->cfg->root_ip4,
+		svr->cfg->num_root_ip4, &best4);
+	const char* ip6 = probe_root_pick(svr, svr->cfg->root_ip6,
+		svr->cfg->num_root_ip6, &best6);
+	/* try both IP4 and IP6, one that works is enough.  If the roots
+	 * of one family only time out, and the other family is reachable,
+	 * that family is not probed, except sometimes to see if it is back */
+	if(ip4 && ip6 && ldns_get_random()%100 >= PROBE_ROOT_EXPLORE) {
+		if(best4 >= RTT_MAX_TIMEOUT && best6 < RTT_MAX_TIMEOUT) {
+			verbose(VERB_ALGO, "skip ip4 authority, it times out");
+			ip4 = NULL;
+		} else if(best6 >= RTT_MAX_TIMEOUT &&
+			best4 < RTT_MAX_TIMEOUT) {
+			verbose(VERB_ALGO, "skip ip6 authority, it times out");
+			ip6 = NULL;
+		}
 	}
+	verbose(VERB_ALGO, "probe authority servers");
+	if(ip4)
+		probe_spawn(ip4, 0, 0, 0, DNS_PORT);
+	if(ip6)
+		probe_spawn(ip6, 0, 0, 0, DNS_PORT);
+	return (svr->num_probes != nump);
+}
+
+/** start a new race of the tcp80, tcp443 and ssl443 resolvers */
+static void
+probe_race_start(struct svr* svr)
+{
+	comm_timer_disable(svr->race_timer);
+	memset(svr->race_started, 0, sizeof(svr->race_started));
+	svr->race_start = (unsigned)ldns_get_random();
 }
 
 /** start probes for TCP to open resolvers on non53 port numbers */
@@ -1043,20 +1910,18 @@ static void probe_spawn_dnstcp(void)
 {
 	/* try ip4 and ip6, on port 80 and 443 (if configured) */
 	verbose(VERB_ALGO, "probe dnstcp servers");
-	probe_spawn(get_random_tcp80_ip4(global_svr->cfg), 1, 1, 0, 80);
-	probe_spawn(get_random_tcp80_ip6(global_svr->cfg), 1, 1, 0, 80);
-	probe_spawn(get_random_tcp443_ip4(global_svr->cfg), 1, 1, 0, 443);
-	probe_spawn(get_random_tcp443_ip6(global_svr->cfg), 1, 1, 0, 443);
+	(void)probe_race_spawn(global_svr, 0);
+	(void)probe_race_spawn(global_svr, 1);
+	(void)probe_race_spawn(global_svr, 2);
+	(void)probe_race_spawn(global_svr, 3);
 }
 
 /** start probes for SSL DNS to open resolvers */
 static void probe_spawn_ssldns(void)
 {
-	struct ssllist* s4 = get_random_ssl443_ip4(global_svr->cfg);
-	struct ssllist* s6 = get_random_ssl443_ip6(global_svr->cfg);
 	verbose(VERB_ALGO, "probe ssl dns servers");
-	if(s4) probe_spawn(s4->str, 1, 1, s4, 443);
-	if(s6) probe_spawn(s6->str, 1, 1, s6, 443);
+	(void)probe_race_spawn(global_svr, 4);
+	(void)probe_race_spawn(global_svr, 5);
 }
 
 void probe_unsafe_test(void)
@@ -1103,7 +1968,9 @@ void probe_ssl_test(void)
 	global_svr->probe_direct = 1;
 	probe_spawn("127.0.0.4", 0, 0, 0, DNS_PORT);
 	global_svr->probe_dnstcp = 1;
+	probe_race_start(global_svr);
 	probe_spawn_ssldns();
+	probe_race_timer_set(global_svr);
 	global_svr->tcp_timer_used = 1; /* avoid retry after 20 sec */
 }
 
@@ -1148,6 +2015,60 @@ static void stop_unfinished_probes(void)
 	}
 }
 
+/** the stage of the probe, the earlier stages are preferred */
+static int
+probe_stage(struct probe_ip* p)
+{
+	if(p->dnstcp)
+		return PROBE_STAGE_TCP;
+	if(p->to_auth)
+		return PROBE_STAGE_AUTH;
+	return PROBE_STAGE_CACHE;
+}
+
+/** the latest probe stage that has been started */
+static int
+probe_stage_started(struct svr* svr)
+{
+	if(svr->probe_dnstcp)
+		return PROBE_STAGE_TCP;
+	if(svr->probe_direct)
+		return PROBE_STAGE_AUTH;
+	return PROBE_STAGE_CACHE;
+}
+
+/** true if probes of the stage are not finished, the http probes are
+ * not counted */
+static int
+probe_stage_busy(struct svr* svr, int stage)
+{
+	struct probe_ip* p;
+	for(p = svr->probes; p; p = p->next) {
+		if(!p->finished && !p->to_http && probe_stage(p) == stage)
+			return 1;
+	}
+	return 0;
+}
+
+/* stop unfinished probes of the stages after this one, an earlier
+ * stage works and is used */
+static void stop_probes_after_stage(struct svr* svr, int stage)
+{
+	struct probe_ip* p, *prev = NULL, *np;
+	for(p = svr->probes; p; p = np) {
+		np = p->next;
+		if(!p->finished && probe_stage(p) > stage) {
+			if(prev) prev->next = p->next;
+			else	svr->probes = p->next;
+			verbose(VERB_ALGO, "stop %s: not needed", p->name);
+			probe_delete(p);
+			svr->num_probes--;
+		} else {
+			prev = p;
+		}
+	}
+}
+
 /* see if there are working dnstcp probes */
 int probe_has_work_tcp(struct svr* svr, int port, int ip6, int ssl)
 {
@@ -1168,10 +2089,67 @@ int probe_has_work_tcp(struct svr* svr, int port, int ip6, int ssl)
 }
 
 
+/** store the probe result for the network */
+static void
+probe_store_netstate(struct svr* svr)
+{
+	char buf[10240];
+	char* now = buf;
+	size_t left = sizeof(buf);
+	struct probe_ip* p;
+	uint32_t* secs;
+	struct timeval* tv;
+	int tcp = 0, msec;
+	if(!svr->net_fp || !svr->net_fp[0] || !svr->cfg->state_file[0])
+		return;
+	if(svr->res_state == res_dark || svr->res_state == res_disconn ||
+		svr->http_insecure) {
+		/* no secure result, nothing to use next time */
+		netstate_remove(&svr->netstates, svr->net_fp);
+		netstate_write(svr->netstates, svr->cfg->state_file);
+		return;
+	}
+	buf[0]=0; /* safe, robust */
+	if(svr->res_state == res_cache) {
+		for(p = svr->probes; p; p = p->next) {
+			if(probe_is_cache(p) && p->works && p->finished) {
+				size_t len;
+				if(left < strlen(p->name)+3)
+					break; /* no space for more */
+				snprintf(now, left, "%s%s",
+					(now==buf)?"":" ", p->name);
+				len = strlen(now);
+				left -= len;
+				now += len;
+			}
+		}
+		if(!buf[0]) {
+			/* without the servers the result cannot be used */
+			netstate_remove(&svr->netstates, svr->net_fp);
+			netstate_write(svr->netstates, svr->cfg->state_file);
+			return;
+		}
+	}
+	if(probe_has_work_tcp(svr, 80, 0, 0)) tcp |= NETSTATE_TCP80_IP4;
+	if(probe_has_work_tcp(svr, 80, 1, 0)) tcp |= NETSTATE_TCP80_IP6;
+	if(probe_has_work_tcp(svr, 443, 0, 0)) tcp |= NETSTATE_TCP443_IP4;
+	if(probe_has_work_tcp(svr, 443, 1, 0)) tcp |= NETSTATE_TCP443_IP6;
+	if(probe_has_work_tcp(svr, 443, 0, 1)) tcp |= NETSTATE_SSL443_IP4;
+	if(probe_has_work_tcp(svr, 443, 1, 1)) tcp |= NETSTATE_SSL443_IP6;
+	comm_base_timept(svr->base, &secs, &tv);
+	msec = (int)(tv->tv_sec - svr->probe_start_tv.tv_sec)*1000 +
+		(int)(tv->tv_usec - svr->probe_start_tv.tv_usec)/1000;
+	netstate_store(&svr->netstates, svr->net_fp, (int)svr->res_state,
+		buf, tcp, msec, time(NULL));
+	netstate_write(svr->netstates, svr->cfg->state_file);
+}
+
 /** see if probe totally done or we have to wait more */
 static void
 probe_partial_done(struct probe_ip* p, const char* in, const char* reason)
 {
+	uint32_t* secs;
+	struct timeval* now;
 	if(!reason && (p->ds_c || p->dnskey_c || p->nsec3_c)) {
 		/* this one success but wait for the other one */
 		verbose(VERB_ALGO, "probe %s: %s completed successfully",
@@ -1197,8 +2175,18 @@ probe_partial_done(struct probe_ip* p, const char* in, const char* reason)
 		p->works = 1;
 	}
 
+	comm_base_timept(global_svr->base, &secs, &now);
+	p->msec = (int)(now->tv_sec - p->start.tv_sec)*1000 +
+		(int)(now->tv_usec - p->start.tv_usec)/1000;
 	p->finished = 1;
 	global_svr->num_probes_done++;
+	timeline_add(global_svr->timeline, "probe %s %s start=%d done=%d "
+		"%s%s",
+		p->ssldns?"ssl443":(p->dnstcp?(p->port==80?"tcp80":"tcp443"):
+		(p->to_auth?"authority":"cache")), p->name,
+		timeline_msec(global_svr->timeline, &p->start),
+		timeline_msec(global_svr->timeline, now),
+		p->works?"ok":"error: ", p->works?"":(p->reason?p->reason:""));
 	probe_done(p);
 }
 
@@ -1215,10 +2203,23 @@ static void
 probe_done(struct probe_ip* p)
 {
 	struct svr* svr = global_svr;
+	int stage = probe_stage(p);
+	if(p->works && stage == PROBE_STAGE_TCP) {
+		/* the first one to work in its race group, stop the others */
+		probe_race_stop(svr, p);
+	} else if(!p->works && stage == PROBE_STAGE_TCP &&
+		probe_race_group(p) != -1 &&
+		svr->race_started[probe_race_group(p)] > 0) {
+		/* start the next resolver of the group, without waiting */
+		(void)probe_race_spawn(svr, probe_race_group(p));
+	}
 	if(p->works) {
-		if(!svr->probe_dnstcp && !svr->probe_direct &&
-			!svr->saw_first_working) {
+		if(stage == PROBE_STAGE_CACHE && !svr->saw_first_working) {
 			svr->saw_first_working = 1;
+			/* the cache is preferred, stop the later stages */
+			comm_timer_disable(svr->stage_timer);
+			svr->stage_wait_http = 0;
+			stop_probes_after_stage(svr, stage);
 			/* if works, not forced_insecure and http works (or
 			 * did not get probed because not configured) then
 			 * we can already use this cache-DNS now before all
@@ -1227,19 +2228,34 @@ probe_done(struct probe_ip* p)
 				svr->skip_http || svr->http->saw_http_work)) {
 				probe_setup_cache(svr, p);
 			}
-		} else if(svr->probe_direct && !svr->probe_dnstcp &&
-			!svr->saw_direct_work) {
+		} else if(stage == PROBE_STAGE_AUTH &&
+			!svr->saw_first_working && !svr->saw_direct_work) {
 			svr->saw_direct_work = 1;
-			/* no need for wait for more done */
-			stop_unfinished_probes();
-			probe_cache_done();
-			return;
-		} else if(svr->probe_dnstcp && !svr->saw_dnstcp_work) {
+			comm_timer_disable(svr->stage_timer);
+			svr->stage_wait_http = 0;
+			stop_probes_after_stage(svr, stage);
+		} else if(stage == PROBE_STAGE_TCP && !svr->saw_first_working
+			&& !svr->saw_direct_work && !svr->saw_dnstcp_work) {
 			svr->saw_dnstcp_work = 1;
-			/* can already use this port */
-			if(!svr->forced_insecure)
+			/* can already use this port, unless an earlier
+			 * stage can still work */
+			if(!svr->forced_insecure &&
+				!probe_stage_busy(svr, PROBE_STAGE_CACHE) &&
+				!probe_stage_busy(svr, PROBE_STAGE_AUTH))
 				probe_setup_dnstcp(svr);
 		}
+	} else if(svr->cfg->probe_stage_delay > 0 &&
+		stage == probe_stage_started(svr)) {
+		/* a probe fails, the next stage is likely needed */
+		probe_stage_next(svr);
+	}
+	if(svr->saw_direct_work && !svr->saw_first_working &&
+		!probe_stage_busy(svr, PROBE_STAGE_CACHE)) {
+		/* authority works, and the cache probes, that are
+		 * preferred, have failed. no need for wait for more done */
+		stop_unfinished_probes();
+		probe_cache_done();
+		return;
 	}
 	if(svr->num_probes_done < svr->num_probes) {
 		/* continue to wait for the rest */
@@ -1260,6 +2276,8 @@ void probe_setup_cache(struct svr* svr, struct probe_ip* p)
 	else	hook_unbound_cache_list(svr->cfg, svr->probes);
 	/* set resolv.conf to 127.0.0.1 */
 	hook_resolv_localhost(svr->cfg);
+	/* when the hooks are done, fill the cache of unbound */
+	prewarm_queue(svr->prewarm, svr);
 	svr_retry_timer_stop();
 	svr->tcp_timer_used = 0;
 	svr->http_insecure = 0;
@@ -1274,6 +2292,8 @@ void probe_setup_auth(struct svr* svr)
 	hook_unbound_auth(svr->cfg);
 	/* set resolv.conf to 127.0.0.1 */
 	hook_resolv_localhost(svr->cfg);
+	/* when the hooks are done, fill the cache of unbound */
+	prewarm_queue(svr->prewarm, svr);
 	svr_retry_timer_stop();
 	svr->tcp_timer_used = 0;
 	svr->http_insecure = 0;
@@ -1284,6 +2304,9 @@ void probe_setup_dnstcp(struct svr* svr)
 {
 	int tcp80_ip4, tcp443_ip4, tcp80_ip6, tcp443_ip6, ssl443_ip4,
 		ssl443_ip6;
+	char buf[102400];
+	char* now = buf;
+	size_t left = sizeof(buf);
 	if(svr->insecure_state) hook_resolv_flush(svr->cfg);
 	svr->insecure_state = 0;
 	/* see which ports work */
@@ -1293,16 +2316,27 @@ void probe_setup_dnstcp(struct svr* svr)
 	tcp443_ip6 = probe_has_work_tcp(svr, 443, 1, 0);
 	ssl443_ip4 = probe_has_work_tcp(svr, 443, 0, 1);
 	ssl443_ip6 = probe_has_work_tcp(svr, 443, 1, 1);
+	/* the resolvers that worked in the race, fastest first */
+	buf[0] = 0;
 	if(tcp80_ip4 || tcp443_ip4 || tcp80_ip6 || tcp443_ip6) {
+		if(tcp80_ip4) probe_race_forwards(svr, 0, buf, &now, &left);
+		if(tcp80_ip6) probe_race_forwards(svr, 1, buf, &now, &left);
+		if(tcp443_ip4) probe_race_forwards(svr, 2, buf, &now, &left);
+		if(tcp443_ip6) probe_race_forwards(svr, 3, buf, &now, &left);
 		svr->res_state = res_tcp;
 		hook_unbound_tcp_upstream(svr->cfg, tcp80_ip4, tcp80_ip6,
-			tcp443_ip4, tcp443_ip6);
+			tcp443_ip4, tcp443_ip6, buf[0]?buf:NULL);
 	} else {
+		if(ssl443_ip4) probe_race_forwards(svr, 4, buf, &now, &left);
+		if(ssl443_ip6) probe_race_forwards(svr, 5, buf, &now, &left);
 		svr->res_state = res_ssl;
-		hook_unbound_ssl_upstream(svr->cfg, ssl443_ip4, ssl443_ip6);
+		hook_unbound_ssl_upstream(svr->cfg, ssl443_ip4, ssl443_ip6,
+			buf[0]?buf:NULL);
 	}
 	/* set resolv.conf to 127.0.0.1 */
 	hook_resolv_localhost(svr->cfg);
+	/* when the hooks are done, fill the cache of unbound */
+	prewarm_queue(svr->prewarm, svr);
 	svr_retry_timer_stop();
 	svr_tcp_timer_enable();
 	svr->http_insecure = 0;
@@ -1397,37 +2431,15 @@ probe_cache_done(void)
 		 * traffic to the authority servers when a cache works */
 		svr->probe_direct = 1;
 		/* set flag first avoids loop in case spawn fails */
-		probe_spawn_direct();
-		return;
+		if(probe_spawn_direct()) {
+			probe_stage_timer_set(svr);
+			return;
+		}
+		/* failed to create the probes, continue */
 	}
 	if(!svr->probe_dnstcp && !svr->saw_first_working
-		&& !svr->saw_direct_work && (cfg_have_dnstcp(svr->cfg) ||
-		cfg_have_ssldns(svr->cfg))) {
-		int nump = global_svr->num_probes;
-		int done = 0;
-		if(hook_unbound_supports_tcp_upstream(svr->cfg)) {
-			/* no working cache and authority-direct works.
-			 * probe dns-over-tcp on port 80 and 443.
-			 * Do not probe earlier to avoid traffic on 
-			 * those resolvers when not necessary */
-			svr->probe_dnstcp = 1;
-			probe_spawn_dnstcp();
-			done = 1;
-		}
-		if(hook_unbound_supports_ssl_upstream(svr->cfg)) {
-			/* probe for SSL wrapped service to avoid deepstuff */
-			svr->probe_dnstcp = 1;
-			probe_spawn_ssldns();
-			done = 1;
-		}
-		if(!done) {
-			verbose(VERB_OPS, "unbound does not support "
-				"tcp-upstream and ssl-upstream, but "
-				"these features are needed now. "
-				"Please upgrade unbound");
-		} else if(global_svr->num_probes == nump) {
-			/* failed to create the probes (outofmemory?) */
-		} else if(done) {
+		&& !svr->saw_direct_work) {
+		if(probe_spawn_tcp_stage(svr)) {
 			/* do the probes */
 			return;
 		}
@@ -1435,6 +2447,93 @@ probe_cache_done(void)
 	probe_all_done();
 }
 
+/** start the probes for tcp and ssl resolvers, if configured and
+ * supported by unbound, returns false if no probes were created */
+static int
+probe_spawn_tcp_stage(struct svr* svr)
+{
+	int nump = svr->num_probes;
+	int done = 0;
+	if(!cfg_have_dnstcp(svr->cfg) && !cfg_have_ssldns(svr->cfg))
+		return 0;
+	probe_race_start(svr);
+	if(hook_unbound_supports_tcp_upstream(svr->cfg)) {
+		/* no working cache and authority-direct works.
+		 * probe dns-over-tcp on port 80 and 443.
+		 * Do not probe earlier to avoid traffic on 
+		 * those resolvers when not necessary */
+		svr->probe_dnstcp = 1;
+		probe_spawn_dnstcp();
+		done = 1;
+	}
+	if(hook_unbound_supports_ssl_upstream(svr->cfg)) {
+		/* probe for SSL wrapped service to avoid deepstuff */
+		svr->probe_dnstcp = 1;
+		probe_spawn_ssldns();
+		done = 1;
+	}
+	if(!done) {
+		verbose(VERB_OPS, "unbound does not support "
+			"tcp-upstream and ssl-upstream, but "
+			"these features are needed now. "
+			"Please upgrade unbound");
+		return 0;
+	}
+	/* the other resolvers in the race start a little later */
+	probe_race_timer_set(svr);
+	/* false if failed to create the probes (outofmemory?) */
+	return (svr->num_probes != nump);
+}
+
+/** set the timer to start the next probe stage early */
+static void
+probe_stage_timer_set(struct svr* svr)
+{
+	struct timeval tv;
+	int d = svr->cfg->probe_stage_delay;
+	if(d <= 0)
+		return;
+	tv.tv_sec = d/1000;
+	tv.tv_usec = (d%1000)*1000;
+	comm_timer_set(svr->stage_timer, &tv);
+}
+
+/** start the next probe stage if nothing works yet.  The current stage
+ * continues, and if it works it is preferred. */
+static void
+probe_stage_next(struct svr* svr)
+{
+	comm_timer_disable(svr->stage_timer);
+	svr->stage_wait_http = 0;
+	if(svr->forced_insecure || svr->saw_first_working ||
+		svr->saw_direct_work || svr->saw_dnstcp_work)
+		return;
+	if(svr->http && !svr->http->saw_http_work && !svr->skip_http) {
+		/* do not probe past the cache unless http works,
+		 * continue when the http probe works */
+		svr->stage_wait_http = 1;
+		return;
+	}
+	if(!svr->probe_direct) {
+		verbose(VERB_ALGO, "start authority probes early");
+		svr->probe_direct = 1;
+		if(probe_spawn_direct()) {
+			probe_stage_timer_set(svr);
+			return;
+		}
+	}
+	if(!svr->probe_dnstcp) {
+		verbose(VERB_ALGO, "start tcp and ssl probes early");
+		(void)probe_spawn_tcp_stage(svr);
+	}
+}
+
+void probe_stage_timeout(void* arg)
+{
+	struct svr* svr = (struct svr*)arg;
+	probe_stage_next(svr);
+}
+
 /** true if no packets were received during the probe: network seems down */
 static int
 got_no_packets(struct svr* svr)
@@ -1451,6 +2550,9 @@ void
 probe_all_done(void)
 {
 	struct svr* svr = global_svr;
+	uint32_t* secs;
+	struct timeval* now;
+	int msec;
 	if(verbosity >= VERB_DETAIL) {
 		struct probe_ip* p;
 		for(p=svr->probes; p; p=p->next) {
@@ -1468,6 +2570,9 @@ probe_all_done(void)
 				p->works?"OK":"error", p->reason?p->reason:"");
 		}
 	}
+	comm_timer_disable(svr->stage_timer);
+	comm_timer_disable(svr->race_timer);
+	svr->stage_wait_http = 0;
 	/* reset skip http once it works */
 	if(svr->skip_http && svr->http && svr->http->saw_http_work)
 		svr->skip_http = 0;
@@ -1476,16 +2581,19 @@ probe_all_done(void)
 		verbose(VERB_OPS, "probe done: but still forced insecure");
 		/* call it again, in case DHCP changes while hotspot-signon */
 		probe_setup_hotspot_signon(svr);
-	} else if(svr->probe_dnstcp && svr->saw_dnstcp_work) {
+	} else if(!svr->saw_first_working && svr->probe_direct &&
+		svr->saw_direct_work) {
+		/* set unbound to process directly, the earlier stage is
+		 * preferred if tcp also works */
+		verbose(VERB_OPS, "probe done: DNSSEC to auth direct");
+		probe_setup_auth(svr);
+	} else if(!svr->saw_first_working && svr->probe_dnstcp &&
+		svr->saw_dnstcp_work) {
 		/* set unbound to process over tcp */
 		verbose(VERB_OPS, "probe done: DNSSEC to tcp or ssl resolver");
 		probe_setup_dnstcp(svr);
-	} else if(svr->probe_direct && svr->saw_direct_work) {
-		/* set unbound to process directly */
-		verbose(VERB_OPS, "probe done: DNSSEC to auth direct");
-		probe_setup_auth(svr);
-	} else if(svr->probe_direct && !svr->saw_direct_work &&
-		!svr->saw_dnstcp_work) {
+	} else if(!svr->saw_first_working && svr->probe_direct &&
+		!svr->saw_direct_work && !svr->saw_dnstcp_work) {
 		/* if there are no cache IPs, then there is nothing else
 		 * we can do, we are in offline mode, most likely. No DHCP,
 		 * no network connectivity */
@@ -1507,7 +2615,29 @@ probe_all_done(void)
 		verbose(VERB_OPS, "probe done: DNSSEC to cache");
 		probe_setup_cache(svr, NULL);
 	}
+	comm_base_timept(svr->base, &secs, &now);
+	msec = (int)(now->tv_sec - svr->probe_start_tv.tv_sec)*1000 +
+		(int)(now->tv_usec - svr->probe_start_tv.tv_usec)/1000;
+	verbose(VERB_OPS, "probe took %d msec, %d queries, %d resent",
+		msec, svr->probe_queries, svr->probe_resent);
+	timeline_add(svr->timeline, "decision %s at=%d queries=%d "
+		"resent=%d%s%s",
+		svr->res_state==res_cache?"cache":(
+		svr->res_state==res_tcp?"tcp":(
+		svr->res_state==res_ssl?"ssl":(
+		svr->res_state==res_auth?"auth":(
+		svr->res_state==res_disconn?"disconnected":"nodnssec")))),
+		msec, svr->probe_queries, svr->probe_resent,
+		svr->forced_insecure?" forced_insecure":"",
+		svr->http_insecure?" http_insecure":"");
+	timeline_decided(svr->timeline);
+	stats_decision(svr->stats, (int)svr->res_state, msec);
+	stats_write(svr);
+	if(!svr->forced_insecure)
+		probe_store_netstate(svr);
 	svr->probetime = time(0);
+	health_start(svr->health, svr);
+	ednsize_start(svr->ednsize, svr);
 	svr_send_results(svr);
 	svr_check_update(svr);
 }
@@ -41,6 +41,7 @@
 
 #ifndef PROBE_H
 #define PROBE_H
+#include "rbtree.h"
 struct comm_point;
 struct comm_reply;
 struct http_get;
@@ -67,8 +68,10 @@ struct probe_ip {
 	int http_ip6;
 	/* destination port */
 	int port;
+	/* EDNS buffer size that the queries advertise, 0 for the default */
+	int udp_size;
 
-	/* the ssl context (if any) for this destination address */
+	/* the ssl context (if any) of the ssl443 server, a reference */
 	void* sslctx;
 
 	/* DS query, or NULL if done */
@@ -93,10 +96,30 @@ struct probe_ip {
 	char* reason;
 	/* if a packet has been received by a query (i.e. network is up) */
 	int got_packet;
+	/* when the probe was started */
+	struct timeval start;
+	/* msec that the probe took, when finished */
+	int msec;
+};
+
+/** times of the events of a query, from the event base, zero if the
+ * event did not happen */
+struct outq_times {
+	struct timeval created;
+	struct timeval sent; /* first send */
+	struct timeval resent; /* last UDP retransmit */
+	int sends; /* number of UDP sends */
+	struct timeval tc; /* reply with TC flag, it switched to TCP */
+	struct timeval connected; /* TCP connect done */
+	struct timeval handshake; /* SSL handshake done */
+	struct timeval done; /* reply or failure */
 };
 
 /** outstanding query */
 struct outq {
+	/* node in the tree of outstanding UDP queries, by qid and addr,
+	 * key is NULL if not in the tree */
+	rbnode_t node;
 	struct sockaddr_storage addr;
 	socklen_t addrlen;
 	uint16_t qid;
@@ -104,25 +127,78 @@ struct outq {
 	int recurse; /* if true: recursive probe */
 	const char* qname; /* reference to a static string */
 	int timeout; /* in msec */
+	int waited; /* msec spent in UDP timeouts */
+	int resent; /* if the UDP query was retransmitted */
+	struct timeval sendtime; /* when the UDP query was sent */
 	int on_tcp; /* if we are using TCP */
 	int on_ssl; /* if we are using SSL */
 	int port; /* port number (mostly 53) */
 	int edns; /* if edns yes */
 	int cdflag; /* if CD flag on query */
-	struct comm_point* c;
+	struct probe_conn* conn; /* TCP connection, NULL for UDP */
+	struct outq* conn_next; /* next query on the TCP connection */
+	const char* conn_err; /* reason if the TCP connection failed */
 	struct comm_timer* timer;
 	struct probe_ip* probe; /* reference only to owner */
+	struct outq_times times; /* for the timeline */
+};
+
+/**
+ * Stream (TCP or SSL) connection to a server, shared by the queries to
+ * that server.  The queries are written after each other, the replies
+ * can come back in any order and are matched by qid.
+ */
+struct probe_conn {
+	struct probe_conn* next; /* in the list of the svr */
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	int on_ssl; /* if we are using SSL */
+	void* sslctx; /* reference to ssl context of the probe */
+	struct comm_point* c;
+	/* timer to handle replies that are in the SSL buffer already */
+	struct comm_timer* timer;
+	struct outq* queries; /* queries on this connection, by conn_next */
+	int replied; /* if a reply was read, no queries can join then */
 };
 
-#define QUERY_START_TIMEOUT 100 /* msec */
-#define QUERY_END_TIMEOUT 1000 /* msec */
+/** wire format query, built once, the qid and flags are patched in */
+struct probe_tmpl {
+	struct probe_tmpl* next;
+	char* qname; /* the query name */
+	uint16_t qtype;
+	int edns; /* if edns with DO flag */
+	size_t len; /* length of wire */
+	uint8_t* wire; /* query in wire format */
+	size_t opt_class; /* position of the EDNS size in wire, or 0 */
+};
+
+/* max number of query templates kept, the list is emptied when full */
+#define PROBE_TMPL_MAX 64
+
+#define QUERY_END_TIMEOUT 3000 /* msec, total wait for UDP reply */
 #define QUERY_TCP_TIMEOUT 3000 /* msec */
+#define QUERY_TIMER_SLACK 10 /* msec the query timeout may be late */
+/* msec between the starts of the raced tcp80, tcp443, ssl443 resolvers */
+#define PROBE_RACE_STAGGER 200
+/* percentage of authority probes that go to a random root server, so
+ * that the latency of the other root servers is measured too */
+#define PROBE_ROOT_EXPLORE 10
+/* seconds a probe result is recent, a submit of the same servers
+ * does not probe again */
+#define PROBE_FRESH_TIME 60
 
 /** start the probe process for a new set of IPs.
  * in a string, with whitespace in between
  * the string may be altered. */
 void probe_start(char* ips);
 
+/** submit of the IPs for a network.  If the IPs are the same as those
+ * that are being probed, or were probed recently, nothing is done.
+ * If some are the same, the changed IPs and the ones that failed are
+ * probed, otherwise, or after a disconnect, probe_start is used.
+ * The string may be altered. */
+void probe_submit(char* ips);
+
 /** delete and stop probe */
 void probe_delete(struct probe_ip* p);
 
@@ -135,9 +211,25 @@ int outq_handle_udp(struct comm_point* c, void* my_arg, int error,
 int outq_handle_tcp(struct comm_point* c, void* my_arg, int error,
         struct comm_reply *reply_info);
 
+/** timeout handler that starts the next probe stage, arg is svr */
+void probe_stage_timeout(void* arg);
+
+/** timeout handler that starts the next raced tcp resolvers, arg is svr */
+void probe_race_timeout(void* arg);
+
 /** outstanding query UDP timeout handler */
 void outq_timeout(void* arg);
 
+/** handle the replies that wait in the SSL buffer, arg is probe_conn */
+void probe_conn_pending(void* arg);
+
+/** compare outstanding queries by qid and address, for the rbtree */
+int outq_cmp(const void* a, const void* b);
+
+/** close the shared UDP sockets, if no queries use them, so the next
+ * queries get new random source ports */
+void outq_udp_reopen(struct svr* svr);
+
 void probe_cache_done(void);
 void probe_all_done(void);
 void probe_unsafe_test(void);
@@ -148,6 +240,9 @@ void probe_setup_cache(struct svr* svr, struct probe_ip* p);
 void probe_setup_hotspot_signon(struct svr* svr);
 void probe_setup_dnstcp(struct svr* svr);
 
+/** delete the list of query templates */
+void probe_tmpl_list_delete(struct probe_tmpl* list);
+
 /** true if probe is a cache IP, a DNS server from the DHCP hook */
 int probe_is_cache(struct probe_ip* p);
 
@@ -45,6 +45,8 @@
 #include "log.h"
 #include "cfg.h"
 #include "probe.h"
+#include "svr.h"
+#include "cmdq.h"
 #ifdef USE_WINSOCK
 #include "winrc/win_svc.h"
 #endif
@@ -70,7 +72,7 @@ set_dns_osx(struct cfg* cfg, char* iplist)
 	snprintf(cmd, sizeof(cmd), "%s/dnssec-trigger-setdns.sh mset %s -- %s",
 		LIBEXEC_DIR, domains, iplist);
 	verbose(VERB_QUERY, "%s", cmd);
-	system(cmd);
+	cmdq_add_cmd(global_svr?global_svr->cmdq:NULL, cmd, NULL, NULL);
 }
 
 /** restore resolv.conf on OSX if localhost is enabled */
@@ -240,11 +242,56 @@ really_set_to_localhost(struct cfg* cfg) {
 }
 #endif /* no USE_WINSOCK, no OSX */
 
+#ifndef USE_WINSOCK
+/** write resolv.conf with the nameserver lines, returns false on failure */
+static int
+write_rescf(struct cfg* cfg, const char* lines)
+{
+	FILE* out = open_rescf(cfg);
+	if(!out) return 0;
+	/* write the nameserver records */
+	prline(out, lines);
+	close_rescf(cfg, out);
+	return 1;
+}
+
+/** set resolv.conf to localhost, runs in the command queue */
+static int
+resolv_localhost_run(void* arg, char* ATTR_UNUSED(data))
+{
+	struct cfg* cfg = (struct cfg*)arg;
+#  ifndef HOOKS_OSX /* on Linux/BSD */
+	if (system("/usr/libexec/dnssec-trigger-script --setup") == 0)
+		return 0;
+
+	if(really_set_to_localhost(cfg)) {
+		/* already done, do not do it again, that would open
+		 * a brief moment of mutable resolv.conf */
+		verbose(VERB_ALGO, "resolv.conf localhost already set");
+		return 0;
+	}
+	verbose(VERB_ALGO, "resolv.conf localhost write");
+#  endif
+	return !write_rescf(cfg, "nameserver 127.0.0.1\n");
+}
+
+/** set resolv.conf to the nameserver lines, runs in the command queue */
+static int
+resolv_iplist_run(void* arg, char* data)
+{
+	struct cfg* cfg = (struct cfg*)arg;
+#  ifndef HOOKS_OSX /* on Linux/BSD */
+	if (system("/usr/libexec/dnssec-trigger-script --restore") == 0)
+		return 0;
+	if(cfg->noaction)
+		return 0;
+#  endif
+	return !write_rescf(cfg, data);
+}
+#endif /* !USE_WINSOCK */
+
 void hook_resolv_localhost(struct cfg* cfg)
 {
-#ifndef USE_WINSOCK
-	FILE* out;
-#endif
 	set_to_localhost = 1;
 	if(cfg->noaction) {
 		return;
@@ -255,53 +302,30 @@ void hook_resolv_localhost(struct cfg* cfg)
 #ifdef USE_WINSOCK
 	win_set_resolv("127.0.0.1");
 #else /* not on windows */
-#  ifndef HOOKS_OSX /* on Linux/BSD */
-	if (system("/usr/libexec/dnssec-trigger-script --setup") == 0)
-		return;
-
-	if(really_set_to_localhost(cfg)) {
-		/* already done, do not do it again, that would open
-		 * a brief moment of mutable resolv.conf */
-		verbose(VERB_ALGO, "resolv.conf localhost already set");
-		return;
-	}
-	verbose(VERB_ALGO, "resolv.conf localhost write");
-#  endif
-	out = open_rescf(cfg);
-	if(!out) return;
-	/* write the nameserver records */
-	prline(out, "nameserver 127.0.0.1\n");
-	close_rescf(cfg, out);
+	/* in the command queue, after the unbound changes that are queued */
+	cmdq_add_run(global_svr?global_svr->cmdq:NULL, &resolv_localhost_run,
+		NULL, cfg, NULL);
 #endif /* not on windows */
 }
 
 void hook_resolv_iplist(struct cfg* cfg, struct probe_ip* list)
 {
 #ifndef USE_WINSOCK
-	char line[1024];
-	FILE* out;
+	char lines[10240];
+	lines[0] = 0;
 #endif
 #if defined(HOOKS_OSX) || defined(USE_WINSOCK)
 	char iplist[10240];
 	iplist[0] = 0;
-#else
-	if (system("/usr/libexec/dnssec-trigger-script --restore") == 0)
-		return;
-#endif
-	set_to_localhost = 0;
-	if(cfg->noaction)
-		return;
-#ifndef USE_WINSOCK
-	out = open_rescf(cfg);
-	if(!out) return;
 #endif
-	/* write the nameserver records */
+	/* the nameserver records, the list can change before the
+	 * command queue writes them */
 	while(list) {
 		if(probe_is_cache(list)) {
 #ifndef USE_WINSOCK
-			snprintf(line, sizeof(line), "nameserver %s\n",
-				list->name);
-			prline(out, line);
+			snprintf(lines+strlen(lines),
+				sizeof(lines)-strlen(lines),
+				"nameserver %s\n", list->name);
 #endif
 #if defined(HOOKS_OSX) || defined(USE_WINSOCK)
 			snprintf(iplist+strlen(iplist),
@@ -311,15 +335,24 @@ void hook_resolv_iplist(struct cfg* cfg, struct probe_ip* list)
 		}
 		list = list->next;
 	}
-#ifndef USE_WINSOCK
-	close_rescf(cfg, out);
-#endif
-#ifdef HOOKS_OSX
-	set_dns_osx(cfg, iplist);
-#endif
+	set_to_localhost = 0;
 #ifdef USE_WINSOCK
+	if(cfg->noaction)
+		return;
 	win_set_resolv(iplist);
-#endif
+#else /* not on windows */
+#  ifdef HOOKS_OSX
+	if(cfg->noaction)
+		return;
+#  endif
+	/* in the command queue, after the unbound changes that are queued,
+	 * on Linux/BSD the restore script is tried before noaction */
+	cmdq_add_run(global_svr?global_svr->cmdq:NULL, &resolv_iplist_run,
+		NULL, cfg, lines);
+#  ifdef HOOKS_OSX
+	set_dns_osx(cfg, iplist);
+#  endif
+#endif /* not on windows */
 }
 
 void hook_resolv_flush(struct cfg* cfg)
@@ -329,10 +362,14 @@ void hook_resolv_flush(struct cfg* cfg)
 	(void)cfg;
 #ifdef HOOKS_OSX
 	/* dscacheutil on 10.5 an later, lookupd before that */
-	system("dscacheutil -flushcache || lookupd -flushcache || discoveryutil udnsflushcaches");
-	system("discoveryutil mdnsflushcache");
+	cmdq_add_cmd(global_svr?global_svr->cmdq:NULL, "dscacheutil "
+		"-flushcache || lookupd -flushcache || discoveryutil "
+		"udnsflushcaches", NULL, NULL);
+	cmdq_add_cmd(global_svr?global_svr->cmdq:NULL,
+		"discoveryutil mdnsflushcache", NULL, NULL);
 #elif defined(USE_WINSOCK)
-	win_run_cmd("ipconfig /flushdns");
+	cmdq_add_cmd(global_svr?global_svr->cmdq:NULL, "ipconfig /flushdns",
+		NULL, NULL);
 #else
 	/* TODO */
 #endif
@@ -0,0 +1,164 @@
+/*
+ * resume.c - dnssec-trigger detection of resume from suspend
+ *
+ * Copyright (c) 2011, NLnet Labs. All rights reserved.
+ *
+ * This software is open source.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the NLNET LABS nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file
+ *
+ * This file contains the detection of a resume from suspend.  The clock
+ * is also set by the user or by ntp, then the boot time clock does not
+ * move away from the monotonic clock, and nothing is done.
+ */
+#include "config.h"
+#include "resume.h"
+#include "svr.h"
+#include "log.h"
+#include "netevent.h"
+#ifdef HAVE_SYS_TIMERFD_H
+#include <sys/timerfd.h>
+#endif
+
+#if defined(HAVE_TIMERFD_CREATE) && defined(HAVE_SYS_TIMERFD_H) && \
+	defined(TFD_TIMER_CANCEL_ON_SET) && defined(CLOCK_BOOTTIME)
+/** the timerfd and the boot time clock can be used */
+#define USE_RESUME_TIMERFD 1
+#endif
+
+/** msec the system was suspended since boot, the boot time clock is ahead
+ * of the monotonic clock by that much, 0 if not known */
+static long long
+resume_slept(void)
+{
+#ifdef USE_RESUME_TIMERFD
+	struct timespec boot, mono;
+	if(clock_gettime(CLOCK_BOOTTIME, &boot) < 0 ||
+		clock_gettime(CLOCK_MONOTONIC, &mono) < 0)
+		return 0;
+	return ((long long)boot.tv_sec - (long long)mono.tv_sec)*1000 +
+		((long long)boot.tv_nsec - (long long)mono.tv_nsec)/1000000;
+#else
+	return 0;
+#endif
+}
+
+#ifdef USE_RESUME_TIMERFD
+/** set the timerfd far in the future, it is cancelled when the clock is
+ * set, before that time */
+static int
+resume_arm(int fd)
+{
+	struct itimerspec its;
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = time(NULL) + RESUME_FAR;
+	if(timerfd_settime(fd, TFD_TIMER_ABSTIME|TFD_TIMER_CANCEL_ON_SET,
+		&its, NULL) == -1) {
+		log_err("timerfd_settime: %s", strerror(errno));
+		return 0;
+	}
+	return 1;
+}
+#endif
+
+struct resume* resume_create(struct svr* svr)
+{
+	struct resume* r = (struct resume*)calloc(1, sizeof(*r));
+	if(!r) {
+		log_err("out of memory");
+		return NULL;
+	}
+	r->svr = svr;
+	r->fd = -1;
+	r->slept = resume_slept();
+#ifdef USE_RESUME_TIMERFD
+	r->fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK|TFD_CLOEXEC);
+	if(r->fd == -1) {
+		/* the timers work, only the resume is not seen */
+		verbose(VERB_OPS, "timerfd_create: %s", strerror(errno));
+		return r;
+	}
+	if(!resume_arm(r->fd)) {
+		close(r->fd);
+		r->fd = -1;
+		return r;
+	}
+	r->c = comm_point_create_raw(svr->base, r->fd, 0, &resume_handle, r);
+	if(!r->c) {
+		log_err("out of memory");
+		close(r->fd);
+		free(r);
+		return NULL;
+	}
+#endif
+	return r;
+}
+
+void resume_delete(struct resume* r)
+{
+	if(!r) return;
+	/* this closes the fd */
+	if(r->c)
+		comm_point_delete(r->c);
+	else if(r->fd != -1)
+		close(r->fd);
+	free(r);
+}
+
+int resume_handle(struct comm_point* ATTR_UNUSED(c), void* arg,
+	int ATTR_UNUSED(err), struct comm_reply* ATTR_UNUSED(reply_info))
+{
+	struct resume* r = (struct resume*)arg;
+	long long slept, gap;
+#ifdef USE_RESUME_TIMERFD
+	uint64_t num;
+	/* it fails with ECANCELED, because the clock was set */
+	if(read(r->fd, &num, sizeof(num)) == -1 && errno != ECANCELED &&
+		errno != EAGAIN && errno != EINTR)
+		log_err("read timerfd: %s", strerror(errno));
+	if(!resume_arm(r->fd)) {
+		/* stop, or the fd stays readable */
+		comm_point_delete(r->c);
+		r->c = NULL;
+		r->fd = -1;
+	}
+#endif
+	slept = resume_slept();
+	gap = slept - r->slept;
+	r->slept = slept;
+	if(gap < RESUME_MIN_SLEEP) {
+		verbose(VERB_ALGO, "the system clock was set");
+		return 0;
+	}
+	svr_resume(r->svr, (int)(gap/1000));
+	return 0;
+}
@@ -0,0 +1,90 @@
+/*
+ * resume.h - dnssec-trigger detection of resume from suspend
+ *
+ * Copyright (c) 2011, NLnet Labs. All rights reserved.
+ *
+ * This software is open source.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the NLNET LABS nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file
+ *
+ * This file contains the detection of a resume from suspend.  The timers
+ * use the monotonic clock, that stops while the system is suspended, so
+ * they are not late after a resume, but the network may have changed.  A
+ * timerfd on the realtime clock is cancelled when the clock is set, and a
+ * resume sets it.  Then the growth of the difference between the boot time
+ * clock and the monotonic clock tells if the system was suspended, and the
+ * network is probed again.
+ */
+
+#ifndef RESUME_H
+#define RESUME_H
+struct svr;
+struct comm_point;
+struct comm_reply;
+
+/** msec of suspend after which the network is probed again */
+#define RESUME_MIN_SLEEP 1000
+/** seconds in the future that the timerfd is set to */
+#define RESUME_FAR (365*24*3600)
+
+/**
+ * Detection of resume from suspend.
+ */
+struct resume {
+	/** the server */
+	struct svr* svr;
+	/** the timerfd, or -1 if not available */
+	int fd;
+	/** the comm point for the timerfd, or NULL */
+	struct comm_point* c;
+	/** msec the system was suspended since boot, when last seen */
+	long long slept;
+};
+
+/**
+ * Create the resume detection, without timerfd it does nothing.
+ * @param svr: the server.
+ * @return new structure or NULL on alloc failure.
+ */
+struct resume* resume_create(struct svr* svr);
+
+/**
+ * Delete the resume detection.
+ * @param r: the structure to delete.
+ */
+void resume_delete(struct resume* r);
+
+/** handle the timerfd, the clock was set or the system resumed */
+int resume_handle(struct comm_point* c, void* arg, int err,
+	struct comm_reply* reply_info);
+
+#endif /* RESUME_H */
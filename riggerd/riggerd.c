@@ -42,6 +42,9 @@
 #include "cfg.h"
 #include "svr.h"
 #include "reshook.h"
+#include "ubhook.h"
+#include "cmdq.h"
+#include "netstate.h"
 #include "netevent.h"
 #ifdef HAVE_GETOPT_H
 #include <getopt.h>
@@ -267,6 +270,7 @@ do_main_work(const char* cfgfile, int nodaemonize, int verb)
 	/* TODO: check if already localhost and if so do not provide a small
 	 * window of opportunity here */
 	hook_resolv_localhost(cfg);
+	hook_unbound_check_options(cfg);
 #ifdef USE_WINSOCK
 	netlist_start(svr);
 #endif
@@ -281,10 +285,24 @@ do_main_work(const char* cfgfile, int nodaemonize, int verb)
 			verbose(VERB_OPS, "%s reload", PACKAGE_STRING);
 			if(!(c2 = cfg_create(cfgfile)))
 				log_err("could not reload config");
-			else {
+			else if(!cfg_setup_ssl443(c2)) {
+				log_err("could not reload config");
+				cfg_delete(c2);
+			} else {
+				/* the queued commands use the old config */
+				cmdq_flush(svr->cmdq);
+				hook_unbound_cleanup();
+				if(strcmp(cfg->state_file, c2->state_file)
+					!= 0) {
+					/* the known networks of the new file */
+					netstate_list_delete(svr->netstates);
+					svr->netstates = netstate_read(
+						c2->state_file);
+				}
+				svr_reload(svr, c2);
 				cfg_delete(cfg);
 				cfg = c2;
-				svr->cfg = cfg;
+				hook_unbound_check_options(cfg);
 			}
 			/* reopen log after HUP to facilitate log rotation */
 			if(!cfg->use_syslog)
@@ -301,6 +319,7 @@ do_main_work(const char* cfgfile, int nodaemonize, int verb)
 	unlink_pid(cfg->pidfile);
 	log_info("%s stop", PACKAGE_STRING);
 	svr_delete(svr);
+	hook_unbound_cleanup();
 	cfg_delete(cfg);
 }
 
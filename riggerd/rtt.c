@@ -0,0 +1,184 @@
+/*
+ * rtt.c - dnssec-trigger round trip time estimates for servers
+ *
+ * Copyright (c) 2011, NLnet Labs. All rights reserved.
+ *
+ * This software is open source.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the NLNET LABS nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file
+ *
+ * This file contains the round trip time estimates for the servers that
+ * are probed.  The smoothed rtt and the variance are computed as in
+ * RFC 6298, with the timeout at srtt + 4*rttvar.  Timeouts double the
+ * retransmit timeout, so a slow link gets longer timeouts next round.
+ */
+#include "config.h"
+#include "rtt.h"
+#include "log.h"
+#include "net_help.h"
+
+int rtt_cmp(const void* a, const void* b)
+{
+	struct rtt_info* x = (struct rtt_info*)a;
+	struct rtt_info* y = (struct rtt_info*)b;
+	return sockaddr_cmp(&x->addr, x->addrlen, &y->addr, y->addrlen);
+}
+
+/** clamp the timeout between min and max */
+static int
+rtt_clamp(int rto)
+{
+	if(rto < RTT_MIN_TIMEOUT)
+		return RTT_MIN_TIMEOUT;
+	if(rto > RTT_MAX_TIMEOUT)
+		return RTT_MAX_TIMEOUT;
+	return rto;
+}
+
+/** set the entry to the state for an unknown server */
+static void
+rtt_init(struct rtt_info* r, time_t now)
+{
+	r->srtt = 0;
+	r->rttvar = 0;
+	r->rto = RTT_UNKNOWN_TIMEOUT;
+	r->measured = 0;
+	r->last = now;
+}
+
+/** find the entry for the server, and if create, make it if needed */
+static struct rtt_info*
+rtt_lookup(struct rbtree_t* rtts, struct sockaddr_storage* addr,
+	socklen_t addrlen, time_t now, int create)
+{
+	struct rtt_info key, *r;
+	memset(&key, 0, sizeof(key));
+	memmove(&key.addr, addr, addrlen);
+	key.addrlen = addrlen;
+	r = (struct rtt_info*)rbtree_search(rtts, &key);
+	if(r) {
+		/* the estimate is old, the network may have changed */
+		if(now - r->last > RTT_TTL || now < r->last)
+			rtt_init(r, now);
+		return r;
+	}
+	if(!create || rtts->count >= RTT_MAX_SERVERS)
+		return NULL;
+	r = (struct rtt_info*)calloc(1, sizeof(*r));
+	if(!r) {
+		log_err("out of memory");
+		return NULL;
+	}
+	memmove(&r->addr, addr, addrlen);
+	r->addrlen = addrlen;
+	rtt_init(r, now);
+	r->node.key = r;
+	(void)rbtree_insert(rtts, &r->node);
+	return r;
+}
+
+int rtt_timeout(struct rbtree_t* rtts, struct sockaddr_storage* addr,
+	socklen_t addrlen, time_t now)
+{
+	struct rtt_info* r = rtt_lookup(rtts, addr, addrlen, now, 0);
+	if(!r)
+		return RTT_UNKNOWN_TIMEOUT;
+	return r->rto;
+}
+
+int rtt_known(struct rbtree_t* rtts, struct sockaddr_storage* addr,
+	socklen_t addrlen, time_t now)
+{
+	struct rtt_info* r = rtt_lookup(rtts, addr, addrlen, now, 0);
+	if(!r)
+		return 0;
+	return r->measured || r->rto != RTT_UNKNOWN_TIMEOUT;
+}
+
+void rtt_update(struct rbtree_t* rtts, struct sockaddr_storage* addr,
+	socklen_t addrlen, int ms, time_t now)
+{
+	struct rtt_info* r = rtt_lookup(rtts, addr, addrlen, now, 1);
+	int delta;
+	if(!r)
+		return;
+	if(ms < 0)
+		ms = 0;
+	if(!r->measured) {
+		r->srtt = ms;
+		r->rttvar = ms/2;
+		r->measured = 1;
+	} else {
+		delta = ms - r->srtt;
+		r->srtt += delta/8;
+		if(delta < 0)
+			delta = -delta;
+		r->rttvar += (delta - r->rttvar)/4;
+	}
+	r->rto = rtt_clamp(r->srtt + 4*r->rttvar);
+	r->last = now;
+	if(verbosity >= VERB_ALGO) {
+		char buf[128];
+		addr_to_str(addr, addrlen, buf, sizeof(buf));
+		verbose(VERB_ALGO, "rtt %s: %d msec, srtt %d rttvar %d "
+			"rto %d", buf, ms, r->srtt, r->rttvar, r->rto);
+	}
+}
+
+void rtt_lost(struct rbtree_t* rtts, struct sockaddr_storage* addr,
+	socklen_t addrlen, int timeout, time_t now)
+{
+	struct rtt_info* r = rtt_lookup(rtts, addr, addrlen, now, 1);
+	if(!r)
+		return;
+	/* back off, from the timeout that was used, that can be
+	 * larger than the rto if the query was retransmitted before */
+	if(timeout < r->rto)
+		timeout = r->rto;
+	r->rto = rtt_clamp(timeout*2);
+	r->last = now;
+}
+
+/** delete an rtt_info in the tree */
+static void
+rtt_del_node(rbnode_t* n, void* ATTR_UNUSED(arg))
+{
+	free(n);
+}
+
+void rtt_delete(struct rbtree_t* rtts)
+{
+	if(!rtts)
+		return;
+	traverse_postorder(rtts, &rtt_del_node, NULL);
+	free(rtts);
+}
@@ -0,0 +1,136 @@
+/*
+ * rtt.h - dnssec-trigger round trip time estimates for servers
+ *
+ * Copyright (c) 2011, NLnet Labs. All rights reserved.
+ *
+ * This software is open source.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the NLNET LABS nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file
+ *
+ * This file contains the round trip time estimates for the servers that
+ * are probed.  They set the UDP retransmission timeout, and are kept
+ * across probe rounds, like the infra cache in unbound.
+ */
+
+#ifndef RTT_H
+#define RTT_H
+#include "rbtree.h"
+
+/** min retransmit timeout, msec */
+#define RTT_MIN_TIMEOUT 50
+/** max retransmit timeout, msec */
+#define RTT_MAX_TIMEOUT 2000
+/** timeout for a server without an estimate, msec (as unbound) */
+#define RTT_UNKNOWN_TIMEOUT 376
+/** seconds an estimate is kept since its last update */
+#define RTT_TTL 900
+/** max number of servers with an estimate */
+#define RTT_MAX_SERVERS 1024
+
+/**
+ * Round trip time estimate for a server address.
+ */
+struct rtt_info {
+	/** node in the tree, key is this struct */
+	rbnode_t node;
+	/** the server address, with port */
+	struct sockaddr_storage addr;
+	/** length of addr */
+	socklen_t addrlen;
+	/** smoothed round trip time, msec */
+	int srtt;
+	/** round trip time variance, msec */
+	int rttvar;
+	/** retransmit timeout, msec */
+	int rto;
+	/** if srtt and rttvar have been measured */
+	int measured;
+	/** time of the last update */
+	time_t last;
+};
+
+/** compare rtt_info by addr, for the tree */
+int rtt_cmp(const void* a, const void* b);
+
+/**
+ * Get the timeout for the first query to the server.
+ * @param rtts: tree of struct rtt_info.
+ * @param addr: the server.
+ * @param addrlen: length of addr.
+ * @param now: the current time.
+ * @return timeout in msec.
+ */
+int rtt_timeout(struct rbtree_t* rtts, struct sockaddr_storage* addr,
+	socklen_t addrlen, time_t now);
+
+/**
+ * See if there is a recent estimate for the server, from a reply or from
+ * a timeout.  The timeout of a server that is not known is a guess.
+ * @param rtts: tree of struct rtt_info.
+ * @param addr: the server.
+ * @param addrlen: length of addr.
+ * @param now: the current time.
+ * @return true if known.
+ */
+int rtt_known(struct rbtree_t* rtts, struct sockaddr_storage* addr,
+	socklen_t addrlen, time_t now);
+
+/**
+ * Update the estimate with a measured round trip time.  Do not use for
+ * replies to a retransmitted query, those cannot be timed (Karn).
+ * @param rtts: tree of struct rtt_info.
+ * @param addr: the server.
+ * @param addrlen: length of addr.
+ * @param ms: measured round trip, msec.
+ * @param now: the current time.
+ */
+void rtt_update(struct rbtree_t* rtts, struct sockaddr_storage* addr,
+	socklen_t addrlen, int ms, time_t now);
+
+/**
+ * Note a timeout, the retransmit timeout backs off.
+ * @param rtts: tree of struct rtt_info.
+ * @param addr: the server.
+ * @param addrlen: length of addr.
+ * @param timeout: the timeout that passed, msec.
+ * @param now: the current time.
+ */
+void rtt_lost(struct rbtree_t* rtts, struct sockaddr_storage* addr,
+	socklen_t addrlen, int timeout, time_t now);
+
+/**
+ * Delete the tree with the estimates.
+ * @param rtts: tree of struct rtt_info, it is freed.
+ */
+void rtt_delete(struct rbtree_t* rtts);
+
+#endif /* RTT_H */
@@ -0,0 +1,354 @@
+/*
+ * stats.c - dnssec-trigger runtime statistics
+ *
+ * Copyright (c) 2011, NLnet Labs. All rights reserved.
+ *
+ * This software is open source.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the NLNET LABS nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file
+ *
+ * This file contains the runtime statistics.  The counters are plain
+ * increments where the events happen; the work of formatting is only
+ * done when they are printed.  The stats-file is written like the state
+ * file, to a temporary file that is renamed, so that a reader, such as
+ * the node exporter textfile collector, does not see a partial file.
+ */
+#include "config.h"
+#include "stats.h"
+#include "svr.h"
+#include "cfg.h"
+#include "log.h"
+#include "health.h"
+#include "ednsize.h"
+#include "netevent.h"
+#include "netstate.h"
+#include <ldns/ldns.h>
+
+/** upper bounds of the histogram buckets in msec, the last bucket has
+ * no bound */
+static const int stats_bounds[STATS_HIST_BUCKETS-1] = { 10, 25, 50, 100,
+	250, 500, 1000, 2500, 5000, 10000, 30000 };
+
+/** names of the res_state values */
+static const char* stats_states[STATS_NUM_STATES] = { "auth", "cache",
+	"tcp", "ssl", "nodnssec", "disconnected" };
+
+/** the wakeups of the event loop since the reset, and per hour */
+static unsigned long long
+stats_wakeups(struct svr* svr, unsigned long long* per_hour)
+{
+	unsigned long long n = comm_base_wakeups(svr->base) -
+		svr->stats->wakeups_since;
+	time_t elapsed = time(NULL) - svr->stats->since;
+	*per_hour = elapsed > 0?n*3600/(unsigned long long)elapsed:n;
+	return n;
+}
+
+/** where the statistics are printed, the buffer or else the file */
+struct stats_out {
+	struct ldns_struct_buffer* buf;
+	FILE* file;
+};
+
+struct stats* stats_create(void)
+{
+	struct stats* st = (struct stats*)calloc(1, sizeof(*st));
+	if(!st) {
+		log_err("out of memory");
+		return NULL;
+	}
+	st->last_state = -1;
+	st->since = time(NULL);
+	return st;
+}
+
+void stats_delete(struct stats* st)
+{
+	free(st);
+}
+
+void stats_clear(struct stats* st, time_t now)
+{
+	int last = st->last_state;
+	memset(st, 0, sizeof(*st));
+	st->last_state = last;
+	st->since = now;
+}
+
+void stats_hist_add(struct stats_hist* h, int msec)
+{
+	int i;
+	if(msec < 0)
+		msec = 0;
+	for(i = 0; i < STATS_HIST_BUCKETS-1; i++) {
+		if(msec <= stats_bounds[i])
+			break;
+	}
+	h->count[i]++;
+	h->num++;
+	h->sum += (unsigned)msec;
+}
+
+void stats_decision(struct stats* st, int state, int msec)
+{
+	if(state < 0 || state >= STATS_NUM_STATES)
+		return;
+	st->num_decision[state]++;
+	if(state != st->last_state)
+		st->num_change[state]++;
+	st->last_state = state;
+	stats_hist_add(&st->decision, msec);
+}
+
+/** print a line of the statistics */
+static void
+stats_out(struct stats_out* o, const char* format, ...)
+	ATTR_FORMAT(printf, 2, 3);
+
+static void
+stats_out(struct stats_out* o, const char* format, ...)
+{
+	char line[1024];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(line, sizeof(line), format, args);
+	va_end(args);
+	if(o->buf)
+		ldns_buffer_printf(o->buf, "%s", line);
+	else	fputs(line, o->file);
+}
+
+/** print a histogram as name.<bound>=count lines, not cumulative */
+static void
+stats_print_hist(struct stats_out* o, const char* name,
+	struct stats_hist* h)
+{
+	int i;
+	for(i = 0; i < STATS_HIST_BUCKETS-1; i++)
+		stats_out(o, "%s.msec.%d=%u\n", name, stats_bounds[i],
+			h->count[i]);
+	stats_out(o, "%s.msec.inf=%u\n", name, h->count[i]);
+	stats_out(o, "%s.num=%u\n", name, h->num);
+	stats_out(o, "%s.sum=%llu\n", name, h->sum);
+}
+
+void stats_print(struct svr* svr, struct ldns_struct_buffer* buf)
+{
+	struct stats* st = svr->stats;
+	struct stats_out o;
+	unsigned long long wakeups, per_hour;
+	int i;
+	o.buf = buf;
+	o.file = NULL;
+	stats_out(&o, "time.since=%lld\n", (long long)st->since);
+	stats_out(&o, "time.elapsed=%lld\n", (long long)(time(NULL) -
+		st->since));
+	stats_out(&o, "state=%s\n", st->last_state == -1?"none":
+		stats_states[st->last_state]);
+	stats_out(&o, "probe.rounds=%u\n", st->num_rounds);
+	for(i = 0; i < STATS_NUM_STATES; i++)
+		stats_out(&o, "decision.%s=%u\n", stats_states[i],
+			st->num_decision[i]);
+	for(i = 0; i < STATS_NUM_STATES; i++)
+		stats_out(&o, "change.%s=%u\n", stats_states[i],
+			st->num_change[i]);
+	stats_out(&o, "query.sent=%u\n", st->num_queries);
+	stats_out(&o, "query.resent=%u\n", st->num_resent);
+	stats_out(&o, "query.timeout=%u\n", st->num_timeouts);
+	stats_out(&o, "query.tc=%u\n", st->num_tc);
+	stats_out(&o, "resume=%u\n", st->num_resume);
+	stats_out(&o, "hook.runs=%u\n", st->num_hooks);
+	stats_out(&o, "hook.failed=%u\n", st->num_hook_fail);
+	stats_out(&o, "hook.msec=%llu\n", st->hook_msec);
+	stats_out(&o, "prewarm.runs=%u\n", st->num_prewarm);
+	stats_out(&o, "prewarm.queries=%u\n", st->num_prewarm_queries);
+	stats_out(&o, "prewarm.failed=%u\n", st->num_prewarm_fail);
+	stats_out(&o, "prewarm.msec=%llu\n", st->prewarm_msec);
+	stats_out(&o, "prewarm.last_msec=%u\n", st->last_prewarm_msec);
+	stats_out(&o, "edns.size=%d\n", svr->ednsize->size);
+	stats_out(&o, "submit.merged=%u\n", svr->num_submit_merged);
+	stats_out(&o, "health.reprobe=%u\n", svr->health->num_reprobe);
+	stats_out(&o, "health.rate=%d\n", health_rate(svr->health));
+	stats_out(&o, "health.msec=%d\n", health_latency(svr->health));
+	wakeups = stats_wakeups(svr, &per_hour);
+	stats_out(&o, "wakeups=%llu\n", wakeups);
+	stats_out(&o, "wakeups.per_hour=%llu\n", per_hour);
+	stats_print_hist(&o, "rtt", &st->rtt);
+	stats_print_hist(&o, "decision", &st->decision);
+}
+
+/** print a prometheus metric header */
+static void
+stats_prom_head(struct stats_out* o, const char* name, const char* type,
+	const char* help)
+{
+	stats_out(o, "# HELP dnssec_trigger_%s %s\n", name, help);
+	stats_out(o, "# TYPE dnssec_trigger_%s %s\n", name, type);
+}
+
+/** print a prometheus metric without labels */
+static void
+stats_prom(struct stats_out* o, const char* name, const char* type,
+	const char* help, unsigned long long value)
+{
+	stats_prom_head(o, name, type, help);
+	stats_out(o, "dnssec_trigger_%s %llu\n", name, value);
+}
+
+/** print a prometheus metric per res_state */
+static void
+stats_prom_states(struct stats_out* o, const char* name, const char* type,
+	const char* help, unsigned* values)
+{
+	int i;
+	stats_prom_head(o, name, type, help);
+	for(i = 0; i < STATS_NUM_STATES; i++)
+		stats_out(o, "dnssec_trigger_%s{state=\"%s\"} %u\n", name,
+			stats_states[i], values[i]);
+}
+
+/** print a prometheus histogram, the buckets are cumulative, in seconds */
+static void
+stats_prom_hist(struct stats_out* o, const char* name, const char* help,
+	struct stats_hist* h)
+{
+	int i;
+	unsigned n = 0;
+	stats_prom_head(o, name, "histogram", help);
+	for(i = 0; i < STATS_HIST_BUCKETS-1; i++) {
+		n += h->count[i];
+		stats_out(o, "dnssec_trigger_%s_bucket{le=\"%g\"} %u\n", name,
+			(double)stats_bounds[i]/1000., n);
+	}
+	stats_out(o, "dnssec_trigger_%s_bucket{le=\"+Inf\"} %u\n", name,
+		h->num);
+	stats_out(o, "dnssec_trigger_%s_sum %.3f\n", name,
+		(double)h->sum/1000.);
+	stats_out(o, "dnssec_trigger_%s_count %u\n", name, h->num);
+}
+
+/** print the statistics in the prometheus text format */
+static void
+stats_print_prom(struct svr* svr, struct stats_out* o)
+{
+	struct stats* st = svr->stats;
+	unsigned cur[STATS_NUM_STATES];
+	unsigned long long wakeups, per_hour;
+	int i;
+	for(i = 0; i < STATS_NUM_STATES; i++)
+		cur[i] = (i == st->last_state);
+	stats_prom(o, "stats_reset_time_seconds", "gauge",
+		"Time the statistics were reset.", (unsigned long long)
+		st->since);
+	stats_prom_states(o, "state", "gauge", "The probe result in use.",
+		cur);
+	stats_prom(o, "probe_rounds_total", "counter",
+		"Probe rounds started.", st->num_rounds);
+	stats_prom_states(o, "decisions_total", "counter",
+		"Probe decisions per result.", st->num_decision);
+	stats_prom_states(o, "state_changes_total", "counter",
+		"Changes into the result.", st->num_change);
+	stats_prom(o, "queries_total", "counter",
+		"Queries sent, without retransmits.", st->num_queries);
+	stats_prom(o, "query_retransmits_total", "counter",
+		"UDP query retransmits.", st->num_resent);
+	stats_prom(o, "query_timeouts_total", "counter",
+		"Query timeouts.", st->num_timeouts);
+	stats_prom(o, "query_tc_fallbacks_total", "counter",
+		"Replies with TC flag that switched to TCP.", st->num_tc);
+	stats_prom(o, "resumes_total", "counter",
+		"Resumes from suspend, that probed again.", st->num_resume);
+	stats_prom(o, "hooks_total", "counter",
+		"Hooks for unbound and resolv.conf that ran.", st->num_hooks);
+	stats_prom(o, "hook_failures_total", "counter",
+		"Hooks that failed.", st->num_hook_fail);
+	stats_prom_head(o, "hook_seconds_total", "counter",
+		"Time the hooks ran.");
+	stats_out(o, "dnssec_trigger_hook_seconds_total %.3f\n",
+		(double)st->hook_msec/1000.);
+	stats_prom(o, "prewarms_total", "counter",
+		"Pre-warms of the unbound cache.", st->num_prewarm);
+	stats_prom(o, "prewarm_queries_total", "counter",
+		"Pre-warm queries sent to unbound.", st->num_prewarm_queries);
+	stats_prom(o, "prewarm_failures_total", "counter",
+		"Pre-warm queries that failed.", st->num_prewarm_fail);
+	stats_prom_head(o, "prewarm_seconds_total", "counter",
+		"Time the pre-warms took.");
+	stats_out(o, "dnssec_trigger_prewarm_seconds_total %.3f\n",
+		(double)st->prewarm_msec/1000.);
+	stats_prom_head(o, "prewarm_last_seconds", "gauge",
+		"Time the last pre-warm took.");
+	stats_out(o, "dnssec_trigger_prewarm_last_seconds %.3f\n",
+		(double)st->last_prewarm_msec/1000.);
+	stats_prom(o, "edns_buffer_size_bytes", "gauge",
+		"EDNS buffer size that works on the path, 0 if not known.",
+		(unsigned long long)svr->ednsize->size);
+	stats_prom(o, "submits_merged_total", "counter",
+		"Submit and reprobe commands merged into another.",
+		svr->num_submit_merged);
+	stats_prom(o, "health_reprobes_total", "counter",
+		"Reprobes after failed health checks.",
+		svr->health->num_reprobe);
+	stats_prom_head(o, "health_success_ratio", "gauge",
+		"Health checks that worked, in the window.");
+	stats_out(o, "dnssec_trigger_health_success_ratio %.2f\n",
+		(double)health_rate(svr->health)/100.);
+	stats_prom_head(o, "health_latency_seconds", "gauge",
+		"Average time of the health checks that worked.");
+	stats_out(o, "dnssec_trigger_health_latency_seconds %.3f\n",
+		(double)health_latency(svr->health)/1000.);
+	wakeups = stats_wakeups(svr, &per_hour);
+	stats_prom(o, "wakeups_total", "counter",
+		"Wakeups of the event loop.", wakeups);
+	stats_prom(o, "wakeups_per_hour", "gauge",
+		"Wakeups of the event loop per hour, since the reset.",
+		per_hour);
+	stats_prom_hist(o, "query_rtt_seconds",
+		"Round trip time of UDP queries.", &st->rtt);
+	stats_prom_hist(o, "decision_seconds",
+		"Time from the start of the probe to the decision.",
+		&st->decision);
+}
+
+void stats_write(struct svr* svr)
+{
+	char tmp[1024];
+	const char* file = svr->cfg->stats_file;
+	struct stats_out o;
+	if(!file || !file[0])
+		return;
+	o.buf = NULL;
+	if(!(o.file = netstate_tmp_open(file, tmp, sizeof(tmp))))
+		return;
+	stats_print_prom(svr, &o);
+	netstate_tmp_commit(o.file, tmp, file);
+}
@@ -0,0 +1,160 @@
+/*
+ * stats.h - dnssec-trigger runtime statistics
+ *
+ * Copyright (c) 2011, NLnet Labs. All rights reserved.
+ *
+ * This software is open source.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the NLNET LABS nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file
+ *
+ * This file contains the runtime statistics, counters and histograms of
+ * the probes, the queries and the hooks.  They are printed by the stats
+ * command, and written to a file in the Prometheus text format.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+struct svr;
+struct ldns_struct_buffer;
+
+/** number of buckets in a histogram */
+#define STATS_HIST_BUCKETS 12
+/** number of probe results, the res_state values */
+#define STATS_NUM_STATES 6
+
+/**
+ * Histogram of times in msec, with fixed buckets.
+ */
+struct stats_hist {
+	/** the number in each bucket, see stats.c for the bounds */
+	unsigned count[STATS_HIST_BUCKETS];
+	/** the total number */
+	unsigned num;
+	/** sum of the msec */
+	unsigned long long sum;
+};
+
+/**
+ * The statistics, the counters are incremented in place.
+ */
+struct stats {
+	/** time the statistics were reset */
+	time_t since;
+	/** wakeups of the event loop at the reset */
+	unsigned long long wakeups_since;
+	/** number of probe rounds started */
+	unsigned num_rounds;
+	/** number of probe decisions, per res_state */
+	unsigned num_decision[STATS_NUM_STATES];
+	/** number of changes into the res_state */
+	unsigned num_change[STATS_NUM_STATES];
+	/** the res_state of the last decision, -1 if none */
+	int last_state;
+	/** number of queries sent, not counting retransmits */
+	unsigned num_queries;
+	/** number of UDP retransmits */
+	unsigned num_resent;
+	/** number of query timeouts */
+	unsigned num_timeouts;
+	/** number of replies with TC flag, that switched to TCP */
+	unsigned num_tc;
+	/** number of resumes from suspend */
+	unsigned num_resume;
+	/** number of hooks that ran */
+	unsigned num_hooks;
+	/** number of hooks that failed */
+	unsigned num_hook_fail;
+	/** msec the hooks ran */
+	unsigned long long hook_msec;
+	/** number of pre-warms of the unbound cache that are done */
+	unsigned num_prewarm;
+	/** number of pre-warm queries, and the ones that failed */
+	unsigned num_prewarm_queries, num_prewarm_fail;
+	/** msec the pre-warms took */
+	unsigned long long prewarm_msec;
+	/** msec the last pre-warm took */
+	unsigned last_prewarm_msec;
+	/** round trip times of the UDP queries */
+	struct stats_hist rtt;
+	/** time from the start of the probe to the decision */
+	struct stats_hist decision;
+};
+
+/**
+ * Create the statistics.
+ * @return new statistics or NULL on alloc failure.
+ */
+struct stats* stats_create(void);
+
+/**
+ * Delete the statistics.
+ * @param st: the statistics to delete.
+ */
+void stats_delete(struct stats* st);
+
+/**
+ * Set the statistics to zero.
+ * @param st: the statistics.
+ * @param now: the time of the reset.
+ */
+void stats_clear(struct stats* st, time_t now);
+
+/**
+ * Add a time to a histogram.
+ * @param h: the histogram.
+ * @param msec: the time.
+ */
+void stats_hist_add(struct stats_hist* h, int msec);
+
+/**
+ * Note the decision of a probe round.
+ * @param st: the statistics.
+ * @param state: the res_state.
+ * @param msec: the time the probe took.
+ */
+void stats_decision(struct stats* st, int state, int msec);
+
+/**
+ * Print the statistics for the stats command, name=value lines.
+ * @param svr: the server with the statistics.
+ * @param buf: the buffer to print to.
+ */
+void stats_print(struct svr* svr, struct ldns_struct_buffer* buf);
+
+/**
+ * Write the statistics to the stats-file, in the Prometheus text format,
+ * if the file is configured.
+ * @param svr: the server with the statistics.
+ */
+void stats_write(struct svr* svr);
+
+#endif /* STATS_H */
@@ -48,6 +48,15 @@
 #include "net_help.h"
 #include "reshook.h"
 #include "update.h"
+#include "cmdq.h"
+#include "rtt.h"
+#include "netstate.h"
+#include "health.h"
+#include "timeline.h"
+#include "stats.h"
+#include "prewarm.h"
+#include "ednsize.h"
+#include "resume.h"
 #ifdef USE_WINSOCK
 #include "winsock_event.h"
 #endif
@@ -64,6 +73,8 @@ static void sslconn_shutdown(struct sslconn* sc);
 static void sslconn_command(struct sslconn* sc);
 static void sslconn_persist_command(struct sslconn* sc);
 static void send_results_to_con(struct svr* svr, struct sslconn* s);
+static void svr_hook_report(void* arg, const char* desc,
+	struct timeval* queued, struct timeval* start, int status);
 
 struct svr* svr_create(struct cfg* cfg)
 {
@@ -85,14 +96,77 @@ struct svr* svr_create(struct cfg* cfg)
 		svr_delete(svr);
 		return NULL;
 	}
+	svr->outqs = rbtree_create(&outq_cmp);
+	if(!svr->outqs) {
+		log_err("out of memory");
+		svr_delete(svr);
+		return NULL;
+	}
+	svr->rtts = rbtree_create(&rtt_cmp);
+	if(!svr->rtts) {
+		log_err("out of memory");
+		svr_delete(svr);
+		return NULL;
+	}
+	if(!cfg_setup_ssl443(cfg)) {
+		svr_delete(svr);
+		return NULL;
+	}
+	/* results for known networks, also after a restart */
+	svr->netstates = netstate_read(cfg->state_file);
+	svr->cmdq = cmdq_create(svr->base);
+	if(!svr->cmdq) {
+		log_err("out of memory");
+		svr_delete(svr);
+		return NULL;
+	}
+	svr->timeline = timeline_create();
+	if(!svr->timeline) {
+		svr_delete(svr);
+		return NULL;
+	}
+	svr->stats = stats_create();
+	if(!svr->stats) {
+		svr_delete(svr);
+		return NULL;
+	}
+	svr->cmdq->report = &svr_hook_report;
+	svr->cmdq->report_arg = svr;
 	svr->retry_timer = comm_timer_create(svr->base, &svr_retry_callback,
 		svr);
 	svr->tcp_timer = comm_timer_create(svr->base, &svr_tcp_callback, svr);
-	if(!svr->retry_timer || !svr->tcp_timer) {
+	svr->stage_timer = comm_timer_create(svr->base, &probe_stage_timeout,
+		svr);
+	svr->submit_timer = comm_timer_create(svr->base, &svr_submit_callback,
+		svr);
+	svr->race_timer = comm_timer_create(svr->base, &probe_race_timeout,
+		svr);
+	if(!svr->retry_timer || !svr->tcp_timer || !svr->stage_timer ||
+		!svr->submit_timer || !svr->race_timer) {
 		log_err("out of memory");
 		svr_delete(svr);
 		return NULL;
 	}
+	svr->health = health_create(svr);
+	if(!svr->health) {
+		svr_delete(svr);
+		return NULL;
+	}
+	svr->prewarm = prewarm_create();
+	if(!svr->prewarm) {
+		svr_delete(svr);
+		return NULL;
+	}
+	svr->ednsize = ednsize_create();
+	if(!svr->ednsize) {
+		svr_delete(svr);
+		return NULL;
+	}
+	svr->resume = resume_create(svr);
+	if(!svr->resume) {
+		svr_delete(svr);
+		return NULL;
+	}
 	if(cfg->check_updates) {
 		svr->update = selfupdate_create(svr, cfg);
 		if(!svr->update) {
@@ -102,6 +176,8 @@ struct svr* svr_create(struct cfg* cfg)
 		}
 	}
 
+	svr_timer_slack(svr);
+
 	/* setup SSL_CTX */
 	if(!setup_ssl_ctx(svr)) {
 		log_err("cannot setup SSL context");
@@ -118,10 +194,26 @@ struct svr* svr_create(struct cfg* cfg)
 	return svr;
 }
 
+void svr_timer_slack(struct svr* svr)
+{
+	int slack = svr->cfg->timer_slack;
+	comm_timer_set_slack(svr->retry_timer, slack);
+	comm_timer_set_slack(svr->tcp_timer, slack);
+	comm_timer_set_slack(svr->health->timer, slack);
+	if(svr->update)
+		comm_timer_set_slack(svr->update->timer, slack);
+}
+
 void svr_delete(struct svr* svr)
 {
 	struct listen_list* ll, *nll;
 	if(!svr) return;
+	/* no pre-warm when the queued commands are done */
+	if(svr->prewarm)
+		prewarm_stop(svr->prewarm);
+	/* perform the commands that are still queued */
+	cmdq_delete(svr->cmdq);
+	svr->cmdq = NULL;
 	/* delete busy */
 	while(svr->busy_list) {
 		(void)SSL_shutdown(svr->busy_list->ssl);
@@ -139,6 +231,10 @@ void svr_delete(struct svr* svr)
 
 	/* delete probes */
 	probe_list_delete(svr->probes);
+	health_delete(svr->health);
+	prewarm_delete(svr->prewarm);
+	ednsize_delete(svr->ednsize);
+	resume_delete(svr->resume);
 
 	if(svr->ctx) {
 		SSL_CTX_free(svr->ctx);
@@ -147,7 +243,20 @@ void svr_delete(struct svr* svr)
 	ldns_buffer_free(svr->udp_buffer);
 	comm_timer_delete(svr->retry_timer);
 	comm_timer_delete(svr->tcp_timer);
+	comm_timer_delete(svr->stage_timer);
+	comm_timer_delete(svr->submit_timer);
+	comm_timer_delete(svr->race_timer);
+	free(svr->submit_ips);
 	http_general_delete(svr->http);
+	comm_point_delete(svr->udp4);
+	comm_point_delete(svr->udp6);
+	free(svr->outqs);
+	rtt_delete(svr->rtts);
+	timeline_delete(svr->timeline);
+	stats_delete(svr->stats);
+	probe_tmpl_list_delete(svr->tmpls);
+	netstate_list_delete(svr->netstates);
+	free(svr->net_fp);
 	comm_base_delete(svr->base);
 	free(svr);
 }
@@ -720,14 +829,14 @@ static void persist_cmd_insecure(int val)
 	svr_send_results(svr);
 }
 
-void cmd_reprobe(void)
+/** print the IPs of the cache probes, with spaces in between */
+static void
+svr_cache_ips(struct svr* svr, char* buf, size_t left)
 {
-	char buf[10240];
 	char* now = buf;
-	size_t left = sizeof(buf);
 	struct probe_ip* p;
 	buf[0]=0; /* safe, robust */
-	for(p = global_svr->probes; p; p = p->next) {
+	for(p = svr->probes; p; p = p->next) {
 		if(probe_is_cache(p)) {
 			size_t len;
 			if(left < strlen(p->name)+3)
@@ -739,9 +848,92 @@ void cmd_reprobe(void)
 			now += len;
 		}
 	}
+}
+
+void cmd_reprobe(void)
+{
+	char buf[10240];
+	svr_cache_ips(global_svr, buf, sizeof(buf));
 	probe_start(buf);
 }
 
+void svr_reload(struct svr* svr, struct cfg* cfg)
+{
+	char buf[10240];
+	int reprobe = (svr->probes != NULL);
+	svr_cache_ips(svr, buf, sizeof(buf));
+	/* the probes, checks and their connections refer to the ssl443
+	 * servers and SSL contexts of the old config, stop them */
+	health_stop(svr->health);
+	prewarm_stop(svr->prewarm);
+	ednsize_stop(svr->ednsize);
+	svr->cfg = cfg;
+	svr_timer_slack(svr);
+	if(reprobe) {
+		/* deletes the old probes, and probes with the new config */
+		verbose(VERB_OPS, "config reloaded, probe again");
+		probe_start(buf);
+	}
+}
+
+void svr_submit_queue(struct svr* svr, char* ips)
+{
+	struct timeval tv;
+	if(svr->cfg->submit_delay <= 0) {
+		if(ips) probe_submit(ips);
+		else	cmd_reprobe();
+		return;
+	}
+	if(ips) {
+		char* s = strdup(ips);
+		if(!s) {
+			log_err("out of memory");
+			return;
+		}
+		free(svr->submit_ips);
+		svr->submit_ips = s;
+	} else {
+		svr->submit_reprobe = 1;
+	}
+	if(svr->submit_waiting++) {
+		svr->num_submit_merged++;
+		verbose(VERB_ALGO, "merged with waiting command (%u merged)",
+			svr->num_submit_merged);
+		return;
+	}
+	tv.tv_sec = svr->cfg->submit_delay/1000;
+	tv.tv_usec = (svr->cfg->submit_delay%1000)*1000;
+	comm_timer_set(svr->submit_timer, &tv);
+}
+
+void svr_submit_callback(void* arg)
+{
+	struct svr* svr = (struct svr*)arg;
+	char* ips = svr->submit_ips;
+	int reprobe = svr->submit_reprobe;
+	comm_timer_disable(svr->submit_timer);
+	svr->submit_ips = NULL;
+	svr->submit_reprobe = 0;
+	svr->submit_waiting = 0;
+	if(ips) {
+		/* a reprobe probes the servers again, also if unchanged */
+		if(reprobe) probe_start(ips);
+		else	probe_submit(ips);
+		free(ips);
+	} else if(reprobe) {
+		cmd_reprobe();
+	}
+}
+
+void svr_resume(struct svr* svr, int secs)
+{
+	verbose(VERB_OPS, "resume after %d seconds of suspend, probe again",
+		secs);
+	svr->stats->num_resume++;
+	/* the network may be different, or gone, after the suspend */
+	svr_submit_queue(svr, NULL);
+}
+
 static void handle_hotspot_signon_cmd(struct svr* svr)
 {
 	verbose(VERB_OPS, "state dark forced_insecure");
@@ -771,7 +963,7 @@ static void sslconn_persist_command(struct sslconn* sc)
 	} else if(strcmp(str, "reprobe") == 0) {
 		global_svr->forced_insecure = 0;
 		global_svr->http_insecure = 0;
-		cmd_reprobe();
+		svr_submit_queue(global_svr, NULL);
 	} else if(strcmp(str, "skip_http") == 0) {
 		handle_skip_http_cmd();
 	} else if(strcmp(str, "hotspot_signon") == 0) {
@@ -789,8 +981,8 @@ static void sslconn_persist_command(struct sslconn* sc)
 
 static void handle_submit(char* ips)
 {
-	/* start probing the servers */
-	probe_start(ips);
+	/* start probing the servers, that have changed */
+	svr_submit_queue(global_svr, ips);
 }
 
 /** append update signal to buffer to send */
@@ -926,6 +1118,64 @@ static void handle_cmdtray_cmd(struct sslconn* sc)
 	sc->line_state = persist_read;
 }
 
+/** add the hook that ran to the timeline and the statistics */
+static void svr_hook_report(void* arg, const char* desc,
+	struct timeval* queued, struct timeval* start, int status)
+{
+	struct svr* svr = (struct svr*)arg;
+	uint32_t* secs;
+	struct timeval* now;
+	comm_base_timept(svr->base, &secs, &now);
+	svr->stats->num_hooks++;
+	if(status != 0)
+		svr->stats->num_hook_fail++;
+	if(start->tv_sec != 0)
+		svr->stats->hook_msec += (unsigned long long)(
+			(now->tv_sec - start->tv_sec)*1000 +
+			(now->tv_usec - start->tv_usec)/1000);
+	timeline_add(svr->timeline, "hook queued=%d start=%d done=%d "
+		"status=%d %s", timeline_msec(svr->timeline, queued),
+		timeline_msec(svr->timeline, start),
+		timeline_msec(svr->timeline, now), status, desc?desc:"-");
+}
+
+static void handle_timings_cmd(struct sslconn* sc)
+{
+	struct strlist* s = timeline_lines(global_svr->timeline);
+	/* write and then close */
+	sc->close_me = 1;
+	comm_point_listen_for_rw(sc->c, 1, 1);
+	sc->line_state = persist_write;
+	ldns_buffer_clear(sc->buffer);
+	if(!s)
+		ldns_buffer_printf(sc->buffer, "none\n");
+	for(; s; s = s->next)
+		ldns_buffer_printf(sc->buffer, "%s\n", s->str);
+	ldns_buffer_flip(sc->buffer);
+}
+
+static void handle_stats_cmd(struct sslconn* sc, char* args)
+{
+	/* write and then close */
+	sc->close_me = 1;
+	comm_point_listen_for_rw(sc->c, 1, 1);
+	sc->line_state = persist_write;
+	ldns_buffer_clear(sc->buffer);
+	stats_print(global_svr, sc->buffer);
+	ldns_buffer_flip(sc->buffer);
+	while(*args == ' ')
+		args++;
+	if(strcmp(args, "reset") == 0) {
+		/* the counters start again, after they are printed */
+		stats_clear(global_svr->stats, time(NULL));
+		global_svr->stats->wakeups_since = comm_base_wakeups(
+			global_svr->base);
+		global_svr->num_submit_merged = 0;
+		global_svr->health->num_reprobe = 0;
+		stats_write(global_svr);
+	}
+}
+
 static void handle_unsafe_cmd(struct sslconn* sc)
 {
 	probe_unsafe_test();
@@ -1023,7 +1273,7 @@ static void sslconn_command(struct sslconn* sc)
 	} else if(strncmp(str, "reprobe", 7) == 0) {
 		global_svr->forced_insecure = 0;
 		global_svr->http_insecure = 0;
-		cmd_reprobe();
+		svr_submit_queue(global_svr, NULL);
 		sslconn_shutdown(sc);
 	} else if(strncmp(str, "skip_http", 9) == 0) {
 		handle_skip_http_cmd();
@@ -1037,6 +1287,10 @@ static void sslconn_command(struct sslconn* sc)
 		handle_status_cmd(sc);
 	} else if(strncmp(str, "cmdtray", 7) == 0) {
 		handle_cmdtray_cmd(sc);
+	} else if(strncmp(str, "stats", 5) == 0) {
+		handle_stats_cmd(sc, str+5);
+	} else if(strncmp(str, "timings", 7) == 0) {
+		handle_timings_cmd(sc);
 	} else if(strncmp(str, "unsafe", 6) == 0) {
 		handle_unsafe_cmd(sc);
 	} else if(strncmp(str, "test_tcp", 8) == 0) {
@@ -52,6 +52,16 @@ struct ldns_struct_buffer;
 struct probe_ip;
 struct http_general;
 struct selfupdate;
+struct cmdq;
+struct probe_tmpl;
+struct probe_conn;
+struct netstate;
+struct health;
+struct timeline;
+struct stats;
+struct prewarm;
+struct ednsize;
+struct resume;
 
 /**
  * The server
@@ -73,6 +83,31 @@ struct svr {
 
 	/** udp buffer */
 	struct ldns_struct_buffer* udp_buffer;
+	/** shared UDP commpoints for outgoing queries, ip4 and ip6,
+	 * or NULL if not open */
+	struct comm_point* udp4, *udp6;
+	/** tree of outstanding UDP queries, struct outq, by qid and addr */
+	struct rbtree_t* outqs;
+	/** TCP and SSL connections for outgoing queries, struct probe_conn */
+	struct probe_conn* conns;
+	/** round trip time estimates of servers, struct rtt_info, by addr */
+	struct rbtree_t* rtts;
+	/** query templates in wire format */
+	struct probe_tmpl* tmpls;
+	/** number of query templates */
+	int num_tmpls;
+	/** timer for submit and reprobe commands, they are merged */
+	struct comm_timer* submit_timer;
+	/** IPs of the last submit that waits, or NULL */
+	char* submit_ips;
+	/** if a reprobe waits */
+	int submit_reprobe;
+	/** number of submit and reprobe commands that wait */
+	int submit_waiting;
+	/** number of submit and reprobe commands merged into another one */
+	unsigned num_submit_merged;
+	/** queue of commands that change unbound and resolv.conf */
+	struct cmdq* cmdq;
 
 	/** probes for the IP addresses */
 	struct probe_ip* probes;
@@ -94,6 +129,40 @@ struct svr {
 	int probe_dnstcp;
 	/** time of probe */
 	time_t probetime;
+	/** time the probe was started */
+	struct timeval probe_start_tv;
+	/** timeline of the probe round, for the timings command */
+	struct timeline* timeline;
+	/** number of queries sent by the probe, and the number of UDP
+	 * retransmits of them */
+	int probe_queries, probe_resent;
+	/** fingerprint of the network that is probed, or NULL */
+	char* net_fp;
+	/** stored probe results per network */
+	struct netstate* netstates;
+	/** timer that starts the next probe stage before the current
+	 * stage is done */
+	struct comm_timer* stage_timer;
+	/** the next probe stage waits for the http probe to work */
+	int stage_wait_http;
+	/** timer for the staggered starts of the raced tcp resolvers */
+	struct comm_timer* race_timer;
+	/** number of resolvers started in the race, per group of tcp80,
+	 * tcp443, ssl443 and address family, see probe.c */
+	int race_started[6];
+	/** random start position in the resolver lists for the race */
+	unsigned race_start;
+
+	/** health checks of the upstream that is in use */
+	struct health* health;
+	/** runtime statistics, for the stats command and stats-file */
+	struct stats* stats;
+	/** pre-warm of the unbound cache after a change of upstream */
+	struct prewarm* prewarm;
+	/** discovery of the EDNS buffer size on the path to the upstream */
+	struct ednsize* ednsize;
+	/** detection of resume from suspend */
+	struct resume* resume;
 
 	/** probe retry timer */
 	struct comm_timer* retry_timer;
@@ -186,12 +255,24 @@ struct svr* svr_create(struct cfg* cfg);
 void svr_delete(struct svr* svr);
 /** perform the service */
 void svr_service(struct svr* svr);
+/** set the timer-slack of the config on the background timers */
+void svr_timer_slack(struct svr* svr);
+/** use the reloaded config, the probes that use the old one are deleted
+ * and the network is probed again.  The old config can be deleted then */
+void svr_reload(struct svr* svr, struct cfg* cfg);
 /** send results to clients */
 void svr_send_results(struct svr* svr);
 /** timeouts of retry timer */
 void svr_retry_callback(void* arg);
 /** timeouts of tcp timer */
 void svr_tcp_callback(void* arg);
+/** do a submit or reprobe, or wait and merge them, ips is NULL for
+ * a reprobe */
+void svr_submit_queue(struct svr* svr, char* ips);
+/** timeout of the submit timer, the merged commands are done */
+void svr_submit_callback(void* arg);
+/** the system resumed after secs of suspend, probe again */
+void svr_resume(struct svr* svr, int secs);
 
 /** start or enable next timeout on the retry timer */
 void svr_retry_timer_next(int http_mode);
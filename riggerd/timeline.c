@@ -0,0 +1,123 @@
+/*
+ * timeline.c - dnssec-trigger timeline of the probe round
+ *
+ * Copyright (c) 2011, NLnet Labs. All rights reserved.
+ *
+ * This software is open source.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the NLNET LABS nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file
+ *
+ * This file contains the timeline of the last probe round.  The lines are
+ * made when the events happen, so the timings command only prints them.
+ * The round before is kept until the new round has decided, so that the
+ * command does not show a round that is half done.
+ */
+#include "config.h"
+#include "timeline.h"
+#include "cfg.h"
+#include "log.h"
+#include <sys/time.h>
+
+struct timeline* timeline_create(void)
+{
+	struct timeline* tl = (struct timeline*)calloc(1, sizeof(*tl));
+	if(!tl) {
+		log_err("out of memory");
+		return NULL;
+	}
+	return tl;
+}
+
+void timeline_delete(struct timeline* tl)
+{
+	if(!tl)
+		return;
+	strlist_delete(tl->lines);
+	strlist_delete(tl->prev);
+	free(tl);
+}
+
+void timeline_start(struct timeline* tl, struct timeval* now)
+{
+	struct timeval wall;
+	/* a round that did not decide is not shown, the one before it is */
+	if(tl->decided) {
+		strlist_delete(tl->prev);
+		tl->prev = tl->lines;
+	} else {
+		strlist_delete(tl->lines);
+	}
+	tl->lines = NULL;
+	tl->lines_last = NULL;
+	tl->num = 0;
+	tl->decided = 0;
+	tl->start = *now;
+	/* now is from the monotonic clock, the start is shown as the time
+	 * of day */
+	if(gettimeofday(&wall, NULL) < 0)
+		wall = *now;
+	timeline_add(tl, "round start=%u.%6.6u", (unsigned)wall.tv_sec,
+		(unsigned)wall.tv_usec);
+}
+
+void timeline_decided(struct timeline* tl)
+{
+	tl->decided = 1;
+}
+
+int timeline_msec(struct timeline* tl, struct timeval* t)
+{
+	if(t->tv_sec == 0 && t->tv_usec == 0)
+		return -1;
+	return (int)(t->tv_sec - tl->start.tv_sec)*1000 +
+		(int)(t->tv_usec - tl->start.tv_usec)/1000;
+}
+
+void timeline_add(struct timeline* tl, const char* format, ...)
+{
+	char buf[1024];
+	va_list args;
+	if(tl->num >= TIMELINE_MAX)
+		return;
+	va_start(args, format);
+	vsnprintf(buf, sizeof(buf), format, args);
+	va_end(args);
+	strlist_append(&tl->lines, &tl->lines_last, buf);
+	tl->num++;
+}
+
+struct strlist* timeline_lines(struct timeline* tl)
+{
+	if(tl->decided)
+		return tl->lines;
+	return tl->prev;
+}
@@ -0,0 +1,117 @@
+/*
+ * timeline.h - dnssec-trigger timeline of the probe round
+ *
+ * Copyright (c) 2011, NLnet Labs. All rights reserved.
+ *
+ * This software is open source.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the NLNET LABS nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file
+ *
+ * This file contains the timeline of the last probe round, the queries,
+ * probes, the decision and the hooks that ran, with their times.  It is
+ * shown with the timings command, one event per line, as
+ * <event> <name> {<key>=<value>} [ok | error: <reason>].
+ * Times are msec since the start of the round, -1 if it did not happen.
+ */
+
+#ifndef TIMELINE_H
+#define TIMELINE_H
+struct strlist;
+
+/** max number of lines kept for a round */
+#define TIMELINE_MAX 512
+
+/**
+ * Timeline of the probe rounds.
+ */
+struct timeline {
+	/** lines of the current round */
+	struct strlist* lines, *lines_last;
+	/** number of lines of the current round */
+	int num;
+	/** lines of the round before the current one */
+	struct strlist* prev;
+	/** start of the current round */
+	struct timeval start;
+	/** if the current round has made its decision */
+	int decided;
+};
+
+/**
+ * Create the timeline.
+ * @return new timeline or NULL on alloc failure.
+ */
+struct timeline* timeline_create(void);
+
+/**
+ * Delete the timeline.
+ * @param tl: the timeline to delete.
+ */
+void timeline_delete(struct timeline* tl);
+
+/**
+ * Start a new round, the current round becomes the one before.
+ * @param tl: the timeline.
+ * @param now: the time the round starts.
+ */
+void timeline_start(struct timeline* tl, struct timeval* now);
+
+/**
+ * The current round has made its decision, it is the one shown.
+ * @param tl: the timeline.
+ */
+void timeline_decided(struct timeline* tl);
+
+/**
+ * Get the time in the round.
+ * @param tl: the timeline.
+ * @param t: the time, zero if it did not happen.
+ * @return msec since the start of the round, or -1 if t is zero.
+ */
+int timeline_msec(struct timeline* tl, struct timeval* t);
+
+/**
+ * Add a line to the current round.
+ * @param tl: the timeline.
+ * @param format: printf style format, without newline.
+ */
+void timeline_add(struct timeline* tl, const char* format, ...)
+	ATTR_FORMAT(printf, 2, 3);
+
+/**
+ * Get the lines of the last round that has made its decision.
+ * @param tl: the timeline.
+ * @return the list of lines, or NULL if none.
+ */
+struct strlist* timeline_lines(struct timeline* tl);
+
+#endif /* TIMELINE_H */
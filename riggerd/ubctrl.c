@@ -0,0 +1,749 @@
+/*
+ * ubctrl.c - dnssec-trigger native unbound remote control client
+ *
+ * Copyright (c) 2011, NLnet Labs. All rights reserved.
+ *
+ * This software is open source.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the NLNET LABS nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file
+ *
+ * This file contains a remote control client for unbound that runs inside
+ * the daemon.  Unbound closes the control connection after every command,
+ * so the client keeps the SSL context with the loaded keys and the SSL
+ * session, and the next connection resumes that session with a short
+ * handshake.  A local (unix) socket can be used instead of SSL.  The
+ * commands from the queue are performed in the background, with a
+ * nonblocking connection that is serviced by the event loop.
+ */
+#include "config.h"
+#include "ubctrl.h"
+#include "cfg.h"
+#include "log.h"
+#include "net_help.h"
+#include "netevent.h"
+#ifdef HAVE_OPENSSL_SSL_H
+#include <openssl/ssl.h>
+#endif
+#ifndef USE_WINSOCK
+#include <sys/un.h>
+#endif
+
+/** version of the unbound control protocol */
+#define UBCTRL_VERSION 1
+/** seconds that unbound has to answer, after that unbound-control is used */
+#define UBCTRL_TIMEOUT 5
+
+/** is the interface a local socket (pathname) */
+static int
+ubctrl_is_local(struct cfg* cfg)
+{
+	return cfg->unbound_control_interface &&
+		cfg->unbound_control_interface[0] == '/';
+}
+
+struct ubctrl* ubctrl_create(struct cfg* cfg)
+{
+	struct ubctrl* uc = (struct ubctrl*)calloc(1, sizeof(*uc));
+	if(!uc) {
+		log_err("out of memory");
+		return NULL;
+	}
+	uc->cfg = cfg;
+	if(ubctrl_is_local(cfg)) {
+#ifdef USE_WINSOCK
+		log_err("unbound-control-interface: local socket %s not "
+			"supported", cfg->unbound_control_interface);
+		free(uc);
+		return NULL;
+#else
+		return uc;
+#endif
+	}
+	uc->ctx = connect_sslctx_create(cfg->unbound_control_key_file,
+		cfg->unbound_control_cert_file, cfg->unbound_server_cert_file);
+	if(!uc->ctx) {
+		verbose(VERB_OPS, "cannot load unbound control keys, "
+			"using unbound-control instead");
+		free(uc);
+		return NULL;
+	}
+	return uc;
+}
+
+void ubctrl_delete(struct ubctrl* uc)
+{
+	if(!uc) return;
+	ubctrl_stop(uc);
+	if(uc->session)
+		SSL_SESSION_free((SSL_SESSION*)uc->session);
+	if(uc->ctx)
+		SSL_CTX_free((SSL_CTX*)uc->ctx);
+	free(uc);
+}
+
+/** close the socket */
+static void
+ubctrl_close(int fd)
+{
+#ifndef USE_WINSOCK
+	close(fd);
+#else
+	closesocket(fd);
+#endif
+}
+
+/** set the send and receive timeout on the socket, so a wedged unbound
+ * cannot hang the daemon */
+static void
+ubctrl_set_timeout(int fd)
+{
+#ifndef USE_WINSOCK
+	struct timeval tv;
+	tv.tv_sec = UBCTRL_TIMEOUT;
+	tv.tv_usec = 0;
+#else
+	DWORD tv = UBCTRL_TIMEOUT*1000;
+#endif
+	if(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (void*)&tv,
+		(socklen_t)sizeof(tv)) < 0)
+		log_err("setsockopt(.. SO_RCVTIMEO ..) failed: %s",
+			strerror(errno));
+	if(setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, (void*)&tv,
+		(socklen_t)sizeof(tv)) < 0)
+		log_err("setsockopt(.. SO_SNDTIMEO ..) failed: %s",
+			strerror(errno));
+}
+
+#ifndef USE_WINSOCK
+/** fill the address of the local socket, returns false on failure */
+static int
+ubctrl_local_addr(const char* path, struct sockaddr_un* addr)
+{
+	if(strlen(path) >= sizeof(addr->sun_path)) {
+		log_err("unbound-control-interface too long: %s", path);
+		return 0;
+	}
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	strncpy(addr->sun_path, path, sizeof(addr->sun_path)-1);
+	return 1;
+}
+
+/** connect to the local socket, or -1 */
+static int
+ubctrl_connect_local(const char* path)
+{
+	struct sockaddr_un addr;
+	int fd;
+	if(!ubctrl_local_addr(path, &addr))
+		return -1;
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd == -1) {
+		log_err("socket: %s", strerror(errno));
+		return -1;
+	}
+	/* the timeout also bounds the connect to a full listen queue */
+	ubctrl_set_timeout(fd);
+	if(connect(fd, (struct sockaddr*)&addr, (socklen_t)sizeof(addr)) < 0) {
+		verbose(VERB_ALGO, "connect %s: %s", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+#endif /* USE_WINSOCK */
+
+/** check the authenticity of the server after the handshake */
+static int
+ubctrl_ssl_verify(struct ubctrl* uc, SSL* ssl)
+{
+	X509* x;
+	if(SSL_get_verify_result(ssl) != X509_V_OK) {
+		log_err("unbound control SSL verification failed");
+		return 0;
+	}
+	x = SSL_get_peer_certificate(ssl);
+	if(!x) {
+		log_err("unbound control server presented no certificate");
+		return 0;
+	}
+	X509_free(x);
+	if(SSL_session_reused(ssl))
+		uc->num_resumed++;
+	return 1;
+}
+
+/** keep the session for the next connection, and close the SSL nicely,
+ * an SSL that is freed without shutdown cannot be resumed */
+static void
+ubctrl_ssl_close(struct ubctrl* uc, SSL* ssl)
+{
+	SSL_SESSION* sess = SSL_get1_session(ssl);
+	if(sess) {
+		if(uc->session)
+			SSL_SESSION_free((SSL_SESSION*)uc->session);
+		uc->session = sess;
+	}
+	(void)SSL_shutdown(ssl);
+}
+
+/** setup SSL on the connection, blocking, resumes the stored session.
+ * The socket has a timeout, so a want read or write means it expired. */
+static SSL*
+ubctrl_ssl_handshake(struct ubctrl* uc, int fd)
+{
+	SSL* ssl = (SSL*)outgoing_ssl_fd(uc->ctx, fd);
+	int r;
+	if(!ssl)
+		return NULL;
+	if(uc->session)
+		(void)SSL_set_session(ssl, (SSL_SESSION*)uc->session);
+	while(1) {
+		ERR_clear_error();
+		if( (r=SSL_do_handshake(ssl)) == 1)
+			break;
+		r = SSL_get_error(ssl, r);
+		if(r == SSL_ERROR_WANT_READ || r == SSL_ERROR_WANT_WRITE) {
+			verbose(VERB_OPS, "unbound control SSL handshake "
+				"timed out");
+			SSL_free(ssl);
+			return NULL;
+		}
+		if(r == SSL_ERROR_SYSCALL && errno == EINTR)
+			continue;
+		log_crypto_err("unbound control SSL handshake failed");
+		SSL_free(ssl);
+		return NULL;
+	}
+	if(!ubctrl_ssl_verify(uc, ssl)) {
+		SSL_free(ssl);
+		return NULL;
+	}
+	return ssl;
+}
+
+/** write to the connection, returns false on failure */
+static int
+ubctrl_write(SSL* ssl, int fd, const char* buf, size_t len)
+{
+	if(ssl) {
+		int r;
+		ERR_clear_error();
+		if((r=SSL_write(ssl, buf, (int)len)) <= 0) {
+			r = SSL_get_error(ssl, r);
+			if(r == SSL_ERROR_WANT_READ || r == SSL_ERROR_WANT_WRITE)
+				verbose(VERB_OPS, "unbound control: write "
+					"timed out");
+			else log_crypto_err("unbound control: could not "
+				"SSL_write");
+			return 0;
+		}
+		return 1;
+	}
+	while(len > 0) {
+		ssize_t r = send(fd, (void*)buf, len, 0);
+		if(r == -1) {
+			if(errno == EINTR)
+				continue;
+			if(errno == EAGAIN || errno == EWOULDBLOCK)
+				verbose(VERB_OPS, "unbound control: send "
+					"timed out");
+			else log_err("unbound control: send: %s",
+				strerror(errno));
+			return 0;
+		}
+		buf += r;
+		len -= (size_t)r;
+	}
+	return 1;
+}
+
+/** read from the connection, returns bytes read, 0 on EOF, -1 on failure */
+static int
+ubctrl_read(SSL* ssl, int fd, char* buf, size_t len)
+{
+	int r;
+	if(ssl) {
+		ERR_clear_error();
+		if((r = SSL_read(ssl, buf, (int)len)) <= 0) {
+			r = SSL_get_error(ssl, r);
+			if(r == SSL_ERROR_ZERO_RETURN)
+				return 0;
+			if(r == SSL_ERROR_WANT_READ || r == SSL_ERROR_WANT_WRITE)
+				verbose(VERB_OPS, "unbound control: read "
+					"timed out");
+			else log_crypto_err("unbound control: could not "
+				"SSL_read");
+			return -1;
+		}
+		return r;
+	}
+	while((r = (int)recv(fd, (void*)buf, len, 0)) == -1) {
+		if(errno == EINTR)
+			continue;
+		if(errno == EAGAIN || errno == EWOULDBLOCK)
+			verbose(VERB_OPS, "unbound control: recv timed out");
+		else log_err("unbound control: recv: %s", strerror(errno));
+		return -1;
+	}
+	return r;
+}
+
+/** create the command line that is sent to unbound, malloced, or NULL */
+static char*
+ubctrl_line(const char* cmd, const char* args)
+{
+	size_t linelen = strlen(cmd) + strlen(args) + 16;
+	char* line = (char*)malloc(linelen);
+	if(!line) {
+		log_err("out of memory");
+		return NULL;
+	}
+	snprintf(line, linelen, "UBCT%d %s%s%s\n", UBCTRL_VERSION, cmd,
+		args[0]?" ":"", args);
+	return line;
+}
+
+int ubctrl_cmd(struct ubctrl* uc, const char* cmd, const char* args,
+	char* reply, size_t replylen)
+{
+	char err[512];
+	char buf[1024];
+	char* line;
+	size_t got = 0;
+	SSL* ssl = NULL;
+	int fd, r, ret = 1;
+	time_t deadline;
+
+	/* contact unbound */
+	err[0] = 0;
+#ifndef USE_WINSOCK
+	if(ubctrl_is_local(uc->cfg))
+		fd = ubctrl_connect_local(uc->cfg->unbound_control_interface);
+	else
+#endif
+	fd = contact_server(uc->cfg->unbound_control_interface,
+		uc->cfg->unbound_control_port, 0, err, sizeof(err));
+	if(fd < 0) {
+		if(err[0])
+			verbose(VERB_ALGO, "unbound control: %s", err);
+		return -1;
+	}
+	ubctrl_set_timeout(fd);
+	deadline = time(NULL) + UBCTRL_TIMEOUT;
+	if(uc->ctx && !(ssl = ubctrl_ssl_handshake(uc, fd))) {
+		ubctrl_close(fd);
+		return -1;
+	}
+
+	/* send the command, in one write so it fits in one SSL record */
+	if(!(line = ubctrl_line(cmd, args))) {
+		if(ssl) SSL_free(ssl);
+		ubctrl_close(fd);
+		return -1;
+	}
+	verbose(VERB_ALGO, "unbound control %s %s", cmd, args);
+	if(!ubctrl_write(ssl, fd, line, strlen(line))) {
+		free(line);
+		if(ssl) SSL_free(ssl);
+		ubctrl_close(fd);
+		return -1;
+	}
+	free(line);
+	uc->num_cmds++;
+
+	/* read the reply until unbound closes the connection */
+	if(reply && replylen > 0)
+		reply[0] = 0;
+	while((r = ubctrl_read(ssl, fd, buf, sizeof(buf)-1)) > 0) {
+		buf[r] = 0;
+		if(got == 0 && strncmp(buf, "error", 5) == 0)
+			ret = 0;
+		if(reply && got+1 < replylen) {
+			size_t n = (size_t)r;
+			if(n > replylen-got-1)
+				n = replylen-got-1;
+			memmove(reply+got, buf, n);
+			reply[got+n] = 0;
+		}
+		got += (size_t)r;
+		/* a reply that trickles in must not hang the daemon */
+		if(time(NULL) > deadline) {
+			verbose(VERB_OPS, "unbound control: reply timed out");
+			r = -1;
+			break;
+		}
+	}
+	if(r == -1 && got == 0)
+		ret = -1;
+
+	if(ssl) {
+		if(ret != -1)
+			ubctrl_ssl_close(uc, ssl);
+		SSL_free(ssl);
+	}
+	ubctrl_close(fd);
+	return ret;
+}
+
+/** connect to unbound, nonblocking, returns the fd or -1 */
+static int
+ubctrl_connect_nb(struct ubctrl* uc)
+{
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	const char* svr = uc->cfg->unbound_control_interface;
+	int fd;
+#ifndef USE_WINSOCK
+	if(ubctrl_is_local(uc->cfg)) {
+		struct sockaddr_un* usock = (struct sockaddr_un*)&addr;
+		if(!ubctrl_local_addr(svr, usock))
+			return -1;
+		addrlen = (socklen_t)sizeof(*usock);
+	} else
+#endif
+	{
+		if(!svr)
+			svr = "127.0.0.1";
+		if(strchr(svr, '@')) {
+			if(!extstrtoaddr(svr, &addr, &addrlen)) {
+				log_err("could not parse IP: %s", svr);
+				return -1;
+			}
+		} else if(!ipstrtoaddr(svr, uc->cfg->unbound_control_port,
+			&addr, &addrlen)) {
+			log_err("could not parse IP: %s", svr);
+			return -1;
+		}
+	}
+	fd = socket((int)addr.ss_family, SOCK_STREAM, 0);
+	if(fd == -1) {
+		log_err("unbound control: socket: %s", strerror(errno));
+		return -1;
+	}
+	fd_set_nonblock(fd);
+	if(connect(fd, (struct sockaddr*)&addr, addrlen) == -1) {
+#ifdef EINPROGRESS
+		if(errno != EINPROGRESS) {
+#else
+		if(1) {
+#endif
+			verbose(VERB_ALGO, "unbound control: connect: %s",
+				strerror(errno));
+			ubctrl_close(fd);
+			return -1;
+		}
+	}
+	return fd;
+}
+
+void ubctrl_stop(struct ubctrl* uc)
+{
+	if(uc->ssl) {
+		SSL_free((SSL*)uc->ssl);
+		uc->ssl = NULL;
+	}
+	comm_point_delete(uc->c);
+	uc->c = NULL;
+	comm_timer_delete(uc->timer);
+	uc->timer = NULL;
+	free(uc->line);
+	uc->line = NULL;
+	uc->cb = NULL;
+	uc->cb_arg = NULL;
+}
+
+/** the command in the background is done, clean up and call back */
+static void
+ubctrl_finish(struct ubctrl* uc, int r)
+{
+	ubctrl_done_type* cb = uc->cb;
+	void* cb_arg = uc->cb_arg;
+	if(r == 0)
+		verbose(VERB_OPS, "unbound control: %s", uc->reply);
+	if(uc->ssl && r != -1)
+		ubctrl_ssl_close(uc, (SSL*)uc->ssl);
+	ubctrl_stop(uc);
+	if(cb)
+		(*cb)(cb_arg, r);
+}
+
+/** the nonblocking connect is done, returns true to go on */
+static int
+ubctrl_connected(struct ubctrl* uc)
+{
+	/* check for pending error from nonblocking connect */
+	int error = 0;
+	socklen_t len = (socklen_t)sizeof(error);
+	if(getsockopt(uc->c->fd, SOL_SOCKET, SO_ERROR, (void*)&error,
+		&len) < 0)
+		error = errno;
+#if defined(EINPROGRESS) && defined(EWOULDBLOCK)
+	if(error == EINPROGRESS || error == EWOULDBLOCK)
+		return 0; /* try again later */
+#endif
+	if(error != 0) {
+		verbose(VERB_ALGO, "unbound control: connect: %s",
+			strerror(error));
+		ubctrl_finish(uc, -1);
+		return 0;
+	}
+	if(uc->ctx) {
+		if(!(uc->ssl = outgoing_ssl_fd(uc->ctx, uc->c->fd))) {
+			ubctrl_finish(uc, -1);
+			return 0;
+		}
+		if(uc->session)
+			(void)SSL_set_session((SSL*)uc->ssl,
+				(SSL_SESSION*)uc->session);
+		uc->state = ubctrl_state_handshake;
+		return 1;
+	}
+	uc->state = ubctrl_state_write;
+	return 1;
+}
+
+/** wait for the SSL to be able to go on, returns false if it failed */
+static int
+ubctrl_ssl_want(struct ubctrl* uc, int r)
+{
+	if(r == SSL_ERROR_WANT_READ) {
+		comm_point_listen_for_rw(uc->c, 1, 0);
+		return 1;
+	} else if(r == SSL_ERROR_WANT_WRITE) {
+		comm_point_listen_for_rw(uc->c, 0, 1);
+		return 1;
+	}
+	return 0;
+}
+
+/** continue the SSL handshake, returns true to go on */
+static int
+ubctrl_handshake(struct ubctrl* uc)
+{
+	SSL* ssl = (SSL*)uc->ssl;
+	int r;
+	ERR_clear_error();
+	if((r=SSL_do_handshake(ssl)) != 1) {
+		if(ubctrl_ssl_want(uc, SSL_get_error(ssl, r)))
+			return 0;
+		log_crypto_err("unbound control SSL handshake failed");
+		ubctrl_finish(uc, -1);
+		return 0;
+	}
+	if(!ubctrl_ssl_verify(uc, ssl)) {
+		ubctrl_finish(uc, -1);
+		return 0;
+	}
+	uc->state = ubctrl_state_write;
+	comm_point_listen_for_rw(uc->c, 0, 1);
+	return 1;
+}
+
+/** write the command line, returns true to go on */
+static int
+ubctrl_write_line(struct ubctrl* uc)
+{
+	size_t len = strlen(uc->line);
+	if(uc->ssl) {
+		int r;
+		/* in one write so it fits in one SSL record */
+		ERR_clear_error();
+		if((r=SSL_write((SSL*)uc->ssl, uc->line, (int)len)) <= 0) {
+			if(ubctrl_ssl_want(uc, SSL_get_error((SSL*)uc->ssl,
+				r)))
+				return 0;
+			log_crypto_err("unbound control: could not SSL_write");
+			ubctrl_finish(uc, -1);
+			return 0;
+		}
+		uc->written = len;
+	} else {
+		ssize_t r = send(uc->c->fd, (void*)(uc->line+uc->written),
+			len-uc->written, 0);
+		if(r == -1) {
+			if(errno == EINTR || errno == EAGAIN ||
+				errno == EWOULDBLOCK)
+				return 0;
+			log_err("unbound control: send: %s", strerror(errno));
+			ubctrl_finish(uc, -1);
+			return 0;
+		}
+		uc->written += (size_t)r;
+		if(uc->written < len)
+			return 0;
+	}
+	uc->num_cmds++;
+	uc->state = ubctrl_state_read;
+	comm_point_listen_for_rw(uc->c, 1, 0);
+	return 1;
+}
+
+/** read the reply, returns true to go on */
+static int
+ubctrl_read_reply(struct ubctrl* uc)
+{
+	char buf[1024];
+	int r;
+	if(uc->ssl) {
+		SSL* ssl = (SSL*)uc->ssl;
+		ERR_clear_error();
+		if((r = SSL_read(ssl, buf, (int)sizeof(buf)-1)) <= 0) {
+			r = SSL_get_error(ssl, r);
+			if(r == SSL_ERROR_ZERO_RETURN) {
+				ubctrl_finish(uc, uc->ret);
+				return 0;
+			}
+			if(ubctrl_ssl_want(uc, r))
+				return 0;
+			if(uc->got == 0)
+				log_crypto_err("unbound control: could not "
+					"SSL_read");
+			ubctrl_finish(uc, uc->got?uc->ret:-1);
+			return 0;
+		}
+	} else {
+		r = (int)recv(uc->c->fd, (void*)buf, sizeof(buf)-1, 0);
+		if(r == -1) {
+			if(errno == EINTR || errno == EAGAIN ||
+				errno == EWOULDBLOCK)
+				return 0;
+			if(uc->got == 0)
+				log_err("unbound control: recv: %s",
+					strerror(errno));
+			ubctrl_finish(uc, uc->got?uc->ret:-1);
+			return 0;
+		}
+		if(r == 0) {
+			/* unbound closed the connection, the reply is done */
+			ubctrl_finish(uc, uc->ret);
+			return 0;
+		}
+	}
+	buf[r] = 0;
+	if(uc->got == 0 && strncmp(buf, "error", 5) == 0)
+		uc->ret = 0;
+	if(uc->got+1 < sizeof(uc->reply)) {
+		size_t n = (size_t)r;
+		if(n > sizeof(uc->reply)-uc->got-1)
+			n = sizeof(uc->reply)-uc->got-1;
+		memmove(uc->reply+uc->got, buf, n);
+		uc->reply[uc->got+n] = 0;
+	}
+	uc->got += (size_t)r;
+	return 1;
+}
+
+int ubctrl_handle(struct comm_point* ATTR_UNUSED(c), void* arg,
+	int err, struct comm_reply* ATTR_UNUSED(reply_info))
+{
+	struct ubctrl* uc = (struct ubctrl*)arg;
+	int go_on = 1;
+	if(err != NETEVENT_NOERROR) {
+		ubctrl_finish(uc, -1);
+		return 0;
+	}
+	/* the uc can be used for the next command once it is finished */
+	while(go_on) {
+		switch(uc->state) {
+		case ubctrl_state_connect:
+			go_on = ubctrl_connected(uc);
+			break;
+		case ubctrl_state_handshake:
+			go_on = ubctrl_handshake(uc);
+			break;
+		case ubctrl_state_write:
+			go_on = ubctrl_write_line(uc);
+			break;
+		case ubctrl_state_read:
+			go_on = ubctrl_read_reply(uc);
+			break;
+		default:
+			go_on = 0;
+		}
+	}
+	/* the return value is not used by comm_point_raw */
+	return 0;
+}
+
+void ubctrl_timeout(void* arg)
+{
+	struct ubctrl* uc = (struct ubctrl*)arg;
+	verbose(VERB_OPS, "unbound control: timed out");
+	ubctrl_finish(uc, -1);
+}
+
+int ubctrl_start(struct ubctrl* uc, struct comm_base* base, const char* cmd,
+	const char* args, ubctrl_done_type* cb, void* arg)
+{
+#ifdef USE_WINSOCK
+	/* the blocking client is used */
+	(void)uc; (void)base; (void)cmd; (void)args; (void)cb; (void)arg;
+	return 0;
+#else
+	struct timeval tv;
+	int fd;
+	log_assert(!uc->c);
+	if(!(uc->line = ubctrl_line(cmd, args)))
+		return 0;
+	if((fd = ubctrl_connect_nb(uc)) == -1) {
+		ubctrl_stop(uc);
+		return 0;
+	}
+	uc->c = comm_point_create_raw(base, fd, 1, &ubctrl_handle, uc);
+	if(!uc->c) {
+		log_err("out of memory");
+		ubctrl_close(fd);
+		ubctrl_stop(uc);
+		return 0;
+	}
+	uc->c->do_not_close = 0;
+	uc->timer = comm_timer_create(base, &ubctrl_timeout, uc);
+	if(!uc->timer) {
+		log_err("out of memory");
+		ubctrl_stop(uc);
+		return 0;
+	}
+	tv.tv_sec = UBCTRL_TIMEOUT;
+	tv.tv_usec = 0;
+	comm_timer_set(uc->timer, &tv);
+	uc->state = ubctrl_state_connect;
+	uc->written = 0;
+	uc->got = 0;
+	uc->reply[0] = 0;
+	uc->ret = 1;
+	uc->cb = cb;
+	uc->cb_arg = arg;
+	verbose(VERB_ALGO, "unbound control %s %s", cmd, args);
+	return 1;
+#endif
+}
@@ -0,0 +1,170 @@
+/*
+ * ubctrl.h - dnssec-trigger native unbound remote control client
+ *
+ * Copyright (c) 2011, NLnet Labs. All rights reserved.
+ *
+ * This software is open source.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the NLNET LABS nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file
+ *
+ * This file contains a remote control client for unbound that runs inside
+ * the daemon.  It speaks the unbound-control protocol itself, so that no
+ * shell and unbound-control process has to be started for every command.
+ * The commands run in the background with the event loop, so that the
+ * SSL session stays in the daemon for the next command.
+ */
+
+#ifndef UBCTRL_H
+#define UBCTRL_H
+struct cfg;
+struct comm_base;
+struct comm_point;
+struct comm_reply;
+struct comm_timer;
+
+/**
+ * Callback when a command in the background is done.
+ * @param arg: user argument.
+ * @param r: -1 if unbound could not be contacted, 0 if unbound returned
+ * 	an error for the command, 1 if the command went fine.
+ */
+typedef void ubctrl_done_type(void* arg, int r);
+
+/** state of the command in the background */
+enum ubctrl_state {
+	/** waiting for the connection to be set up */
+	ubctrl_state_connect,
+	/** busy with the SSL handshake */
+	ubctrl_state_handshake,
+	/** writing the command */
+	ubctrl_state_write,
+	/** reading the reply, until unbound closes the connection */
+	ubctrl_state_read
+};
+
+/**
+ * The native unbound control client.
+ */
+struct ubctrl {
+	/** the config with the interface, port and key files (reference) */
+	struct cfg* cfg;
+	/** SSL context with the keys loaded, or NULL for a local socket */
+	void* ctx;
+	/** session of the last SSL connection, for resumption (SSL_SESSION) */
+	void* session;
+	/** number of commands performed over the native client */
+	unsigned num_cmds;
+	/** number of SSL handshakes that resumed the session */
+	unsigned num_resumed;
+
+	/** commpoint of the command in the background, or NULL if none */
+	struct comm_point* c;
+	/** timeout of the command in the background */
+	struct comm_timer* timer;
+	/** SSL of the command in the background (SSL*), or NULL */
+	void* ssl;
+	/** state of the command in the background */
+	enum ubctrl_state state;
+	/** the command line that is sent, malloced */
+	char* line;
+	/** number of bytes of the line that are written */
+	size_t written;
+	/** the start of the reply, for the log, zero terminated */
+	char reply[1024];
+	/** number of bytes of the reply that are read */
+	size_t got;
+	/** the result so far, 0 if unbound replied with an error */
+	int ret;
+	/** callback when the command is done */
+	ubctrl_done_type* cb;
+	/** argument for the callback */
+	void* cb_arg;
+};
+
+/**
+ * Create the native unbound control client.  Loads the keys.
+ * @param cfg: the config options.
+ * @return new client or NULL on failure (logged), the caller can then
+ * 	use unbound-control itself.
+ */
+struct ubctrl* ubctrl_create(struct cfg* cfg);
+
+/**
+ * Delete the native unbound control client.
+ * @param uc: client to delete.
+ */
+void ubctrl_delete(struct ubctrl* uc);
+
+/**
+ * Perform a command at unbound, blocking, like unbound-control does.
+ * The connection times out after a couple of seconds, so that an unbound
+ * that hangs does not freeze the daemon; that returns -1.
+ * @param uc: the client.
+ * @param cmd: the command.
+ * @param args: the arguments, can be "".
+ * @param reply: the text that unbound replied is returned in here,
+ * 	truncated to fit.  Can be NULL.
+ * @param replylen: length of reply buffer.
+ * @return -1 if unbound could not be contacted, 0 if unbound returned
+ * 	an error for the command, 1 if the command went fine.
+ */
+int ubctrl_cmd(struct ubctrl* uc, const char* cmd, const char* args,
+	char* reply, size_t replylen);
+
+/**
+ * Start a command at unbound in the background, it is serviced by the
+ * event loop.  One command at a time.  An error reply is logged.
+ * @param uc: the client.
+ * @param base: the event base.
+ * @param cmd: the command.
+ * @param args: the arguments, can be "".
+ * @param cb: called when done, not from inside this function.
+ * @param arg: argument for the callback.
+ * @return false if it could not be started.
+ */
+int ubctrl_start(struct ubctrl* uc, struct comm_base* base, const char* cmd,
+	const char* args, ubctrl_done_type* cb, void* arg);
+
+/**
+ * Stop the command in the background, the callback is not called.
+ * @param uc: the client.
+ */
+void ubctrl_stop(struct ubctrl* uc);
+
+/** handle events on the connection of the command in the background */
+int ubctrl_handle(struct comm_point* c, void* arg, int err,
+	struct comm_reply* reply_info);
+
+/** handle the timeout of the command in the background */
+void ubctrl_timeout(void* arg);
+
+#endif /* UBCTRL_H */
@@ -44,6 +44,9 @@
 #include "cfg.h"
 #include "log.h"
 #include "probe.h"
+#include "ubctrl.h"
+#include "cmdq.h"
+#include "svr.h"
 #ifdef USE_WINSOCK
 #include "winrc/win_svc.h"
 #endif
@@ -51,24 +54,101 @@
 /* the state configured for unbound */
 static int ub_has_tcp_upstream = 0;
 static int ub_has_ssl_upstream = 0;
+static int ub_edns_size = 0;
+
+/* the native unbound control client, created when first used */
+static struct ubctrl* ub_native = NULL;
+/* if the native client was tried (and perhaps failed to setup) */
+static int ub_native_tried = 0;
+/* if the native client could not contact unbound for this command, and
+ * the child process uses unbound-control for it */
+static int ub_native_skip = 0;
 
 /**
- * Perform the unbound control command.
- * @param cfg: the config options with the command pathname.
+ * The check if unbound supports an option, it runs in the command queue.
+ */
+struct ub_option {
+	/** the config options, set when the check is queued */
+	struct cfg* cfg;
+	/** the cached result, -1 is not yet known */
+	int supports;
+	/** if a check is in the command queue */
+	int pending;
+	/** if unbound answered the check over the native client */
+	int answered;
+	/** the command queue, while the native client is busy with it */
+	struct cmdq* q;
+};
+static struct ub_option ub_opt_tcp_upstream = { NULL, -1, 0, 0, NULL };
+static struct ub_option ub_opt_ssl_upstream = { NULL, -1, 0, 0, NULL };
+
+/** get the native unbound control client, created when first used */
+static struct ubctrl*
+ub_native_get(struct cfg* cfg)
+{
+	if(!cfg->unbound_control_native)
+		return NULL;
+	if(!ub_native_tried) {
+		ub_native = ubctrl_create(cfg);
+		ub_native_tried = 1;
+	}
+	return ub_native;
+}
+
+/**
+ * Perform the command with the native unbound control client.
+ * @param cfg: the config options.
  * @param cmd: the command.
  * @param args: arguments.
+ * @return -1 if the native client cannot be used, 0 if unbound returned
+ * 	an error, 1 on success.
  */
-static void
-ub_ctrl(struct cfg* cfg, const char* cmd, const char* args)
+static int
+ub_ctrl_native(struct cfg* cfg, const char* cmd, const char* args)
+{
+	char reply[1024];
+	int r;
+	if(!ub_native_get(cfg))
+		return -1;
+	r = ubctrl_cmd(ub_native, cmd, args, reply, sizeof(reply));
+	if(r == 0) {
+		verbose(VERB_OPS, "unbound control %s %s: %s", cmd, args,
+			reply);
+	}
+	return r;
+}
+
+void hook_unbound_cleanup(void)
+{
+	ubctrl_delete(ub_native);
+	ub_native = NULL;
+	ub_native_tried = 0;
+	ub_opt_tcp_upstream.supports = -1;
+	ub_opt_tcp_upstream.pending = 0;
+	ub_opt_ssl_upstream.supports = -1;
+	ub_opt_ssl_upstream.pending = 0;
+}
+
+/**
+ * Perform the unbound control command, this runs in the command queue,
+ * in the child process, or blocking if there is no child process.
+ * @param arg: the config options with the command pathname.
+ * @param data: the command and its arguments.
+ * @return exit status.
+ */
+static int
+ub_ctrl_run(void* arg, char* data)
 {
+	struct cfg* cfg = (struct cfg*)arg;
 	char command[12000];
 	const char* ctrl = "unbound-control";
 #ifdef USE_WINSOCK
 	char* regctrl = NULL;
 #endif
 	int r;
-	if(cfg->noaction)
-		return;
+	/* the native client sends the line, with the arguments */
+	if(!ub_native_skip && (r=ub_ctrl_native(cfg, data, "")) != -1)
+		return !r;
 #ifdef USE_WINSOCK
 	if( (regctrl = get_registry_unbound_control()) != NULL) {
 		ctrl = regctrl;
@@ -76,8 +156,8 @@ ub_ctrl(struct cfg* cfg, const char* cmd, const char* args)
 #endif
 	if(cfg->unbound_control)
 		ctrl = cfg->unbound_control;
-	verbose(VERB_ALGO, "system %s %s %s", ctrl, cmd, args);
-	snprintf(command, sizeof(command), "%s %s %s", ctrl, cmd, args);
+	verbose(VERB_ALGO, "system %s %s", ctrl, data);
+	snprintf(command, sizeof(command), "%s %s", ctrl, data);
 #ifdef USE_WINSOCK
 	r = win_run_cmd(command);
 	free(regctrl);
@@ -85,12 +165,95 @@ ub_ctrl(struct cfg* cfg, const char* cmd, const char* args)
 	r = system(command);
 	if(r == -1) {
 		log_err("system(%s) failed: %s", ctrl, strerror(errno));
-	} else
+	}
 #endif
-	if(r != 0) {
+	return r;
+}
+
+/** the native client could not contact unbound, unbound-control is
+ * started for the command, in the child process that does not try the
+ * native client again */
+static void
+ub_native_fallback(struct cmdq* q)
+{
+	ub_native_skip = 1;
+	cmdq_async_done(q, CMDQ_RUN_INSTEAD);
+	ub_native_skip = 0;
+}
+
+/** the native client is done with the command in the background */
+static void
+ub_ctrl_native_done(void* arg, int r)
+{
+	struct cmdq* q = (struct cmdq*)arg;
+	if(r == -1) {
+		ub_native_fallback(q);
+		return;
+	}
+	cmdq_async_done(q, !r);
+}
+
+/**
+ * Start the unbound control command in the daemon, with the native client,
+ * this runs in the command queue.
+ * @param q: the command queue.
+ * @param arg: the config options.
+ * @param data: the command and its arguments.
+ * @return false if the native client cannot be used.
+ */
+static int
+ub_ctrl_start(struct cmdq* q, void* arg, char* data)
+{
+	struct cfg* cfg = (struct cfg*)arg;
+	if(!ub_native_get(cfg))
+		return 0;
+	return ubctrl_start(ub_native, q->base, data, "", &ub_ctrl_native_done,
+		q);
+}
+
+/** stop the unbound control command in the daemon */
+static void
+ub_ctrl_stop(void* ATTR_UNUSED(arg))
+{
+	if(ub_native)
+		ubctrl_stop(ub_native);
+}
+
+/** the unbound control command is done */
+static void
+ub_ctrl_done(int status, void* ATTR_UNUSED(arg), char* data)
+{
+	if(status != 0 && status != -1) {
 		log_warn("unbound-control exited with status %d, cmd: %s",
-			r, command);
+			status, data);
+	}
+}
+
+/**
+ * Perform the unbound control command.  It is put in the command queue,
+ * after the changes that were asked for before.
+ * @param cfg: the config options with the command pathname.
+ * @param cmd: the command.
+ * @param args: arguments.
+ */
+static void
+ub_ctrl(struct cfg* cfg, const char* cmd, const char* args)
+{
+	size_t len = strlen(cmd)+strlen(args)+2;
+	char* line;
+	if(cfg->noaction)
+		return;
+	/* load the keys once, and not in every command process */
+	(void)ub_native_get(cfg);
+	line = (char*)malloc(len);
+	if(!line) {
+		log_err("out of memory");
+		return;
 	}
+	snprintf(line, len, "%s %s", cmd, args);
+	cmdq_add_async(global_svr?global_svr->cmdq:NULL, &ub_ctrl_start,
+		&ub_ctrl_stop, &ub_ctrl_run, &ub_ctrl_done, cfg, line);
+	free(line);
 }
 
 static void
@@ -170,40 +333,116 @@ void hook_unbound_dark(struct cfg* cfg)
 	ub_ctrl(cfg, "forward", UNBOUND_DARK_IP); 
 }
 
-static int hook_unbound_supports_option(struct cfg* cfg, const char* args)
+/** the native client is done with the option check */
+static void
+ub_option_native_done(void* arg, int r)
 {
-	char command[12000];
-	const char* ctrl = "unbound-control";
-	const char* cmd = "get_option";
-	int r;
-	if(cfg->unbound_control)
-		ctrl = cfg->unbound_control;
-	verbose(VERB_ALGO, "system %s %s %s", ctrl, cmd, args);
-	snprintf(command, sizeof(command), "%s %s %s", ctrl, cmd, args);
-#ifdef USE_WINSOCK
-	r = win_run_cmd(command);
-#else
-	r = system(command);
+	struct ub_option* opt = (struct ub_option*)arg;
+	struct cmdq* q = opt->q;
+	opt->q = NULL;
 	if(r == -1) {
-		log_err("system(%s) failed: %s", ctrl, strerror(errno));
-	} else
-#endif
-	if(r != 0) {
-		verbose(VERB_OPS, "unbound does not support option: %s", args);
+		ub_native_fallback(q);
+		return;
+	}
+	/* unbound answered, the result can be stored */
+	opt->answered = 1;
+	opt->supports = r;
+	cmdq_async_done(q, !r);
+}
+
+/** start the option check in the daemon, with the native client */
+static int
+ub_option_start(struct cmdq* q, void* arg, char* data)
+{
+	struct ub_option* opt = (struct ub_option*)arg;
+	if(!ub_native_get(opt->cfg))
 		return 0;
+	opt->q = q;
+	return ubctrl_start(ub_native, q->base, data, "",
+		&ub_option_native_done, opt);
+}
+
+/** perform the option check with unbound-control, in the child process */
+static int
+ub_option_run(void* arg, char* data)
+{
+	struct ub_option* opt = (struct ub_option*)arg;
+	return ub_ctrl_run(opt->cfg, data);
+}
+
+/** the option check is done */
+static void
+ub_option_done(int status, void* arg, char* data)
+{
+	struct ub_option* opt = (struct ub_option*)arg;
+	opt->pending = 0;
+	if(opt->answered) {
+		verbose(VERB_OPS, "unbound %s option: %s",
+			opt->supports?"supports":"does not support", data);
+		return;
 	}
-	verbose(VERB_OPS, "unbound supports option: %s", args);
-	return 1;
+	if(status != 0) {
+		/* a failure exit may mean that unbound was not reachable,
+		 * only the successful result is stored */
+		verbose(VERB_OPS, "unbound does not support option: %s",
+			data);
+		return;
+	}
+	verbose(VERB_OPS, "unbound supports option: %s", data);
+	opt->supports = 1;
+}
+
+/** queue the check if unbound supports the option */
+static void
+ub_option_check(struct cfg* cfg, const char* name, struct ub_option* opt)
+{
+	char line[128];
+	if(opt->supports != -1 || opt->pending)
+		return;
+	opt->cfg = cfg;
+	opt->pending = 1;
+	opt->answered = 0;
+	snprintf(line, sizeof(line), "get_option %s", name);
+	cmdq_add_async(global_svr?global_svr->cmdq:NULL, &ub_option_start,
+		&ub_ctrl_stop, &ub_option_run, &ub_option_done, opt, line);
+}
+
+void hook_unbound_check_options(struct cfg* cfg)
+{
+	if(cfg->noaction)
+		return;
+	if(cfg_have_dnstcp(cfg))
+		ub_option_check(cfg, "tcp-upstream", &ub_opt_tcp_upstream);
+	if(cfg_have_ssldns(cfg))
+		ub_option_check(cfg, "ssl-upstream", &ub_opt_ssl_upstream);
+}
+
+/** see if unbound supports the option, without waiting for unbound */
+static int
+hook_unbound_supports_option(struct cfg* cfg, const char* name,
+	struct ub_option* opt)
+{
+	/* unbound is not changed, there is no need to ask it, and the
+	 * probe of the tcp and ssl resolvers can be tested */
+	if(cfg->noaction)
+		return 1;
+	if(opt->supports == -1)
+		ub_option_check(cfg, name, opt);
+	/* if it is not known yet, the check is in the queue, and
+	 * the probes do not wait for it */
+	return opt->supports == 1;
 }
 
 int hook_unbound_supports_tcp_upstream(struct cfg* cfg)
 {
-	return hook_unbound_supports_option(cfg, "tcp-upstream");
+	return hook_unbound_supports_option(cfg, "tcp-upstream",
+		&ub_opt_tcp_upstream);
 }
 
 int hook_unbound_supports_ssl_upstream(struct cfg* cfg)
 {
-	return hook_unbound_supports_option(cfg, "ssl-upstream");
+	return hook_unbound_supports_option(cfg, "ssl-upstream",
+		&ub_opt_ssl_upstream);
 }
 
 static void append_str_port(char* buf, char** now, size_t* left,
@@ -219,7 +458,7 @@ static void append_str_port(char* buf, char** now, size_t* left,
 }
 
 void hook_unbound_tcp_upstream(struct cfg* cfg, int tcp80_ip4, int tcp80_ip6,
-	int tcp443_ip4, int tcp443_ip6)
+	int tcp443_ip4, int tcp443_ip6, const char* servers)
 {
 	char buf[102400];
 	char* now = buf;
@@ -231,21 +470,26 @@ void hook_unbound_tcp_upstream(struct cfg* cfg, int tcp80_ip4, int tcp80_ip6,
 	if(cfg->noaction)
 		return;
 	buf[0] = 0;
-	if(tcp80_ip4) {
-		for(p=cfg->tcp80_ip4; p; p=p->next)
-			append_str_port(buf, &now, &left, p->str, 80);
-	}
-	if(tcp80_ip6) {
-		for(p=cfg->tcp80_ip6; p; p=p->next)
-			append_str_port(buf, &now, &left, p->str, 80);
-	}
-	if(tcp443_ip4) {
-		for(p=cfg->tcp443_ip4; p; p=p->next)
-			append_str_port(buf, &now, &left, p->str, 443);
-	}
-	if(tcp443_ip6) {
-		for(p=cfg->tcp443_ip6; p; p=p->next)
-			append_str_port(buf, &now, &left, p->str, 443);
+	if(servers) {
+		/* the servers that were probed, in order of preference */
+		(void)strlcpy(buf, servers, sizeof(buf));
+	} else {
+		if(tcp80_ip4) {
+			for(p=cfg->tcp80_ip4; p; p=p->next)
+				append_str_port(buf, &now, &left, p->str, 80);
+		}
+		if(tcp80_ip6) {
+			for(p=cfg->tcp80_ip6; p; p=p->next)
+				append_str_port(buf, &now, &left, p->str, 80);
+		}
+		if(tcp443_ip4) {
+			for(p=cfg->tcp443_ip4; p; p=p->next)
+				append_str_port(buf, &now, &left, p->str, 443);
+		}
+		if(tcp443_ip6) {
+			for(p=cfg->tcp443_ip6; p; p=p->next)
+				append_str_port(buf, &now, &left, p->str, 443);
+		}
 	}
 	/* effectuate tcp upstream and new list of servers */
 	disable_ssl_upstream(cfg);
@@ -258,7 +502,8 @@ void hook_unbound_tcp_upstream(struct cfg* cfg, int tcp80_ip4, int tcp80_ip6,
 	ub_has_tcp_upstream = 1;
 }
 
-void hook_unbound_ssl_upstream(struct cfg* cfg, int ssl443_ip4, int ssl443_ip6)
+void hook_unbound_ssl_upstream(struct cfg* cfg, int ssl443_ip4, int ssl443_ip6,
+	const char* servers)
 {
 	char buf[102400];
 	char* now = buf;
@@ -269,13 +514,18 @@ void hook_unbound_ssl_upstream(struct cfg* cfg, int ssl443_ip4, int ssl443_ip6)
 	if(cfg->noaction)
 		return;
 	buf[0] = 0;
-	if(ssl443_ip4) {
-		for(p=cfg->ssl443_ip4; p; p=p->next)
-			append_str_port(buf, &now, &left, p->str, 443);
-	}
-	if(ssl443_ip6) {
-		for(p=cfg->ssl443_ip6; p; p=p->next)
-			append_str_port(buf, &now, &left, p->str, 443);
+	if(servers) {
+		/* the servers that were probed, in order of preference */
+		(void)strlcpy(buf, servers, sizeof(buf));
+	} else {
+		if(ssl443_ip4) {
+			for(p=cfg->ssl443_ip4; p; p=p->next)
+				append_str_port(buf, &now, &left, p->str, 443);
+		}
+		if(ssl443_ip6) {
+			for(p=cfg->ssl443_ip6; p; p=p->next)
+				append_str_port(buf, &now, &left, p->str, 443);
+		}
 	}
 	/* effectuate ssl upstream and new list of servers */
 	/* set SSL first, so no contact of this server over normal DNS,
@@ -293,3 +543,14 @@ void hook_unbound_ssl_upstream(struct cfg* cfg, int ssl443_ip4, int ssl443_ip6)
 	}
 	ub_has_ssl_upstream = 1;
 }
+
+void hook_unbound_edns_size(struct cfg* cfg, int size)
+{
+	char buf[64];
+	if(cfg->noaction || size == ub_edns_size)
+		return;
+	verbose(VERB_QUERY, "unbound hook to edns-buffer-size %d", size);
+	snprintf(buf, sizeof(buf), "edns-buffer-size: %d", size);
+	ub_ctrl(cfg, "set_option", buf);
+	ub_edns_size = size;
+}
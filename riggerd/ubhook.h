@@ -45,6 +45,12 @@
 struct cfg;
 struct probe_ip;
 
+/**
+ * Close the unbound control client and forget the cached unbound options.
+ * Call on exit and when the config is reloaded.
+ */
+void hook_unbound_cleanup(void);
+
 /**
  * Set the unbound server to go to the authorities
  * @param cfg: the config options.
@@ -76,14 +82,29 @@ void hook_unbound_dark(struct cfg* cfg);
  * donotquery 127.0.0.0/8 by default */
 #define UNBOUND_DARK_IP "127.0.0.127"
 
+/**
+ * Queue the checks if unbound supports the tcp-upstream and ssl-upstream
+ * options, for the configured tcp and ssl servers.  Done at startup and
+ * after a reload, so the result is known when the probes need it.
+ * Nothing is checked with noaction.
+ * @param cfg: the config options.
+ */
+void hook_unbound_check_options(struct cfg* cfg);
+
 /**
  * Detect if unbound supports the tcp-upstream option (since 1.4.13).
+ * The result is cached, until hook_unbound_cleanup.  Does not wait for
+ * unbound, if the result is not known yet it returns false, and the check
+ * is queued.  With noaction it returns true.
  * @param cfg: the config options.
  */
 int hook_unbound_supports_tcp_upstream(struct cfg* cfg);
 
 /**
  * Detect if unbound supports the ssl-upstream option (since 1.4.14).
+ * The result is cached, until hook_unbound_cleanup.  Does not wait for
+ * unbound, if the result is not known yet it returns false, and the check
+ * is queued.  With noaction it returns true.
  * @param cfg: the config options.
  */
 int hook_unbound_supports_ssl_upstream(struct cfg* cfg);
@@ -95,16 +116,28 @@ int hook_unbound_supports_ssl_upstream(struct cfg* cfg);
  * @param tcp80_ip6: if true, use those IP addresses.
  * @param tcp443_ip4: if true, use those IP addresses.
  * @param tcp443_ip6: if true, use those IP addresses.
+ * @param servers: forward list (ip@port, space separated) to use instead
+ *	of all the configured servers of the enabled lists, or NULL.
  */
 void hook_unbound_tcp_upstream(struct cfg* cfg, int tcp80_ip4, int tcp80_ip6,
-	int tcp443_ip4, int tcp443_ip6);
+	int tcp443_ip4, int tcp443_ip6, const char* servers);
 
 /**
  * Set unbound to use ssl upstream.
  * @param cfg: the config options.
  * @param ssl443_ip4: if true, use those IP addresses.
  * @param ssl443_ip6: if true, use those IP addresses.
+ * @param servers: forward list (ip@port, space separated) to use instead
+ *	of all the configured servers of the enabled lists, or NULL.
+ */
+void hook_unbound_ssl_upstream(struct cfg* cfg, int ssl443_ip4, int ssl443_ip6,
+	const char* servers);
+
+/**
+ * Set the EDNS buffer size of unbound, nothing if it is set to that already.
+ * @param cfg: the config options.
+ * @param size: the EDNS buffer size that works on the path.
  */
-void hook_unbound_ssl_upstream(struct cfg* cfg, int ssl443_ip4, int ssl443_ip6);
+void hook_unbound_edns_size(struct cfg* cfg, int size);
 
 #endif /* UBHOOKS_H */
@@ -748,6 +748,7 @@ svr_close_sockets(struct svr* svr)
 	struct sslconn* b;
 	struct listen_list* l;
 	struct probe_ip* p;
+	struct probe_conn* conn;
 	/* do not cause traffic on the fds because the real daemon
 	 * is still using them */
 	for(b=svr->busy_list; b; b=b->next) {
@@ -758,15 +759,15 @@ svr_close_sockets(struct svr* svr)
 		if(l->c)
 			close(l->c->fd);
 	}
+	if(svr->udp4)
+		close(svr->udp4->fd);
+	if(svr->udp6)
+		close(svr->udp6->fd);
+	for(conn=svr->conns; conn; conn=conn->next) {
+		if(conn->c)
+			close(conn->c->fd);
+	}
 	for(p=svr->probes; p; p=p->next) {
-		if(p->ds_c && p->ds_c->c)
-			close(p->ds_c->c->fd);
-		if(p->dnskey_c && p->dnskey_c->c)
-			close(p->dnskey_c->c->fd);
-		if(p->nsec3_c && p->nsec3_c->c)
-			close(p->nsec3_c->c->fd);
-		if(p->host_c && p->host_c->c)
-			close(p->host_c->c->fd);
 		if(p->http && p->http->cp)
 			close(p->http->cp->fd);
 	}
@@ -777,12 +778,6 @@ svr_close_sockets(struct svr* svr)
 		if(svr->update->download_http6 &&
 			svr->update->download_http6->cp)
 			close(svr->update->download_http6->cp->fd);
-		if(svr->update->txt_query && svr->update->txt_query->c)
-			close(svr->update->txt_query->c->fd);
-		if(svr->update->addr_4 && svr->update->addr_4->c)
-			close(svr->update->addr_4->c->fd);
-		if(svr->update->addr_6 && svr->update->addr_6->c)
-			close(svr->update->addr_6->c->fd);
 	}
 }
 
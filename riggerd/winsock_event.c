@@ -440,6 +440,7 @@ int event_base_dispatch(struct event_base *base)
                                 return 0;
                         return -1;
                 }
+                base->num_wakeups++;
         }
         return 0;
 }
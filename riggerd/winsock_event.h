@@ -128,6 +128,8 @@ struct event_base
         struct event** signals;
 	/** if we need to exit */
 	int need_to_exit;
+	/** number of times the loop woke up from waiting */
+	unsigned long long num_wakeups;
 	/** where to store time in seconds */
 	uint32_t* time_secs;
 	/** where to store time in microseconds */
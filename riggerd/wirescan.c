@@ -0,0 +1,310 @@
+/*
+ * wirescan.c - dnssec-trigger scanner for DNS replies in wire format
+ *
+ * Copyright (c) 2011, NLnet Labs. All rights reserved.
+ *
+ * This software is open source.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the NLNET LABS nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file
+ *
+ * This file contains a scanner for DNS replies in wire format.  The
+ * sections are walked once, the RR types are noted in a bitmap and the
+ * offsets of the SOA owner names for the denial check are kept, so the
+ * checks on a probe reply need no heap allocations.
+ */
+#include "config.h"
+#include "wirescan.h"
+#include <ldns/ldns.h>
+#include <ctype.h>
+
+/** max number of compression pointers followed in a name */
+#define MAX_COMPRESS_PTRS 256
+
+/** skip a domain name, returns false if malformed */
+static int
+skip_dname(uint8_t* wire, size_t len, size_t* pos)
+{
+	size_t p = *pos, total = 0;
+	uint8_t lablen;
+	while(p < len) {
+		lablen = wire[p];
+		if((lablen&0xc0) == 0xc0) {
+			/* compression pointer ends the name here */
+			if(p+2 > len)
+				return 0;
+			*pos = p+2;
+			return 1;
+		} else if((lablen&0xc0) != 0) {
+			return 0; /* unknown label type */
+		}
+		p++;
+		total += (size_t)lablen + 1;
+		if(total > LDNS_MAX_DOMAINLEN)
+			return 0;
+		if(lablen == 0) {
+			*pos = p;
+			return 1;
+		}
+		p += lablen;
+	}
+	return 0;
+}
+
+/**
+ * Copy the name at the position to buf, uncompressed.
+ * @param wire: message.
+ * @param len: message length.
+ * @param pos: start of the name.
+ * @param buf: destination, LDNS_MAX_DOMAINLEN+1 in size.
+ * @return false if malformed.
+ */
+static int
+decompress_dname(uint8_t* wire, size_t len, size_t pos, uint8_t* buf)
+{
+	size_t total = 0;
+	int ptrs = 0;
+	uint8_t lablen;
+	while(pos < len) {
+		lablen = wire[pos];
+		if((lablen&0xc0) == 0xc0) {
+			if(pos+2 > len || ++ptrs > MAX_COMPRESS_PTRS)
+				return 0;
+			pos = (size_t)ldns_read_uint16(wire+pos)&0x3fff;
+			continue;
+		} else if((lablen&0xc0) != 0) {
+			return 0;
+		}
+		if(pos+1+lablen > len ||
+			total+1+lablen > LDNS_MAX_DOMAINLEN)
+			return 0;
+		memmove(buf+total, wire+pos, (size_t)lablen+1);
+		total += (size_t)lablen+1;
+		if(lablen == 0)
+			return 1;
+		pos += (size_t)lablen+1;
+	}
+	return 0;
+}
+
+/**
+ * Convert a domain name from presentation format, into buf.
+ * @param str: the name, the trailing dot is optional.
+ * @param buf: destination, LDNS_MAX_DOMAINLEN+1 in size.
+ * @return false if malformed.
+ */
+static int
+str2wire_dname(const char* str, uint8_t* buf)
+{
+	size_t total = 0, lab = 0;
+	const char* s = str;
+	uint8_t c;
+	if(strcmp(str, ".") == 0) {
+		buf[0] = 0;
+		return 1;
+	}
+	buf[0] = 0;
+	while(*s) {
+		if(*s == '.') {
+			if(buf[lab] == 0)
+				return 0; /* empty label */
+			lab = ++total;
+			if(total >= LDNS_MAX_DOMAINLEN)
+				return 0;
+			buf[lab] = 0;
+			s++;
+			continue;
+		}
+		if(*s == '\\' && isdigit((unsigned char)s[1]) &&
+			isdigit((unsigned char)s[2]) &&
+			isdigit((unsigned char)s[3])) {
+			int v = (s[1]-'0')*100 + (s[2]-'0')*10 + (s[3]-'0');
+			if(v > 255)
+				return 0;
+			c = (uint8_t)v;
+			s += 4;
+		} else if(*s == '\\' && s[1]) {
+			c = (uint8_t)s[1];
+			s += 2;
+		} else {
+			c = (uint8_t)*s++;
+		}
+		if(buf[lab] >= 63 || total+2 >= LDNS_MAX_DOMAINLEN)
+			return 0;
+		buf[++total] = c;
+		buf[lab]++;
+	}
+	if(buf[lab] != 0) {
+		/* no trailing dot, add the root label */
+		buf[++total] = 0;
+	}
+	return 1;
+}
+
+/** count the labels of an uncompressed name, without the root label */
+static int
+dname_count_labels(uint8_t* d)
+{
+	int n = 0;
+	while(*d) {
+		n++;
+		d += *d + 1;
+	}
+	return n;
+}
+
+/** compare uncompressed names, case insensitive, true if equal */
+static int
+dname_equal(uint8_t* a, uint8_t* b)
+{
+	uint8_t lablen;
+	while(*a == *b) {
+		lablen = *a;
+		if(lablen == 0)
+			return 1;
+		a++;
+		b++;
+		while(lablen--) {
+			if(tolower((unsigned char)*a) !=
+				tolower((unsigned char)*b))
+				return 0;
+			a++;
+			b++;
+		}
+	}
+	return 0;
+}
+
+/** note the RR type in the section of the scan */
+static void
+note_type(struct wirescan* ws, int section, uint16_t t)
+{
+	if(t < 256)
+		ws->types[section][t/8] |= (uint8_t)(1<<(t%8));
+	else	ws->high_types[section] = 1;
+}
+
+const char* wirescan_scan(struct wirescan* ws, uint8_t* wire, size_t len)
+{
+	size_t pos = LDNS_HEADER_SIZE;
+	uint16_t t, rdlen;
+	int s, i;
+	memset(ws, 0, sizeof(*ws));
+	ws->wire = wire;
+	ws->len = len;
+	if(len < LDNS_HEADER_SIZE)
+		return "short header";
+	ws->count[LDNS_SECTION_QUESTION] = LDNS_QDCOUNT(wire);
+	ws->count[LDNS_SECTION_ANSWER] = LDNS_ANCOUNT(wire);
+	ws->count[LDNS_SECTION_AUTHORITY] = LDNS_NSCOUNT(wire);
+	ws->count[LDNS_SECTION_ADDITIONAL] = LDNS_ARCOUNT(wire);
+	ws->start[LDNS_SECTION_QUESTION] = pos;
+	for(i=0; i<(int)ws->count[LDNS_SECTION_QUESTION]; i++) {
+		if(!skip_dname(wire, len, &pos) || pos+4 > len)
+			return "malformed question section";
+		t = ldns_read_uint16(wire+pos);
+		note_type(ws, LDNS_SECTION_QUESTION, t);
+		pos += 4;
+	}
+	for(s=LDNS_SECTION_ANSWER; s<=LDNS_SECTION_ADDITIONAL; s++) {
+		ws->start[s] = pos;
+		for(i=0; i<(int)ws->count[s]; i++) {
+			size_t owner = pos;
+			if(!skip_dname(wire, len, &pos) || pos+10 > len)
+				return "malformed resource record";
+			t = ldns_read_uint16(wire+pos);
+			rdlen = ldns_read_uint16(wire+pos+8);
+			pos += 10;
+			if(pos+rdlen > len)
+				return "rdata length exceeds packet";
+			pos += rdlen;
+			note_type(ws, s, t);
+			if(s == LDNS_SECTION_ADDITIONAL &&
+				t == LDNS_RR_TYPE_OPT) {
+				ws->have_opt = 1;
+			} else if(s == LDNS_SECTION_AUTHORITY &&
+				t == LDNS_RR_TYPE_SOA) {
+				if(ws->num_soa < WIRESCAN_MAX_OWNERS)
+					ws->soa_owner[ws->num_soa++] = owner;
+			}
+		}
+	}
+	return NULL;
+}
+
+int wirescan_has_type(struct wirescan* ws, int section, uint16_t t)
+{
+	size_t pos;
+	int i;
+	if(t < 256)
+		return (ws->types[section][t/8] & (1<<(t%8))) != 0;
+	if(!ws->high_types[section])
+		return 0;
+	/* rare, walk the section again, it was checked by the scan */
+	pos = ws->start[section];
+	for(i=0; i<(int)ws->count[section]; i++) {
+		(void)skip_dname(ws->wire, ws->len, &pos);
+		if(ldns_read_uint16(ws->wire+pos) == t)
+			return 1;
+		if(section == LDNS_SECTION_QUESTION)
+			pos += 4;
+		else	pos += 10 + ldns_read_uint16(ws->wire+pos+8);
+	}
+	return 0;
+}
+
+int wirescan_soa_from_parent(struct wirescan* ws, const char* dname)
+{
+	uint8_t name[LDNS_MAX_DOMAINLEN+1];
+	uint8_t owner[LDNS_MAX_DOMAINLEN+1];
+	uint8_t* sub;
+	int namelabs, ownerlabs;
+	size_t i;
+	if(!str2wire_dname(dname, name))
+		return 0; /* robustness, the name should parse */
+	namelabs = dname_count_labels(name);
+	for(i=0; i<ws->num_soa; i++) {
+		if(!decompress_dname(ws->wire, ws->len, ws->soa_owner[i],
+			owner))
+			continue;
+		/* note that the name must be longer than the owner, the
+		 * SOA must be from a parent server */
+		ownerlabs = dname_count_labels(owner);
+		if(ownerlabs >= namelabs)
+			continue;
+		sub = name;
+		while(ownerlabs++ < namelabs)
+			sub += *sub + 1;
+		if(dname_equal(sub, owner))
+			return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,103 @@
+/*
+ * wirescan.h - dnssec-trigger scanner for DNS replies in wire format
+ *
+ * Copyright (c) 2011, NLnet Labs. All rights reserved.
+ *
+ * This software is open source.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the NLNET LABS nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file
+ *
+ * This file contains a scanner for DNS replies in wire format.  It walks
+ * the reply once and notes what the probe checks need, without allocating
+ * memory, so the probe replies do not have to be parsed into ldns packets.
+ */
+
+#ifndef WIRESCAN_H
+#define WIRESCAN_H
+
+/** max number of SOA owner names that are remembered */
+#define WIRESCAN_MAX_OWNERS 8
+
+/**
+ * The result of a scan of a DNS message.  Refers to the wire buffer
+ * that was scanned, that must be kept during the lookups.
+ */
+struct wirescan {
+	/** the message that was scanned */
+	uint8_t* wire;
+	/** length of the message */
+	size_t len;
+	/** number of RRs per section (question, answer, authority, add) */
+	uint16_t count[4];
+	/** bitmap of the RR types (below 256) present, per section */
+	uint8_t types[4][32];
+	/** if RR types of 256 and larger are present, per section */
+	int high_types[4];
+	/** offset of the first RR per section */
+	size_t start[4];
+	/** if an EDNS OPT record is present in the additional section */
+	int have_opt;
+	/** number of SOA records in the authority section */
+	size_t num_soa;
+	/** offsets of the owner names of the SOA records in authority */
+	size_t soa_owner[WIRESCAN_MAX_OWNERS];
+};
+
+/**
+ * Scan a DNS message.  The header must be present.
+ * @param ws: the scan result is stored here.
+ * @param wire: the message, it is referred to by ws.
+ * @param len: length of the message.
+ * @return NULL on success, or a static string with the reason the
+ * 	message is malformed.
+ */
+const char* wirescan_scan(struct wirescan* ws, uint8_t* wire, size_t len);
+
+/**
+ * See if the RR type is present in the section.
+ * @param ws: scanned message.
+ * @param section: LDNS_SECTION_ANSWER, or another section.
+ * @param t: the RR type.
+ * @return true if present.
+ */
+int wirescan_has_type(struct wirescan* ws, int section, uint16_t t);
+
+/**
+ * See if a SOA record in the authority section is from a parent zone of
+ * the name, that is, the name is a subdomain of the owner and not equal.
+ * @param ws: scanned message.
+ * @param dname: the name, in presentation format.
+ * @return true if such a SOA is present.
+ */
+int wirescan_soa_from_parent(struct wirescan* ws, const char* dname);
+
+#endif /* WIRESCAN_H */
@@ -0,0 +1,335 @@
+/*
+ * test/bench_timers.c - dnssec-trigger benchmark of the event timeouts
+ *
+ * Copyright (c) 2011, NLnet Labs. All rights reserved.
+ *
+ * This software is open source.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the NLNET LABS nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file
+ *
+ * This file contains a microbenchmark of the timeouts in mini_event.  The
+ * timeouts are kept in a heap.  The benchmark compares it with the red-black
+ * tree that mini_event used before, on thousands of short-lived timers:
+ * most timers are deleted before they expire, because the reply came in,
+ * and a new timer is added for the next query.  At the end the timers that
+ * are left expire, in order.
+ */
+#include "config.h"
+#include "riggerd/mini_event.h"
+#include "riggerd/rbtree.h"
+#include "riggerd/log.h"
+#include "riggerd/fptr_wlist.h"
+#ifdef HAVE_GETOPT_H
+#include <getopt.h>
+#endif
+#include <sys/time.h>
+#include <time.h>
+
+/** default number of timer deletes and adds */
+#define BENCH_OPS 1000000
+/** the longest timeout, in usec */
+#define BENCH_MAX_TIMEOUT 10000000
+
+/** a timer in the red-black tree, like mini_event kept them before */
+struct rb_timer {
+	/** node in the tree, the key is the event */
+	rbnode_t node;
+	/** the event with the timeout */
+	struct event ev;
+};
+
+/** the benchmark state */
+struct bench {
+	/** the time in seconds, for the event base */
+	uint32_t secs;
+	/** the time now, for the event base */
+	struct timeval now;
+	/** the event base, with the heap */
+	struct event_base* base;
+	/** number of timers that expired */
+	int expired;
+	/** number of timers that should expire before the loop exits */
+	int expect;
+	/** random state */
+	uint32_t rnd;
+};
+
+/** the benchmark, for the callbacks */
+static struct bench b;
+
+/** random number, the same sequence for both timer sets */
+static uint32_t
+bench_random(void)
+{
+	b.rnd = b.rnd*1103515245 + 12345;
+	return (b.rnd >> 8);
+}
+
+/** a random timeout for a new timer */
+static void
+bench_timeout(struct timeval* tv)
+{
+	uint32_t usec = bench_random() % BENCH_MAX_TIMEOUT;
+	tv->tv_sec = (time_t)(usec / 1000000);
+	tv->tv_usec = (suseconds_t)(usec % 1000000);
+}
+
+/** the time now, in nanoseconds */
+static double
+now_nsec(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+	struct timespec ts;
+	if(clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return (double)ts.tv_sec*1e9 + (double)ts.tv_nsec;
+#endif
+	{
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return (double)tv.tv_sec*1e9 + (double)tv.tv_usec*1e3;
+	}
+}
+
+/** callback of a timer that expires */
+static void
+bench_expire_cb(int ATTR_UNUSED(fd), short ATTR_UNUSED(bits),
+	void* ATTR_UNUSED(arg))
+{
+	if(++b.expired == b.expect)
+		(void)event_base_loopexit(b.base, NULL);
+}
+
+/** callback of a timer in the tree that expires */
+static void
+bench_rb_expire_cb(int ATTR_UNUSED(fd), short ATTR_UNUSED(bits),
+	void* ATTR_UNUSED(arg))
+{
+	b.expired++;
+}
+
+int
+fptr_whitelist_event(void (*fptr)(int, short, void *))
+{
+	return fptr == &bench_expire_cb || fptr == &bench_rb_expire_cb;
+}
+
+int
+fptr_whitelist_rbtree_cmp(int (*fptr) (const void *, const void *))
+{
+	return fptr == &mini_ev_cmp;
+}
+
+/** add the rb timer, like event_add did with the tree */
+static void
+rb_add(rbtree_t* tree, struct rb_timer* t, struct timeval* tv)
+{
+	t->ev.ev_timeout.tv_sec = b.now.tv_sec + tv->tv_sec;
+	t->ev.ev_timeout.tv_usec = b.now.tv_usec + tv->tv_usec;
+	while(t->ev.ev_timeout.tv_usec >= 1000000) {
+		t->ev.ev_timeout.tv_usec -= 1000000;
+		t->ev.ev_timeout.tv_sec++;
+	}
+	t->node.key = &t->ev;
+	(void)rbtree_insert(tree, &t->node);
+}
+
+/** expire the rb timers that are due, like the event loop did */
+static void
+rb_expire(rbtree_t* tree, struct timeval* now)
+{
+	struct rb_timer* t;
+	while((rbnode_t*)(t = (struct rb_timer*)rbtree_first(tree))
+		!= RBTREE_NULL) {
+		if(t->ev.ev_timeout.tv_sec > now->tv_sec ||
+			(t->ev.ev_timeout.tv_sec == now->tv_sec &&
+			t->ev.ev_timeout.tv_usec > now->tv_usec))
+			break;
+		(void)rbtree_delete(tree, &t->ev);
+		fptr_ok(fptr_whitelist_event(t->ev.ev_callback));
+		(*t->ev.ev_callback)(t->ev.ev_fd, EV_TIMEOUT, t->ev.ev_arg);
+	}
+}
+
+/** the time at the end of all timeouts */
+static void
+bench_end_time(struct timeval* end)
+{
+	*end = b.now;
+	end->tv_sec += BENCH_MAX_TIMEOUT/1000000 + 1;
+}
+
+/** run the benchmark on the red-black tree, returns the times */
+static void
+bench_rbtree(int num, int ops, double* t_churn, double* t_expire)
+{
+	rbtree_t* tree = rbtree_create(mini_ev_cmp);
+	struct rb_timer* ts = (struct rb_timer*)calloc((size_t)num,
+		sizeof(*ts));
+	struct timeval tv, end;
+	double start;
+	int i;
+	if(!tree || !ts)
+		fatal_exit("out of memory");
+	b.rnd = 1;
+	for(i=0; i<num; i++) {
+		ts[i].ev.ev_fd = -1;
+		ts[i].ev.ev_callback = &bench_rb_expire_cb;
+		bench_timeout(&tv);
+		rb_add(tree, &ts[i], &tv);
+	}
+	start = now_nsec();
+	for(i=0; i<ops; i++) {
+		struct rb_timer* t = &ts[bench_random()%(uint32_t)num];
+		(void)rbtree_delete(tree, &t->ev);
+		bench_timeout(&tv);
+		rb_add(tree, t, &tv);
+	}
+	*t_churn = (now_nsec() - start) / (double)ops;
+	b.expired = 0;
+	b.expect = num;
+	bench_end_time(&end);
+	start = now_nsec();
+	rb_expire(tree, &end);
+	*t_expire = (now_nsec() - start) / (double)num;
+	if(b.expired != num)
+		fatal_exit("rbtree: %d of %d timers expired", b.expired, num);
+	free(ts);
+	free(tree);
+}
+
+/** run the benchmark on the heap in mini_event, returns the times */
+static void
+bench_heap(int num, int ops, double* t_churn, double* t_expire)
+{
+	struct event* ts = (struct event*)calloc((size_t)num, sizeof(*ts));
+	struct timeval tv, end;
+	double start;
+	int i;
+	if(!ts)
+		fatal_exit("out of memory");
+	b.rnd = 1;
+	for(i=0; i<num; i++) {
+		event_set(&ts[i], -1, EV_TIMEOUT, &bench_expire_cb, NULL);
+		if(event_base_set(b.base, &ts[i]) != 0)
+			fatal_exit("event_base_set failed");
+		bench_timeout(&tv);
+		if(event_add(&ts[i], &tv) != 0)
+			fatal_exit("event_add failed");
+	}
+	start = now_nsec();
+	for(i=0; i<ops; i++) {
+		struct event* ev = &ts[bench_random()%(uint32_t)num];
+		(void)event_del(ev);
+		bench_timeout(&tv);
+		(void)event_add(ev, &tv);
+	}
+	*t_churn = (now_nsec() - start) / (double)ops;
+	/* the event loop expires them, with the clock moved past them */
+	b.expired = 0;
+	b.expect = num;
+	bench_end_time(&end);
+	for(i=0; i<num; i++) {
+		ts[i].ev_timeout.tv_sec -= end.tv_sec - b.now.tv_sec;
+	}
+	start = now_nsec();
+	if(event_base_dispatch(b.base) != 0)
+		fatal_exit("event_base_dispatch failed");
+	*t_expire = (now_nsec() - start) / (double)num;
+	if(b.expired != num)
+		fatal_exit("heap: %d of %d timers expired", b.expired, num);
+	free(ts);
+}
+
+/** print usage and exit */
+static void
+usage(void)
+{
+	printf("usage: bench_timers [-n ops] [timers ...]\n");
+	printf("compares the timeout heap of mini_event with a red-black tree\n");
+	printf("for the number of timers, default 100 1000 10000.\n");
+	printf("-n ops	number of timer deletes and adds, default %d\n",
+		BENCH_OPS);
+	exit(1);
+}
+
+/** getopt global, in case header files fail to declare it. */
+extern int optind;
+/** getopt global, in case header files fail to declare it. */
+extern char* optarg;
+
+/**
+ * main program of the benchmark.
+ * @param argc: number of commandline arguments.
+ * @param argv: array of commandline arguments.
+ * @return: exit status of the program.
+ */
+int main(int argc, char* argv[])
+{
+	const char* sizes[] = { "100", "1000", "10000" };
+	int c, i, ops = BENCH_OPS;
+	while( (c=getopt(argc, argv, "hn:")) != -1) {
+		switch(c) {
+		case 'n':
+			ops = atoi(optarg);
+			if(ops < 1)
+				usage();
+			break;
+		case 'h':
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if(argc == 0) {
+		argc = 3;
+		argv = (char**)sizes;
+	}
+	log_init(NULL, 0, NULL);
+	b.base = (struct event_base*)event_init(&b.secs, &b.now);
+	if(!b.base)
+		fatal_exit("could not create event base");
+	printf("%8s %14s %14s %14s %14s\n", "timers", "heap churn ns",
+		"tree churn ns", "heap expire ns", "tree expire ns");
+	for(i=0; i<argc; i++) {
+		int num = atoi(argv[i]);
+		double hc, he, tc, te;
+		if(num < 1)
+			usage();
+		bench_heap(num, ops, &hc, &he);
+		bench_rbtree(num, ops, &tc, &te);
+		printf("%8d %14.1f %14.1f %14.1f %14.1f\n", num, hc, tc, he,
+			te);
+	}
+	event_base_free(b.base);
+	return 0;
+}
@@ -0,0 +1,332 @@
+/*
+ * test/bench_wirescan.c - dnssec-trigger benchmark of the probe reply checks
+ *
+ * Copyright (c) 2011, NLnet Labs. All rights reserved.
+ *
+ * This software is open source.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the NLNET LABS nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * \file
+ *
+ * This file contains a benchmark of the checks on probe replies.  Every
+ * reply is checked the way the probes do it, with the wirescan module,
+ * and with the ldns packet parse that was used before it.  The replies
+ * are read from hex files, like drill -w writes, or the samples in
+ * test/replies.
+ */
+#include "config.h"
+#include "riggerd/wirescan.h"
+#include <ldns/ldns.h>
+#ifdef HAVE_GETOPT_H
+#include <getopt.h>
+#endif
+#include <ctype.h>
+#include <sys/time.h>
+#include <time.h>
+
+/** default number of times every reply is checked */
+#define BENCH_COUNT 100000
+
+/** a reply that is checked */
+struct reply {
+	/** the file it came from */
+	const char* fname;
+	/** the message */
+	uint8_t wire[LDNS_MAX_PACKETLEN];
+	/** length of the message */
+	size_t len;
+	/** the query name, in presentation format */
+	char qname[LDNS_MAX_DOMAINLEN*4+1];
+	/** the query type */
+	uint16_t qtype;
+};
+
+/** the time now, in nanoseconds */
+static double
+now_nsec(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+	struct timespec ts;
+	if(clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return (double)ts.tv_sec*1e9 + (double)ts.tv_nsec;
+#endif
+	{
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return (double)tv.tv_sec*1e9 + (double)tv.tv_usec*1e3;
+	}
+}
+
+/** read a reply from the hex file, ; starts a comment, returns false
+ * on failure */
+static int
+read_reply(const char* fname, struct reply* r)
+{
+	FILE* in = fopen(fname, "r");
+	ldns_pkt* p = NULL;
+	int c, half = -1;
+	if(!in) {
+		printf("cannot open %s: %s\n", fname, strerror(errno));
+		return 0;
+	}
+	r->fname = fname;
+	r->len = 0;
+	while((c = getc(in)) != EOF) {
+		if(c == ';') {
+			while((c = getc(in)) != EOF && c != '\n')
+				;
+			continue;
+		}
+		if(isspace(c))
+			continue;
+		if(!isxdigit(c) || r->len >= sizeof(r->wire)) {
+			printf("%s: bad hex\n", fname);
+			fclose(in);
+			return 0;
+		}
+		if(half == -1) {
+			half = ldns_hexdigit_to_int((char)c);
+			continue;
+		}
+		r->wire[r->len++] = (uint8_t)(half*16 +
+			ldns_hexdigit_to_int((char)c));
+		half = -1;
+	}
+	fclose(in);
+	/* the question, to know what the probe would check */
+	if(ldns_wire2pkt(&p, r->wire, r->len) != LDNS_STATUS_OK || !p ||
+		ldns_rr_list_rr_count(ldns_pkt_question(p)) != 1) {
+		printf("%s: cannot parse the question\n", fname);
+		ldns_pkt_free(p);
+		return 0;
+	} else {
+		ldns_rr* q = ldns_rr_list_rr(ldns_pkt_question(p), 0);
+		char* s = ldns_rdf2str(ldns_rr_owner(q));
+		if(!s) {
+			ldns_pkt_free(p);
+			return 0;
+		}
+		(void)strlcpy(r->qname, s, sizeof(r->qname));
+		free(s);
+		r->qtype = (uint16_t)ldns_rr_get_type(q);
+	}
+	ldns_pkt_free(p);
+	return 1;
+}
+
+/** check the reply with the wirescan module, like the probes do, returns
+ * true if the reply is fine */
+static int
+check_wirescan(struct reply* r)
+{
+	struct wirescan ws;
+	int rrsig_in_auth = 0;
+	if(wirescan_scan(&ws, r->wire, r->len) != NULL)
+		return 0;
+	if(LDNS_RCODE_WIRE(r->wire) != LDNS_RCODE_NOERROR)
+		return 0;
+	if(!ws.have_opt)
+		return 0;
+	if(r->qtype == LDNS_RR_TYPE_NULL) {
+		if(!wirescan_has_type(&ws, LDNS_SECTION_AUTHORITY,
+			LDNS_RR_TYPE_NSEC3))
+			return 0;
+		rrsig_in_auth = 1;
+	} else if(!wirescan_has_type(&ws, LDNS_SECTION_ANSWER, r->qtype)) {
+		if(r->qtype != LDNS_RR_TYPE_DS)
+			return 0;
+		if(!wirescan_soa_from_parent(&ws, r->qname))
+			return 0;
+		if(!wirescan_has_type(&ws, LDNS_SECTION_AUTHORITY,
+			LDNS_RR_TYPE_NSEC))
+			return 0;
+		rrsig_in_auth = 1;
+	}
+	return wirescan_has_type(&ws, rrsig_in_auth?LDNS_SECTION_AUTHORITY:
+		LDNS_SECTION_ANSWER, LDNS_RR_TYPE_RRSIG);
+}
+
+/** test if type is present in the section of the packet */
+static int
+ldns_has_type(ldns_pkt* p, int t, ldns_pkt_section s)
+{
+	ldns_rr_list *l = ldns_pkt_rr_list_by_type(p, t, s);
+	if(!l)
+		return 0;
+	ldns_rr_list_deep_free(l);
+	return 1;
+}
+
+/** test if the right denial (from parent) is in the packet */
+static int
+ldns_has_denial(ldns_pkt* p, const char* dname)
+{
+	size_t i;
+	int found = 0;
+	ldns_rdf* d = ldns_dname_new_frm_str(dname);
+	ldns_rr_list *l = ldns_pkt_rr_list_by_type(p, LDNS_RR_TYPE_SOA,
+		LDNS_SECTION_AUTHORITY);
+	for(i=0; d && l && i<ldns_rr_list_rr_count(l); i++) {
+		if(ldns_dname_is_subdomain(d, ldns_rr_owner(ldns_rr_list_rr(
+			l, i))))
+			found = 1;
+	}
+	ldns_rr_list_deep_free(l);
+	ldns_rdf_deep_free(d);
+	return found;
+}
+
+/** check the reply with an ldns packet, like the probes did before the
+ * wirescan module, returns true if the reply is fine */
+static int
+check_ldns(struct reply* r)
+{
+	ldns_pkt* p = NULL;
+	int rrsig_in_auth = 0, ok = 0;
+	if(ldns_wire2pkt(&p, r->wire, r->len) != LDNS_STATUS_OK || !p)
+		return 0;
+	if(ldns_pkt_get_rcode(p) != LDNS_RCODE_NOERROR)
+		goto done;
+	/* ldns removes the OPT record from the additional section */
+	if(LDNS_ARCOUNT(r->wire) == 0 ||
+		ldns_pkt_arcount(p) == LDNS_ARCOUNT(r->wire))
+		goto done;
+	if(r->qtype == LDNS_RR_TYPE_NULL) {
+		if(!ldns_has_type(p, LDNS_RR_TYPE_NSEC3,
+			LDNS_SECTION_AUTHORITY))
+			goto done;
+		rrsig_in_auth = 1;
+	} else if(!ldns_has_type(p, r->qtype, LDNS_SECTION_ANSWER)) {
+		if(r->qtype != LDNS_RR_TYPE_DS)
+			goto done;
+		if(!ldns_has_denial(p, r->qname))
+			goto done;
+		if(!ldns_has_type(p, LDNS_RR_TYPE_NSEC,
+			LDNS_SECTION_AUTHORITY))
+			goto done;
+		rrsig_in_auth = 1;
+	}
+	ok = ldns_has_type(p, LDNS_RR_TYPE_RRSIG, rrsig_in_auth?
+		LDNS_SECTION_AUTHORITY:LDNS_SECTION_ANSWER);
+done:
+	ldns_pkt_free(p);
+	return ok;
+}
+
+/** time the check, returns nanoseconds per reply */
+static double
+bench_check(int (*check)(struct reply*), struct reply* r, int count)
+{
+	double start = now_nsec();
+	int i;
+	for(i=0; i<count; i++)
+		(void)(*check)(r);
+	return (now_nsec() - start) / (double)count;
+}
+
+/** print usage and exit */
+static void
+usage(void)
+{
+	printf("usage: bench_wirescan [-n count] file.hex ...\n");
+	printf("checks the DNS replies in the hex files like the probes do,\n");
+	printf("with wirescan and with ldns, and prints the time per reply.\n");
+	printf("-n count	number of checks per reply, default %d\n",
+		BENCH_COUNT);
+	exit(1);
+}
+
+/** getopt global, in case header files fail to declare it. */
+extern int optind;
+/** getopt global, in case header files fail to declare it. */
+extern char* optarg;
+
+/**
+ * main program of the benchmark.
+ * @param argc: number of commandline arguments.
+ * @param argv: array of commandline arguments.
+ * @return: exit status of the program, 1 if the two checks differ.
+ */
+int main(int argc, char* argv[])
+{
+	struct reply* r;
+	int c, i, count = BENCH_COUNT, ret = 0;
+	double t_scan, t_ldns, sum_scan = 0, sum_ldns = 0;
+	while( (c=getopt(argc, argv, "hn:")) != -1) {
+		switch(c) {
+		case 'n':
+			count = atoi(optarg);
+			if(count < 1)
+				usage();
+			break;
+		case 'h':
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if(argc == 0)
+		usage();
+	r = (struct reply*)calloc(1, sizeof(*r));
+	if(!r) {
+		printf("out of memory\n");
+		return 1;
+	}
+	printf("%-28s %6s %4s %12s %12s %8s\n", "reply", "octets", "ok",
+		"wirescan ns", "ldns ns", "speedup");
+	for(i=0; i<argc; i++) {
+		const char* name = strrchr(argv[i], '/');
+		int ok;
+		if(!read_reply(argv[i], r)) {
+			ret = 1;
+			continue;
+		}
+		ok = check_wirescan(r);
+		if(ok != check_ldns(r)) {
+			printf("%s: wirescan says %s, ldns says %s\n", argv[i],
+				ok?"ok":"bad", ok?"bad":"ok");
+			ret = 1;
+		}
+		t_scan = bench_check(&check_wirescan, r, count);
+		t_ldns = bench_check(&check_ldns, r, count);
+		sum_scan += t_scan;
+		sum_ldns += t_ldns;
+		printf("%-28s %6u %4s %12.0f %12.0f %7.1fx\n",
+			name?name+1:argv[i], (unsigned)r->len, ok?"yes":"no",
+			t_scan, t_ldns, t_scan>0?t_ldns/t_scan:0.0);
+	}
+	if(sum_scan > 0)
+		printf("%-28s %6s %4s %12.0f %12.0f %7.1fx\n", "total", "", "",
+			sum_scan, sum_ldns, sum_ldns/sum_scan);
+	free(r);
+	return ret;
+}
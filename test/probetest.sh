@@ -0,0 +1,292 @@
+#!/bin/sh
+#
+# probetest.sh - run the probe of dnssec-triggerd against stub DNS servers
+#
+# Copyright (c) 2011, NLnet Labs. All rights reserved.
+#
+# This software is open source.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+#
+# Redistributions of source code must retain the above copyright notice,
+# this list of conditions and the following disclaimer.
+#
+# Redistributions in binary form must reproduce the above copyright notice,
+# this list of conditions and the following disclaimer in the documentation
+# and/or other materials provided with the distribution.
+#
+# Neither the name of the NLNET LABS nor the names of its contributors may
+# be used to endorse or promote products derived from this software without
+# specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+# A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+# HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+# TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+# PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+# LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+# NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+# SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+# For every scenario a stub DNS server plays the DHCP cache, the root server
+# and the tcp80 resolver, and dnssec-triggerd with noaction probes it.  The
+# decision, the time to the decision and the number of queries are read
+# from the log and printed, and the test fails if the decision is not the
+# expected one.
+#
+# Run it from the build directory, with the daemon, dnssec-trigger-control
+# and dnssec-trigger-control-setup built.  The stub serves on port 53 and
+# 80, that needs root; if possible the test runs in a network namespace of
+# its own, with unshare -rn, otherwise it is skipped.
+
+# settings:
+
+# directory of the test files
+testdir=`dirname "$0"`
+# the scenarios
+scenarios="$testdir/probe.scenarios"
+# seconds to wait for a decision
+DECISION_WAIT=60
+
+# end of settings
+
+usage ( ) {
+	echo "usage: probetest.sh [-s scenarios] [name ...]"
+	echo "	-s file	scenario file, default $scenarios"
+	echo "	name	run only the scenarios with these names"
+	exit 1
+}
+
+error ( ) {
+	echo "$0 fatal error: $1"
+	exit 1
+}
+
+# sleep a short while, if sleep cannot do fractions, a second
+nap ( ) {
+	sleep 0.1 2>/dev/null || sleep 1
+}
+
+while test $# -ne 0; do
+	case $1 in
+	-s)
+	if test $# -eq 1; then usage; fi
+	scenarios="$2"
+	shift
+	;;
+	-*)
+	usage
+	;;
+	*)
+	break
+	;;
+	esac
+	shift
+done
+
+# the stub needs port 53 and 80 on 127.0.0.x, use a namespace for that
+if test -z "$PROBETEST_NS"; then
+	PROBETEST_NS=1
+	export PROBETEST_NS
+	if unshare -rn true >/dev/null 2>&1; then
+		exec unshare -rn /bin/sh "$0" -s "$scenarios" "$@"
+	fi
+	if test "`id -u`" != 0; then
+		echo "probetest: skipped, it needs root or unshare -rn to serve"
+		echo "	DNS on port 53 and 80"
+		exit 0
+	fi
+else
+	ip link set lo up 2>/dev/null || ifconfig lo up 2>/dev/null
+fi
+
+# a python 3 for the stub
+py=""
+for p in "$PYTHON" python3; do
+	if test -n "$p" && "$p" -c \
+		'import sys; sys.exit(sys.version_info[0] < 3)' >/dev/null 2>&1
+	then
+		py="$p"
+		break
+	fi
+done
+if test -z "$py"; then
+	echo "probetest: skipped, python 3 is needed for the stub DNS server"
+	exit 0
+fi
+
+for f in dnssec-triggerd dnssec-trigger-control \
+	dnssec-trigger-control-setup; do
+	if test ! -x "./$f"; then
+		error "./$f not found, run this from the build directory"
+	fi
+done
+test -f "$scenarios" || error "cannot read $scenarios"
+
+dir=`mktemp -d "${TMPDIR:-/tmp}/probetest.XXXXXX"` || error "no temp dir"
+conf="$dir/test.conf"
+stubpid=""
+daemon=""
+trap 'cleanup' 0
+trap 'exit 1' 1 2 15
+
+cleanup ( ) {
+	if test -n "$daemon"; then
+		kill $daemon 2>/dev/null
+		wait $daemon 2>/dev/null
+	fi
+	stop_stub
+	rm -rf "$dir"
+}
+
+stop_stub ( ) {
+	if test -n "$stubpid"; then
+		kill $stubpid 2>/dev/null
+		wait $stubpid 2>/dev/null
+		stubpid=""
+	fi
+}
+
+./dnssec-trigger-control-setup -d "$dir" >"$dir/setup.log" 2>&1 || \
+	error "could not create the keys, see dnssec-trigger-control-setup"
+
+cat >"$conf" <<EOF
+verbosity: 2
+pidfile: "$dir/dnssec-trigger.pid"
+state-file: ""
+logfile: "$dir/dnssec-trigger.log"
+use-syslog: no
+resolvconf: "$dir/resolv.conf"
+noaction: yes
+check-updates: no
+server-key-file: "$dir/dnssec_trigger_server.key"
+server-cert-file: "$dir/dnssec_trigger_server.pem"
+control-key-file: "$dir/dnssec_trigger_control.key"
+control-cert-file: "$dir/dnssec_trigger_control.pem"
+root: 127.0.0.3
+tcp80: 127.0.0.4
+health-interval: 0
+edns-buffer-size: 0
+EOF
+
+control ( ) {
+	./dnssec-trigger-control -c "$conf" "$@" </dev/null
+}
+
+# the queries the stub got from an address, as udp/tcp
+stub_count ( ) {
+	c=`sed -n "s,^$1 [^ ]* udp=\([0-9]*\) tcp=\([0-9]*\)$,\1/\2,p" \
+		"$dir/stub.count" 2>/dev/null`
+	echo "${c:--}"
+}
+
+# the scenarios that are selected on the commandline, all if empty
+names="$*"
+selected ( ) {
+	if test -z "$names"; then return 0; fi
+	for n in $names; do
+		if test "$n" = "$1"; then return 0; fi
+	done
+	return 1
+}
+
+# the decision of the probe in the log
+decision_of ( ) {
+	sed -n -e 's/.*probe done: DNSSEC to cache$/cache/p' \
+		-e 's/.*probe done: DNSSEC to auth direct$/auth/p' \
+		-e 's/.*probe done: DNSSEC to tcp or ssl resolver$/tcp/p' \
+		-e 's/.*probe done: DNSSEC fails$/nodnssec/p' \
+		-e 's/.*probe done: disconnected$/disconnected/p' \
+		-e 's/.*probe done: http fails$/http/p' \
+		-e 's/.*probe done: but still forced insecure$/insecure/p' \
+		"$1" 2>/dev/null | tail -1
+}
+
+# the time and the queries of the probe in the log, as msec and queries
+took_of ( ) {
+	sed -n 's/.*probe took \([0-9]*\) msec, \([0-9]*\) queries.*/\1 \2/p' \
+		"$1" 2>/dev/null | tail -1
+}
+
+fails=0
+runs=0
+printf "%-12s %-12s %7s %7s %7s %7s %7s  %s\n" scenario decision msec \
+	queries cache root tcp80 result
+while read name cache root tcp80 expect; do
+	case "$name" in
+	""|\#*) continue ;;
+	esac
+	selected "$name" || continue
+	runs=`expr $runs + 1`
+	rm -f "$dir/stub.pid" "$dir/stub.count" "$dir/dnssec-trigger.log"
+	"$py" "$testdir/stubdns.py" -p "$dir/stub.pid" -o "$dir/stub.count" \
+		127.0.0.2=$cache 127.0.0.3=$root 127.0.0.4=$tcp80 \
+		</dev/null &
+	stubpid=$!
+	i=0
+	while test ! -f "$dir/stub.pid"; do
+		i=`expr $i + 1`
+		test $i -gt 100 && error "the stub DNS server did not start"
+		nap
+	done
+
+	./dnssec-triggerd -d -c "$conf" </dev/null >/dev/null 2>&1 &
+	daemon=$!
+	i=0
+	while ! control status >/dev/null 2>&1; do
+		i=`expr $i + 1`
+		if test $i -gt 100; then
+			cat "$dir/dnssec-trigger.log" 2>/dev/null
+			error "the daemon did not start"
+		fi
+		nap
+	done
+
+	control submit 127.0.0.2 >/dev/null
+	got=""
+	i=0
+	while test -z "$got"; do
+		decision=`decision_of "$dir/dnssec-trigger.log"`
+		took=`took_of "$dir/dnssec-trigger.log"`
+		if test -n "$decision" -a -n "$took"; then
+			got="$decision $took"
+		else
+			i=`expr $i + 1`
+			test $i -gt `expr $DECISION_WAIT \* 10` && break
+			nap
+		fi
+	done
+	counts="`stub_count 127.0.0.2` `stub_count 127.0.0.3`"
+	counts="$counts `stub_count 127.0.0.4`"
+
+	control stop >/dev/null 2>&1
+	wait $daemon 2>/dev/null
+	daemon=""
+	stop_stub
+
+	if test -z "$got"; then
+		got="none - -"
+	fi
+	set -- $got
+	decision=$1
+	if test "$decision" = "$expect"; then
+		result=ok
+	else
+		result="FAILED, expected $expect"
+		fails=`expr $fails + 1`
+	fi
+	printf "%-12s %-12s %7s %7s %7s %7s %7s  %s\n" "$name" "$decision" \
+		"$2" "$3" $counts "$result"
+done <"$scenarios"
+
+if test $fails -ne 0; then
+	echo "$fails of $runs scenarios failed"
+	exit 1
+fi
+echo "$runs scenarios ok"
+exit 0
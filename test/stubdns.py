@@ -0,0 +1,422 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+#
+# stubdns.py - stub DNS server for the dnssec-trigger probe tests
+#
+# Copyright (c) 2011, NLnet Labs. All rights reserved.
+#
+# This software is open source.  See the LICENSE file for the BSD license.
+"""
+A stub DNS server that answers the probe queries of dnssec-triggerd, with
+a behaviour per address, so that a test can script a network: a DHCP
+cache that strips the signatures, a root server that is unreachable, a
+tcp80 resolver that works.
+
+The answers have the structure the probe checks for, DNSKEY and DS with
+RRSIGs, an NSEC3 nodata, the EDNS OPT record, AA for queries without RD,
+but the keys and signatures are random octets.  The probe does not
+validate, unbound does that.
+
+Usage: stubdns.py [-p pidfile] [-o countfile] ip=behaviour ...
+
+On every ip it listens on UDP port 53 and TCP ports 53, 80 and 443.  The
+behaviours are:
+  ok        answers with DNSSEC
+  ra        like ok, but with the RA flag also on the authority answers
+  noedns    answers without the OPT record and without RRSIGs
+  nodnssec  answers with the OPT record, without RRSIGs
+  servfail  answers SERVFAIL
+  drop      does not answer
+  tc        UDP answers are truncated, TCP answers are complete
+  slowN     answers like ok after N msec
+  mtuN      like ok, but UDP answers longer than N octets are lost
+  loseN     like ok, but the first N UDP queries for a name and type are
+            lost
+
+The number of queries per address is written to the countfile after every
+query, one line per address: ip behaviour udp=N tcp=N.
+"""
+
+import getopt
+import heapq
+import os
+import random
+import select
+import signal
+import socket
+import struct
+import sys
+import time
+
+TYPE_SOA = 6
+TYPE_NULL = 10
+TYPE_OPT = 41
+TYPE_DS = 43
+TYPE_RRSIG = 46
+TYPE_DNSKEY = 48
+TYPE_NSEC3 = 50
+
+RCODE_SERVFAIL = 2
+FLAG_QR = 0x8000
+FLAG_AA = 0x0400
+FLAG_TC = 0x0200
+FLAG_RD = 0x0100
+FLAG_RA = 0x0080
+
+# TCP ports, the DNS port and those of the tcp80 and tcp443 resolvers
+TCP_PORTS = (53, 80, 443)
+
+# the same random keys for every answer of a run
+rnd = random.Random(2011)
+
+
+def random_octets(n):
+    return bytes(rnd.getrandbits(8) for _ in range(n))
+
+
+def wire_name(name):
+    if name in ("", "."):
+        return b"\0"
+    out = b""
+    for label in name.rstrip(".").split("."):
+        out += bytes([len(label)]) + label.encode("ascii")
+    return out + b"\0"
+
+
+def wire_rr(owner, rtype, rdata, ttl=86400):
+    return owner + struct.pack("!HHIH", rtype, 1, ttl, len(rdata)) + rdata
+
+
+def rrsig(covered, labels, signer):
+    return (struct.pack("!HBBIIIH", covered, 8, labels, 86400,
+        int(time.time()) + 86400*14, int(time.time()) - 3600, 20326) +
+        wire_name(signer) + random_octets(256))
+
+
+def labels_of(qname):
+    return len([l for l in qname.rstrip(".").split(".") if l])
+
+
+def parent_zone(qname):
+    labels = qname.rstrip(".").split(".")
+    return ".".join(labels[1:]) + "." if len(labels) > 1 else "."
+
+
+# keys are made once, the root DNSKEY answer is about as large as the real
+KSK = struct.pack("!HBB", 257, 3, 8) + b"\x03\x01\x00\x01" + random_octets(256)
+ZSK = struct.pack("!HBB", 256, 3, 8) + b"\x03\x01\x00\x01" + random_octets(256)
+ZSK2 = struct.pack("!HBB", 256, 3, 8) + b"\x03\x01\x00\x01" + random_octets(256)
+
+
+class Query:
+    """A parsed query, only what is needed for the answer."""
+
+    def __init__(self, wire):
+        if len(wire) < 12:
+            raise ValueError("short query")
+        (self.qid, self.flags, qdcount, ancount, nscount,
+            arcount) = struct.unpack("!HHHHHH", wire[:12])
+        if self.flags & FLAG_QR or qdcount != 1:
+            raise ValueError("not a query")
+        pos = 12
+        labels = []
+        while True:
+            n = wire[pos]
+            pos += 1
+            if n == 0:
+                break
+            if n & 0xc0:
+                raise ValueError("compressed qname")
+            labels.append(wire[pos:pos+n].decode("ascii", "replace"))
+            pos += n
+        self.qname = ".".join(labels) + "."
+        self.question = wire[12:pos+4]
+        self.qtype, = struct.unpack("!H", wire[pos:pos+2])
+        pos += 4
+        self.edns = False
+        self.do = False
+        self.udpsize = 512
+        if arcount > 0 and wire[pos:pos+3] == b"\0\0\x29":
+            # the OPT record
+            self.edns = True
+            self.udpsize, ttl = struct.unpack("!HI", wire[pos+3:pos+9])
+            self.do = (ttl & 0x8000) != 0
+            if self.udpsize < 512:
+                self.udpsize = 512
+
+
+def answer(q, behaviour, ra=False):
+    """Make the answer to the query, with RA also without RD if ra."""
+    flags = FLAG_QR | (q.flags & FLAG_RD)
+    if q.flags & FLAG_RD:
+        flags |= FLAG_RA
+    else:
+        flags |= FLAG_AA
+        if ra:
+            flags |= FLAG_RA
+    if behaviour == "servfail":
+        flags = (flags & ~FLAG_AA) | RCODE_SERVFAIL
+        return header(q, flags, 0, 0, 0) + q.question
+    sigs = q.do and behaviour not in ("noedns", "nodnssec")
+    opt = q.edns and behaviour != "noedns"
+    ptr = b"\xc0\x0c"
+    an = []
+    ns = []
+    if q.qtype == TYPE_DNSKEY:
+        an = [wire_rr(ptr, TYPE_DNSKEY, k) for k in (KSK, ZSK, ZSK2)]
+        if sigs:
+            an.append(wire_rr(ptr, TYPE_RRSIG, rrsig(TYPE_DNSKEY,
+                labels_of(q.qname), q.qname)))
+    elif q.qtype == TYPE_DS:
+        an = [wire_rr(ptr, TYPE_DS, struct.pack("!HBB", 20326, 8, 2) +
+            random_octets(32))]
+        if sigs:
+            an.append(wire_rr(ptr, TYPE_RRSIG, rrsig(TYPE_DS,
+                labels_of(q.qname), parent_zone(q.qname))))
+    else:
+        # nodata, with NSEC3 for the probe type, the zone is the parent
+        zone = parent_zone(q.qname)
+        zname = wire_name(zone)
+        soa = (wire_name("ns." + zone) + wire_name("hostmaster." + zone) +
+            struct.pack("!IIIII", 2011101600, 1800, 900, 604800, 3600))
+        ns.append(wire_rr(zname, TYPE_SOA, soa, 3600))
+        if sigs:
+            ns.append(wire_rr(zname, TYPE_RRSIG, rrsig(TYPE_SOA,
+                labels_of(zone), zone)))
+        owner = wire_name("8n4pl5v1l0sdqonjmdhhqh8fspgvl7qe." + zone)
+        nsec3 = (struct.pack("!BBHB", 1, 1, 1, 4) + random_octets(4) +
+            bytes([20]) + random_octets(20) + b"\x00\x03\x00\x00\x80")
+        if q.qtype == TYPE_NULL:
+            ns.append(wire_rr(owner, TYPE_NSEC3, nsec3, 3600))
+            if sigs:
+                ns.append(wire_rr(owner, TYPE_RRSIG, rrsig(TYPE_NSEC3,
+                    labels_of(zone)+1, zone)))
+    ar = []
+    if opt:
+        ar.append(b"\0" + struct.pack("!HHIH", TYPE_OPT, 4096,
+            0x8000 if q.do else 0, 0))
+    return (header(q, flags, len(an), len(ns), len(ar)) + q.question +
+        b"".join(an) + b"".join(ns) + b"".join(ar))
+
+
+def header(q, flags, an, ns, ar):
+    return struct.pack("!HHHHHH", q.qid, flags, 1, an, ns, ar)
+
+
+def truncated(q, ans):
+    """The truncated UDP answer, only the header and question."""
+    flags, = struct.unpack("!H", ans[2:4])
+    return header(q, flags | FLAG_TC, 0, 0, 0) + q.question
+
+
+class Listener:
+    """The sockets and counts of one address."""
+
+    def __init__(self, ip, behaviour):
+        self.ip = ip
+        self.behaviour = behaviour
+        self.delay = 0
+        self.mtu = 0
+        self.ra = False
+        self.lose = 0
+        self.lost = {}
+        if behaviour.startswith("slow"):
+            self.delay = int(behaviour[4:] or "500") / 1000.0
+            behaviour = "ok"
+        elif behaviour.startswith("mtu"):
+            self.mtu = int(behaviour[3:] or "1232")
+            behaviour = "ok"
+        elif behaviour.startswith("lose"):
+            self.lose = int(behaviour[4:] or "1")
+            behaviour = "ok"
+        elif behaviour == "ra":
+            self.ra = True
+            behaviour = "ok"
+        if behaviour not in ("ok", "noedns", "nodnssec", "servfail", "drop",
+                "tc"):
+            raise ValueError("unknown behaviour %s" % self.behaviour)
+        self.kind = behaviour
+        self.udp_count = 0
+        self.tcp_count = 0
+        fam = socket.AF_INET6 if ":" in ip else socket.AF_INET
+        self.udp = socket.socket(fam, socket.SOCK_DGRAM)
+        self.udp.bind((ip, 53))
+        self.tcp = []
+        for port in TCP_PORTS:
+            s = socket.socket(fam, socket.SOCK_STREAM)
+            s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+            s.bind((ip, port))
+            s.listen(16)
+            self.tcp.append(s)
+
+
+class Server:
+    """The event loop for all the listeners."""
+
+    def __init__(self, listeners, countfile):
+        self.listeners = listeners
+        self.countfile = countfile
+        self.conns = {}
+        self.timers = []
+        self.seq = 0
+        self.write_counts()
+
+    def write_counts(self):
+        if not self.countfile:
+            return
+        tmp = self.countfile + ".tmp"
+        with open(tmp, "w") as f:
+            for l in self.listeners:
+                f.write("%s %s udp=%d tcp=%d\n" % (l.ip, l.behaviour,
+                    l.udp_count, l.tcp_count))
+        os.rename(tmp, self.countfile)
+
+    def later(self, delay, func, *args):
+        self.seq += 1
+        heapq.heappush(self.timers, (time.monotonic() + delay, self.seq,
+            func, args))
+
+    def reply(self, l, wire, send):
+        try:
+            q = Query(wire)
+        except (ValueError, IndexError, struct.error):
+            return
+        if l.kind == "drop":
+            return
+        ans = answer(q, l.kind, l.ra)
+        if l.delay:
+            self.later(l.delay, send, q, ans)
+        else:
+            send(q, ans)
+
+    def udp_send(self, l, addr):
+        def send(q, ans):
+            if l.kind == "tc" or len(ans) > q.udpsize:
+                ans = truncated(q, ans)
+            elif l.mtu and len(ans) > l.mtu:
+                # the fragments are lost on the path
+                return
+            if l.lose:
+                key = (q.qname.lower(), q.qtype)
+                l.lost[key] = l.lost.get(key, 0) + 1
+                if l.lost[key] <= l.lose:
+                    return
+            l.udp.sendto(ans, addr)
+        return send
+
+    def tcp_send(self, s):
+        def send(q, ans):
+            if s.fileno() == -1:
+                return
+            try:
+                s.sendall(struct.pack("!H", len(ans)) + ans)
+            except OSError:
+                self.tcp_close(s)
+        return send
+
+    def tcp_close(self, s):
+        self.conns.pop(s, None)
+        s.close()
+
+    def tcp_read(self, s):
+        l, buf = self.conns[s]
+        try:
+            data = s.recv(65535)
+        except OSError:
+            data = b""
+        if not data:
+            self.tcp_close(s)
+            return
+        buf += data
+        while len(buf) >= 2:
+            n, = struct.unpack("!H", buf[:2])
+            if len(buf) < 2 + n:
+                break
+            l.tcp_count += 1
+            self.write_counts()
+            self.reply(l, buf[2:2+n], self.tcp_send(s))
+            buf = buf[2+n:]
+        self.conns[s] = (l, buf)
+
+    def run(self):
+        udp = dict((l.udp, l) for l in self.listeners)
+        accept = dict((s, l) for l in self.listeners for s in l.tcp)
+        while True:
+            timeout = None
+            if self.timers:
+                timeout = max(0, self.timers[0][0] - time.monotonic())
+            rd = list(udp) + list(accept) + list(self.conns)
+            ready, _, _ = select.select(rd, [], [], timeout)
+            for s in ready:
+                if s in udp:
+                    l = udp[s]
+                    try:
+                        wire, addr = s.recvfrom(65535)
+                    except OSError:
+                        continue
+                    l.udp_count += 1
+                    self.write_counts()
+                    self.reply(l, wire, self.udp_send(l, addr))
+                elif s in accept:
+                    try:
+                        c, _ = s.accept()
+                    except OSError:
+                        continue
+                    self.conns[c] = (accept[s], b"")
+                elif s in self.conns:
+                    self.tcp_read(s)
+            now = time.monotonic()
+            while self.timers and self.timers[0][0] <= now:
+                _, _, func, args = heapq.heappop(self.timers)
+                func(*args)
+
+
+def usage():
+    print(__doc__.strip())
+    sys.exit(1)
+
+
+def main(argv):
+    pidfile = None
+    countfile = None
+    try:
+        opts, args = getopt.getopt(argv, "hp:o:")
+    except getopt.GetoptError as e:
+        print("error: %s" % e)
+        usage()
+    for o, a in opts:
+        if o == "-p":
+            pidfile = a
+        elif o == "-o":
+            countfile = a
+        else:
+            usage()
+    if not args:
+        usage()
+    listeners = []
+    for arg in args:
+        if "=" not in arg:
+            usage()
+        ip, behaviour = arg.split("=", 1)
+        try:
+            listeners.append(Listener(ip, behaviour))
+        except (ValueError, OSError) as e:
+            print("stubdns: %s: %s" % (arg, e), file=sys.stderr)
+            sys.exit(1)
+    server = Server(listeners, countfile)
+    signal.signal(signal.SIGTERM, lambda sig, frame: sys.exit(0))
+    if pidfile:
+        # the sockets are bound, the test can start
+        with open(pidfile, "w") as f:
+            f.write("%d\n" % os.getpid())
+    try:
+        server.run()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if pidfile:
+            os.unlink(pidfile)
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
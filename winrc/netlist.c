@@ -462,7 +462,7 @@ static HANDLE notify_nets(void)
 		/* start the probe for the notified IPs from up networks */
 		fetch_wlan_ssid(ssid, sizeof(ssid));
 		if(has_changed(netnames, result, ssid)) {
-			probe_start(result);
+			probe_submit(result);
 		}
 		return lookup;
 	}
@@ -51,6 +51,7 @@
 #include "riggerd/cfg.h"
 #include "riggerd/svr.h"
 #include "riggerd/reshook.h"
+#include "riggerd/ubhook.h"
 #include "riggerd/netevent.h"
 #include "riggerd/net_help.h"
 #include "riggerd/fptr_wlist.h"
@@ -331,6 +332,7 @@ service_deinit(struct svr* svr, struct cfg* cfg)
 	if(svr->insecure_state)
 		hook_resolv_localhost(cfg);
 	svr_delete(svr);
+	hook_unbound_cleanup();
 	cfg_delete(cfg);
 }
 